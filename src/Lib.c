@@ -1,5 +1,23 @@
 #include "Lib.h"
+#include "arena.h"
 #include "b_tree.h"
+#include "buddy.h"
+#include "cpucache.h"
+#include "guard.h"
+#include "latency.h"
+#include "pagemap.h"
+#include "pheap.h"
+#include "pool.h"
+#include "profiler.h"
+#include "region.h"
+#include "remotefree.h"
+#include "scavenger.h"
+#include "shard.h"
+#include "nodepool.h"
+#include "sizecache.h"
+#include "telemetry.h"
+#include "tlsf.h"
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -8,6 +26,19 @@
 static int initialized = 0;
 static FILE* log_file = NULL;
 
+// Дерево и области не потокобезопасны: все публичные функции работают под этой блокировкой
+static pthread_mutex_t alloc_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_t scavenger_thread;
+static pthread_cond_t scavenger_cond = PTHREAD_COND_INITIALIZER;
+static int scavenger_running = 0;
+static unsigned scavenger_interval_ms = SCAVENGE_DEFAULT_INTERVAL_MS;
+static size_t scavenger_budget = SCAVENGE_DEFAULT_BUDGET;
+static int engine = TREEALOC_ENGINE_BESTFIT;
+static RemoteQueue remote_queue = REMOTE_QUEUE_INIT;
+static int remote_free_on = 0;
+static size_t isolation_threshold = 0;
+
 void log_to_file(const char* message) {
     if (!log_file) return;
     time_t now = time(NULL);
@@ -16,8 +47,71 @@ void log_to_file(const char* message) {
     fprintf(log_file, "[%s] %s\n", timestamp, message);
 }
 
-void* treealoc_malloc(size_t size) {
+static size_t round_to(size_t size, size_t align) {
+    size_t rounded = (size + align - 1) & ~(align - 1);
+    return rounded ? rounded : align;
+}
+
+static size_t round_block_size(size_t size) {
+    return round_to(size, REGION_ALIGN);
+}
+
+// Изолированный блок начинается со строки кэша и занимает целые строки,
+// поэтому ни одна его строка не делится с другим блоком
+static inline size_t placement_align(size_t size, int flags) {
+    if ((flags & TREEALOC_F_ISOLATED) || (isolation_threshold && size >= isolation_threshold)) return TREEALOC_CACHE_LINE;
+    return REGION_ALIGN;
+}
+
+static void publish_released(void) {
+    atomic_store_explicit(&telemetry->released_to_os, scavenger_released_bytes(), memory_order_relaxed);
+}
+
+// Разбор smaps дорогой, поэтому покрытие обновляется только из trim/сборщика и по запросу
+static void publish_hugepages(void) {
+    atomic_store_explicit(&telemetry->mapped_bytes, region_mapped_bytes(), memory_order_relaxed);
+    atomic_store_explicit(&telemetry->huge_backed_bytes, region_huge_backed_bytes(), memory_order_relaxed);
+}
+
+// Выделяет блок и сообщает участок [*zero_lo, *zero_hi), заведомо заполненный нулями:
+// весь блок для свежей памяти из mmap, страницы после MADV_DONTNEED для повторно выданного.
+// align - REGION_ALIGN или строка кэша (placement_align)
+static void* alloc_locked(size_t size, size_t align, uintptr_t* zero_lo, uintptr_t* zero_hi) {
     char log_msg[128];
+    uint64_t start_ns = telemetry_now_ns();
+    TELEMETRY_INC(allocs);
+    if (pheap_active()) {
+        // Хвост файла мог остаться от откатанной эпохи, поэтому он не считается нулевым
+        void* ptr = pheap_malloc(size);
+        *zero_lo = *zero_hi = (uintptr_t)ptr;
+        return ptr;
+    }
+    if (guard_should_sample(size)) {
+        void* ptr = guard_alloc(size, zero_lo, zero_hi);
+        if (ptr) {
+            telemetry_record_latency(start_ns);
+            return ptr;
+        }
+    }
+    // Изолированные блоки выдаёт best-fit: у блоков TLSF заголовок, у мелких блоков близнецов общие строки
+    if (align == REGION_ALIGN && engine == TREEALOC_ENGINE_TLSF) {
+        // Без отладочного вывода: путь TLSF должен укладываться в жёсткую границу задержки
+        void* ptr = tlsf_malloc(size);
+        *zero_lo = *zero_hi = (uintptr_t)ptr;
+        if (!ptr) log_to_file("[ERROR] malloc failed");
+        telemetry_record_latency(start_ns);
+        return ptr;
+    }
+    if (align == REGION_ALIGN && engine == TREEALOC_ENGINE_BUDDY) {
+        void* ptr = buddy_malloc(size);
+        if (ptr || size <= BUDDY_MAX_BLOCK) {
+            *zero_lo = *zero_hi = (uintptr_t)ptr;
+            if (!ptr) log_to_file("[ERROR] malloc failed");
+            telemetry_record_latency(start_ns);
+            return ptr;
+        }
+        // Больше пула: такой блок выдаётся обычным путём из отдельного отображения
+    }
     printf("[DEBUG] Inside treealoc_malloc(%zu)\n", size);
     snprintf(log_msg, sizeof(log_msg), "[DEBUG] Inside treealoc_malloc(%zu)", size);
     log_to_file(log_msg);
@@ -26,57 +120,282 @@ void* treealoc_malloc(size_t size) {
     snprintf(log_msg, sizeof(log_msg), "[DEBUG] root = %p", root);
     log_to_file(log_msg);
 
-    void* ptr = btree_find_best_fit(size);
+    size_t block_size = round_to(size, align);
+    void* ptr = align == REGION_ALIGN ? sizecache_pop(block_size) : NULL;
+    if (ptr) {
+        // Блок освобождён через free_sized и для дерева остаётся занятым
+        TELEMETRY_INC(reuse_hits);
+        *zero_lo = *zero_hi = (uintptr_t)ptr;
+        telemetry_record_latency(start_ns);
+        return ptr;
+    }
+    ptr = align == REGION_ALIGN ? btree_find_best_fit(block_size) : btree_find_best_fit_aligned(block_size, align);
     if (ptr) {
+        TELEMETRY_INC(reuse_hits);
+        // Забирается вся ёмкость: realloc пишет в неё на месте, не проходя через claim
+        scavenger_claim(0, ptr, btree_block_size(ptr), zero_lo, zero_hi);
+        // Метки кэшей с прошлого освобождения: блок снова занят
+        sizecache_unmark(ptr);
+        cpucache_unmark(ptr);
+        publish_released();
         printf("[treealoc] Reused free block %p (size %zu)\n", ptr, size);
         snprintf(log_msg, sizeof(log_msg), "[treealoc] Reused free block %p (size %zu)", ptr, size);
         log_to_file(log_msg);
+        telemetry_record_latency(start_ns);
         return ptr;
     }
+    TELEMETRY_INC(reuse_misses);
 
-    ptr = malloc(size);
+    ptr = region_alloc_aligned(0, block_size, align);
     if (!ptr) {
         printf("[ERROR] malloc failed\n");
         log_to_file("[ERROR] malloc failed");
+        telemetry_record_latency(start_ns);
         return NULL;
     }
-    btree_insert(size, ptr);
+    btree_insert(block_size, ptr);
+    *zero_lo = (uintptr_t)ptr;
+    *zero_hi = (uintptr_t)ptr + block_size;
     printf("[treealoc] malloc(%zu) = %p\n", size, ptr);
     snprintf(log_msg, sizeof(log_msg), "[treealoc] malloc(%zu) = %p", size, ptr);
     log_to_file(log_msg);
+    telemetry_record_latency(start_ns);
     return ptr;
 }
 
-void* treealoc_realloc(void* ptr, size_t size) {
+static void* malloc_locked(size_t size) {
+    uintptr_t zero_lo, zero_hi;
+    return alloc_locked(size, placement_align(size, 0), &zero_lo, &zero_hi);
+}
+
+// Шард, из дерева которого выдан блок области; 0 - основная куча или не блок области
+static int shard_of(void* ptr) {
+    Span* span = pagemap_lookup(ptr);
+    return span && span->kind == SPAN_REGION ? region_shard(span) : 0;
+}
+
+// Ёмкость блока, начинающегося с ptr, или 0 для чужого указателя.
+// Владелец находится по карте страниц; дерево нужно только для крупных блоков без записи в карте размеров.
+static size_t usable_size_locked(void* ptr) {
+    Span* span = pagemap_lookup(ptr);
+    if (!span) return 0;
+    if (span->kind == SPAN_PHEAP) return pheap_usable_size(ptr);
+    if (span->kind == SPAN_GUARD) return guard_usable_size(ptr);
+    if (span->kind == SPAN_TLSF) return tlsf_usable_size(span, ptr);
+    if (span->kind == SPAN_BUDDY) return buddy_usable_size(span, ptr);
+    size_t size = region_block_size(span, ptr);
+    if (size == REGION_SIZE_UNKNOWN) {
+        if (region_shard(span)) return shard_usable_size(region_shard(span), ptr);
+        int index;
+        BNode* node = find_node(root, ptr, &index);
+        size = node ? bnode_size(node, index) : 0;
+    }
+    return size;
+}
+
+static void free_locked(void* ptr) {
     char log_msg[128];
-    if (!ptr) return treealoc_malloc(size);
-    if (size == 0) {
-        treealoc_free(ptr);
-        return NULL;
+    if (ptr) {
+        uint64_t start_ns = telemetry_now_ns();
+        TELEMETRY_INC(frees);
+        Span* span = pagemap_lookup(ptr);
+        if (span && span->kind == SPAN_PHEAP) {
+            pheap_free(ptr);
+            telemetry_record_latency(start_ns);
+            return;
+        }
+        if (span && span->kind == SPAN_GUARD) {
+            guard_free(ptr);
+            telemetry_record_latency(start_ns);
+            return;
+        }
+        if (span && span->kind == SPAN_REGION && region_shard(span)) {
+            shard_free(region_shard(span), ptr, 0);
+            telemetry_record_latency(start_ns);
+            return;
+        }
+        if (span && (span->kind == SPAN_TLSF || span->kind == SPAN_BUDDY)) {
+            if ((span->kind == SPAN_TLSF ? tlsf_free(span, ptr) : buddy_free(span, ptr)) != 0) {
+                printf("[treealoc] free(%p): not a live treealoc block\n", ptr);
+                snprintf(log_msg, sizeof(log_msg), "[treealoc] free(%p): not a live treealoc block", ptr);
+                log_to_file(log_msg);
+            }
+            telemetry_record_latency(start_ns);
+            return;
+        }
+        // Чужой указатель или указатель внутрь блока отсекается по карте страниц без спуска по дереву.
+        // Блок остаётся в дереве свободным и может быть выдан повторно.
+        if (!span || !region_block_size(span, ptr) || !btree_mark_free(ptr)) {
+            printf("[treealoc] free(%p): not a live treealoc block\n", ptr);
+            snprintf(log_msg, sizeof(log_msg), "[treealoc] free(%p): not a live treealoc block", ptr);
+            log_to_file(log_msg);
+            telemetry_record_latency(start_ns);
+            return;
+        }
+        telemetry_record_latency(start_ns);
+        printf("[treealoc] Freed %p\n", ptr);
+        snprintf(log_msg, sizeof(log_msg), "[treealoc] Freed %p", ptr);
+        log_to_file(log_msg);
     }
+}
+
+// Кэш процессора обслуживает только блоки областей движка best-fit
+static inline int cpucache_usable(void) {
+    return cpucache_enabled() && engine == TREEALOC_ENGINE_BESTFIT && !pheap_active();
+}
 
+// Блок области уходит в кэш процессора без блокировки; 0 - нужен обычный путь
+static int cpucache_release(void* ptr) {
+    if (!ptr || !cpucache_usable()) return 0;
+    Span* span = pagemap_lookup(ptr);
+    if (!span || span->kind != SPAN_REGION) return 0;
+    size_t capacity = region_block_size(span, ptr);
+    return capacity && capacity != REGION_SIZE_UNKNOWN && cpucache_push(ptr, capacity);
+}
+
+// Отложенные освобождения других потоков: в кэш процессора или в дерево
+static void release_remote(void* ptr) {
+    if (!cpucache_release(ptr)) free_locked(ptr);
+}
+
+static void drain_remote(void) {
+    remote_drain(&remote_queue, release_remote);
+}
+
+// Получивший блокировку первым делом освобождает накопленное другими потоками
+static void lock_heap(void) {
+    pthread_mutex_lock(&alloc_lock);
+    drain_remote();
+}
+
+static void release_cached(void* ptr) {
+    int shard = shard_of(ptr);
+    if (shard) shard_free(shard, ptr, 0);
+    else btree_mark_free(ptr);
+}
+
+// Кэши free_sized и процессоров сливаются в дерево перед всем, что смотрит на свободные блоки дерева
+static void drain_caches(void) {
+    drain_remote();
+    sizecache_drain(release_cached);
+    cpucache_drain(release_cached);
+}
+
+static void free_sized_locked(void* ptr, size_t size) {
+    if (!ptr) return;
+    Span* span = pagemap_lookup(ptr);
+    size_t capacity = span && span->kind == SPAN_REGION ? region_block_size(span, ptr) : 0;
+    size_t block_size = round_block_size(size);
+    if (!capacity || (capacity != REGION_SIZE_UNKNOWN && capacity < block_size)) {
+        // Не блок области или размер больше ёмкости: обычный путь разберётся и запишет ошибку
+        free_locked(ptr);
+        return;
+    }
+    // Повторное освобождение: блок с меткой кэша либо ещё лежит в кэше, либо слит в дерево свободным.
+    // Без метки проверки нет - дерево здесь не спрашивается (кроме отладочной сборки).
+    size_t cached_size = sizecache_marked(ptr);
+    if (cached_size) {
+        int index;
+        BNode* node;
+        if (sizecache_contains(ptr, cached_size) ||
+            ((node = find_node(root, ptr, &index)) && bnode_is_free(node, index))) {
+            char log_msg[128];
+            printf("[treealoc] free_sized(%p, %zu): double free\n", ptr, size);
+            snprintf(log_msg, sizeof(log_msg), "[treealoc] free_sized(%p, %zu): double free", ptr, size);
+            log_to_file(log_msg);
+            return;
+        }
+    }
+#ifdef TREEALOC_DEBUG
+    // Отладочная сборка сверяет размер с деревом - ровно тот спуск, который здесь экономится
     int index;
     BNode* node = find_node(root, ptr, &index);
-    if (node && size <= node->sizes[index]) {
-        node->sizes[index] = size;
+    if (!node || bnode_is_free(node, index) || bnode_size(node, index) < block_size) {
+        char log_msg[128];
+        printf("[treealoc] free_sized(%p, %zu): size does not match the block\n", ptr, size);
+        snprintf(log_msg, sizeof(log_msg), "[treealoc] free_sized(%p, %zu): size does not match the block", ptr, size);
+        log_to_file(log_msg);
+        if (node && !bnode_is_free(node, index)) free_locked(ptr);
+        return;
+    }
+#endif
+    uint64_t start_ns = telemetry_now_ns();
+    if (!sizecache_push(ptr, block_size)) {
+        free_locked(ptr);
+        return;
+    }
+    TELEMETRY_INC(frees);
+    telemetry_record_latency(start_ns);
+}
+
+// Блок кучи, занятой другим потоком, уходит в очередь без ожидания; 0 - нужен обычный путь.
+// sized - освобождение через free_sized с размером size.
+static int free_or_defer(void* ptr, size_t size, int sized) {
+    if (!ptr || !remote_free_on) return 0;
+    if (pthread_mutex_trylock(&alloc_lock) == 0) {
+        drain_remote();
+        if (sized) free_sized_locked(ptr, size);
+        else free_locked(ptr);
+        pthread_mutex_unlock(&alloc_lock);
+        return 1;
+    }
+    // Ссылка очереди пишется в сам блок, поэтому чужие указатели и указатели внутрь блока отсекаются заранее
+    Span* span = pagemap_lookup(ptr);
+    if (!span || ((uintptr_t)ptr & (sizeof(void*) - 1))) return 0;
+    if (span->kind == SPAN_REGION && !region_block_size(span, ptr)) return 0;
+    remote_push(&remote_queue, ptr);
+    return 1;
+}
+
+static void* realloc_locked(void* ptr, size_t size) {
+    char log_msg[128];
+    TELEMETRY_INC(reallocs);
+    if (!ptr) return malloc_locked(size);
+    if (size == 0) {
+        free_locked(ptr);
+        return NULL;
+    }
+    Span* span = pagemap_lookup(ptr);
+    if (span && span->kind == SPAN_PHEAP) {
+        size_t old_size = pheap_usable_size(ptr);
+        if (size <= old_size) return ptr;
+        void* moved = pheap_malloc(size);
+        if (moved) {
+            memcpy(moved, ptr, old_size);
+            pheap_free(ptr);
+        }
+        return moved;
+    }
+    if (span && span->kind == SPAN_GUARD) {
+        // Блок на защищённой странице не растёт на месте: выход за размер должен ловиться
+        size_t old_size = guard_usable_size(ptr);
+        if (size <= old_size) return ptr;
+        void* moved = malloc_locked(size);
+        if (moved) {
+            memcpy(moved, ptr, old_size);
+            free_locked(ptr);
+        }
+        return moved;
+    }
+
+    size_t old_size = usable_size_locked(ptr);
+    if (old_size && size <= old_size) {
+        // Ёмкость блока сохраняется, чтобы хвост можно было снова использовать после free
         printf("[treealoc] Shrunk block %p to %zu\n", ptr, size);
         snprintf(log_msg, sizeof(log_msg), "[treealoc] Shrunk block %p to %zu", ptr, size);
         log_to_file(log_msg);
         return ptr;
     }
-
-    void* new_ptr = malloc(size);
+    void* new_ptr = malloc_locked(size);
     if (!new_ptr) {
         printf("[ERROR] realloc failed\n");
         log_to_file("[ERROR] realloc failed");
         return NULL;
     }
-    if (node) {
-        size_t old_size = node->sizes[index];
+    if (old_size) {
         memcpy(new_ptr, ptr, old_size < size ? old_size : size);
-        treealoc_free(ptr);
+        free_locked(ptr);
     }
-    btree_insert(size, new_ptr);
     printf("[treealoc] realloc(%p, %zu) = ", ptr, size);
     snprintf(log_msg, sizeof(log_msg), "[treealoc] realloc(%p, %zu) = ", ptr, size);
     log_to_file(log_msg);
@@ -86,17 +405,33 @@ void* treealoc_realloc(void* ptr, size_t size) {
     return new_ptr;
 }
 
-void* treealoc_calloc(size_t nmemb, size_t size) {
+// Обнуляется только то, что не известно как нулевое; нетронутые страницы не подгружаются
+static void clear_outside(void* ptr, size_t total, uintptr_t zero_lo, uintptr_t zero_hi) {
+    uintptr_t lo = (uintptr_t)ptr;
+    uintptr_t hi = lo + total;
+    if (zero_hi > hi) zero_hi = hi;
+    if (zero_lo >= zero_hi) {
+        memset(ptr, 0, total);
+    } else {
+        memset(ptr, 0, zero_lo - lo);
+        memset((void*)zero_hi, 0, hi - zero_hi);
+        TELEMETRY_ADD(calloc_zero_skipped, zero_hi - zero_lo);
+    }
+}
+
+static void* calloc_locked(size_t nmemb, size_t size) {
     char log_msg[128];
     size_t total;
+    TELEMETRY_INC(callocs);
     if (__builtin_mul_overflow(nmemb, size, &total)) {
         printf("[ERROR] Calloc size overflow\n");
         log_to_file("[ERROR] Calloc size overflow");
         return NULL;
     }
-    void* ptr = treealoc_malloc(total);
+    uintptr_t zero_lo, zero_hi;
+    void* ptr = alloc_locked(total, placement_align(total, 0), &zero_lo, &zero_hi);
     if (ptr) {
-        memset(ptr, 0, total);
+        clear_outside(ptr, total, zero_lo, zero_hi);
         printf("[treealoc] calloc(%zu, %zu) = %p\n", nmemb, size, ptr);
         snprintf(log_msg, sizeof(log_msg), "[treealoc] calloc(%zu, %zu) = %p", nmemb, size, ptr);
         log_to_file(log_msg);
@@ -104,16 +439,414 @@ void* treealoc_calloc(size_t nmemb, size_t size) {
     return ptr;
 }
 
+// Шард потока; 0 - основная куча. Шарды есть только у движка best-fit.
+static inline int thread_shard(void) {
+    return engine == TREEALOC_ENGINE_BESTFIT && !pheap_active() ? shard_for_thread() : 0;
+}
+
+// Выделение из шарда: счётчики телеметрии и выборка защитных страниц - как у основной кучи.
+// Пул защитных страниц общий, поэтому блокировка аллокатора берётся, только когда выборка сработала.
+static void* shard_malloc(int shard, size_t size, size_t align, uintptr_t* zero_lo, uintptr_t* zero_hi) {
+    uint64_t start_ns = telemetry_now_ns();
+    TELEMETRY_INC(allocs);
+    // Общая блокировка берётся только для выбранного выделения: пул защитных страниц один на всех
+    if (guard_enabled() && align == REGION_ALIGN && guard_should_sample(size)) {
+        pthread_mutex_lock(&alloc_lock);
+        void* ptr = guard_alloc(size, zero_lo, zero_hi);
+        pthread_mutex_unlock(&alloc_lock);
+        if (ptr) {
+            telemetry_record_latency(start_ns);
+            return ptr;
+        }
+    }
+    void* ptr = shard_alloc(shard, size, align, zero_lo, zero_hi);
+    telemetry_record_latency(start_ns);
+    return ptr;
+}
+
+static void shard_release(int shard, void* ptr) {
+    uint64_t start_ns = telemetry_now_ns();
+    TELEMETRY_INC(frees);
+    shard_free(shard, ptr, remote_free_on);
+    telemetry_record_latency(start_ns);
+}
+
+// Блоки кэша процессора выровнены только по грануле, поэтому изолированные берутся мимо него
+static void* malloc_placed(size_t size, size_t align) {
+    void* ptr = align == REGION_ALIGN && cpucache_usable() ? cpucache_pop(round_block_size(size)) : NULL;
+    if (!ptr) {
+        int shard = thread_shard();
+        if (shard) {
+            uintptr_t zero_lo, zero_hi;
+            ptr = shard_malloc(shard, size, align, &zero_lo, &zero_hi);
+        } else {
+            uintptr_t zero_lo, zero_hi;
+            lock_heap();
+            ptr = alloc_locked(size, align, &zero_lo, &zero_hi);
+            pthread_mutex_unlock(&alloc_lock);
+        }
+    }
+    return ptr;
+}
+
+void* treealoc_malloc(size_t size) {
+    uint64_t start = latency_start(); // Вместе с ожиданием блокировки: это часть задержки
+    void* ptr = malloc_placed(size, placement_align(size, 0));
+    latency_stop(LAT_MALLOC, start);
+    return ptr;
+}
+
+void* treealoc_malloc_flags(size_t size, int flags) {
+    uint64_t start = latency_start();
+    void* ptr = malloc_placed(size, placement_align(size, flags));
+    latency_stop(LAT_MALLOC, start);
+    return ptr;
+}
+
+void treealoc_set_node_layout(int mode) {
+    if (mode < TREEALOC_LAYOUT_NONE || mode > TREEALOC_LAYOUT_VEB) return;
+    pthread_mutex_lock(&alloc_lock);
+    btree_set_layout(mode == TREEALOC_LAYOUT_BFS ? BTREE_LAYOUT_BFS : mode == TREEALOC_LAYOUT_VEB ? BTREE_LAYOUT_VEB : BTREE_LAYOUT_NONE);
+    btree_relayout();
+    pthread_mutex_unlock(&alloc_lock);
+}
+
+void treealoc_set_isolation(size_t threshold) {
+    isolation_threshold = threshold;
+    printf("[treealoc] Cache line isolation: %s%zu bytes\n", threshold ? "from " : "off, ", threshold);
+}
+
+// Блок шарда переносится публичными функциями: новый берётся из шарда текущего потока
+static void* realloc_shard_block(int shard, void* ptr, size_t size) {
+    if (size == 0) {
+        treealoc_free(ptr);
+        return NULL;
+    }
+    Span* span = pagemap_lookup(ptr);
+    size_t old_size = region_block_size(span, ptr);
+    if (old_size == REGION_SIZE_UNKNOWN) old_size = shard_usable_size(shard, ptr);
+    if (old_size && size <= old_size) return ptr;
+    void* new_ptr = treealoc_malloc(size);
+    if (new_ptr && old_size) {
+        memcpy(new_ptr, ptr, old_size);
+        treealoc_free(ptr);
+    }
+    return new_ptr;
+}
+
+void* treealoc_realloc(void* ptr, size_t size) {
+    uint64_t start = latency_start();
+    int shard = ptr ? shard_of(ptr) : thread_shard();
+    if (shard) {
+        TELEMETRY_INC(reallocs);
+        void* new_ptr = ptr ? realloc_shard_block(shard, ptr, size) : treealoc_malloc(size);
+        latency_stop(LAT_REALLOC, start);
+        return new_ptr;
+    }
+    lock_heap();
+    void* new_ptr = realloc_locked(ptr, size);
+    pthread_mutex_unlock(&alloc_lock);
+    latency_stop(LAT_REALLOC, start);
+    return new_ptr;
+}
+
+void* treealoc_calloc(size_t nmemb, size_t size) {
+    uint64_t start = latency_start();
+    int shard = thread_shard();
+    size_t total;
+    if (shard && !__builtin_mul_overflow(nmemb, size, &total)) {
+        TELEMETRY_INC(callocs);
+        uintptr_t zero_lo, zero_hi;
+        void* ptr = shard_malloc(shard, total, placement_align(total, 0), &zero_lo, &zero_hi);
+        if (ptr) clear_outside(ptr, total, zero_lo, zero_hi);
+        latency_stop(LAT_CALLOC, start);
+        return ptr;
+    }
+    lock_heap();
+    void* ptr = calloc_locked(nmemb, size);
+    pthread_mutex_unlock(&alloc_lock);
+    latency_stop(LAT_CALLOC, start);
+    return ptr;
+}
+
+TreealocPool* treealoc_pool_create(size_t object_size, size_t align) {
+    pthread_mutex_lock(&alloc_lock);
+    Pool* pool = pool_create(object_size, align, malloc_locked, free_locked);
+    pthread_mutex_unlock(&alloc_lock);
+    return (TreealocPool*)pool;
+}
+
+void* treealoc_pool_alloc(TreealocPool* pool) {
+    pthread_mutex_lock(&alloc_lock);
+    void* obj = pool_alloc((Pool*)pool);
+    pthread_mutex_unlock(&alloc_lock);
+    return obj;
+}
+
+void treealoc_pool_free(TreealocPool* pool, void* obj) {
+    pthread_mutex_lock(&alloc_lock);
+    pool_free((Pool*)pool, obj);
+    pthread_mutex_unlock(&alloc_lock);
+}
+
+void treealoc_pool_destroy(TreealocPool* pool) {
+    pthread_mutex_lock(&alloc_lock);
+    pool_destroy((Pool*)pool);
+    pthread_mutex_unlock(&alloc_lock);
+}
+
+TreealocArena* treealoc_arena_create(size_t chunk_size) {
+    pthread_mutex_lock(&alloc_lock);
+    Arena* arena = arena_create(chunk_size, malloc_locked, free_locked);
+    pthread_mutex_unlock(&alloc_lock);
+    return (TreealocArena*)arena;
+}
+
+void* treealoc_arena_alloc(TreealocArena* arena, size_t size) {
+    pthread_mutex_lock(&alloc_lock);
+    void* ptr = arena_alloc((Arena*)arena, size);
+    pthread_mutex_unlock(&alloc_lock);
+    return ptr;
+}
+
+void treealoc_arena_reset(TreealocArena* arena) {
+    pthread_mutex_lock(&alloc_lock);
+    arena_reset((Arena*)arena);
+    pthread_mutex_unlock(&alloc_lock);
+}
+
+void treealoc_arena_destroy(TreealocArena* arena) {
+    pthread_mutex_lock(&alloc_lock);
+    arena_destroy((Arena*)arena);
+    pthread_mutex_unlock(&alloc_lock);
+}
+
+// Ёмкость занятого блока основной кучи; освобождённый блок (свободный в дереве или лежащий
+// в кэше) даёт 0. В отличие от usable_size_locked здесь нужен спуск по дереву.
+static size_t live_size_locked(void* ptr) {
+    size_t size = usable_size_locked(ptr);
+    Span* span = pagemap_lookup(ptr);
+    if (!size || span->kind != SPAN_REGION) return size;
+    if (cpucache_marked(ptr)) return 0;
+    size_t cached_size = sizecache_marked(ptr);
+    if (cached_size && sizecache_contains(ptr, cached_size)) return 0;
+    int index;
+    BNode* node = find_node(root, ptr, &index);
+    return node && !bnode_is_free(node, index) ? size : 0;
+}
+
+// Владелец находится по карте страниц: блок шарда проверяется под блокировкой только этого шарда
+size_t treealoc_usable_size(void* ptr) {
+    Span* span = pagemap_lookup(ptr);
+    if (!span) return 0;
+    if (span->kind == SPAN_REGION && region_shard(span)) {
+        return region_block_size(span, ptr) && !cpucache_marked(ptr) ? shard_usable_size(region_shard(span), ptr) : 0;
+    }
+    lock_heap(); // Отложенные освобождения тоже должны стать видны
+    size_t size = live_size_locked(ptr);
+    pthread_mutex_unlock(&alloc_lock);
+    return size;
+}
+
+int treealoc_owns(void* ptr) {
+    return treealoc_usable_size(ptr) != 0;
+}
+
+void treealoc_free_sized(void* ptr, size_t size) {
+    uint64_t start = latency_start();
+    int shard = shard_of(ptr);
+    if (shard) {
+        if (!cpucache_release(ptr)) shard_release(shard, ptr);
+    } else if (!cpucache_release(ptr) && !free_or_defer(ptr, size, 1)) {
+        lock_heap();
+        free_sized_locked(ptr, size);
+        pthread_mutex_unlock(&alloc_lock);
+    }
+    latency_stop(LAT_FREE, start);
+}
+
 void treealoc_free(void* ptr) {
-    char log_msg[128];
-    if (ptr) {
-        btree_remove(ptr);
-        printf("[treealoc] Freed %p\n", ptr);
-        snprintf(log_msg, sizeof(log_msg), "[treealoc] Freed %p", ptr);
-        log_to_file(log_msg);
+    uint64_t start = latency_start();
+    int shard = shard_of(ptr);
+    if (shard) {
+        if (!cpucache_release(ptr)) shard_release(shard, ptr);
+    } else if (!cpucache_release(ptr) && !free_or_defer(ptr, 0, 0)) {
+        lock_heap();
+        free_locked(ptr);
+        pthread_mutex_unlock(&alloc_lock);
+    }
+    latency_stop(LAT_FREE, start);
+}
+
+// Слив кэша завершившегося потока: мимо кэшей, сразу в дерево
+static void free_uncached(void* ptr) {
+    pthread_mutex_lock(&alloc_lock);
+    free_locked(ptr);
+    pthread_mutex_unlock(&alloc_lock);
+}
+
+void treealoc_remote_free_enable(int on) {
+    lock_heap();
+    remote_free_on = on;
+    pthread_mutex_unlock(&alloc_lock);
+}
+
+int treealoc_cpucache_enable(int on) {
+    pthread_mutex_lock(&alloc_lock);
+    if (!on) drain_caches();
+    int mode = cpucache_enable(on, free_uncached);
+    pthread_mutex_unlock(&alloc_lock);
+    return mode;
+}
+
+size_t treealoc_trim(void) {
+    pthread_mutex_lock(&alloc_lock);
+    drain_caches();
+    size_t released = scavenger_trim(0, (size_t)-1);
+    released += shard_trim((size_t)-1);
+    publish_released();
+    publish_hugepages();
+    pthread_mutex_unlock(&alloc_lock);
+    return released;
+}
+
+static void* scavenger_main(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&alloc_lock);
+    while (scavenger_running) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += scavenger_interval_ms / 1000;
+        deadline.tv_nsec += (long)(scavenger_interval_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        // Ожидание отпускает блокировку, аллокатор в это время работает как обычно
+        pthread_cond_timedwait(&scavenger_cond, &alloc_lock, &deadline);
+        if (!scavenger_running) break;
+        drain_caches();
+        size_t released = scavenger_trim(0, scavenger_budget);
+        if (released < scavenger_budget) shard_trim(scavenger_budget - released);
+        publish_released();
+        publish_hugepages();
+    }
+    pthread_mutex_unlock(&alloc_lock);
+    return NULL;
+}
+
+int treealoc_scavenger_start(unsigned interval_ms, size_t budget_bytes) {
+    pthread_mutex_lock(&alloc_lock);
+    if (scavenger_running) {
+        pthread_mutex_unlock(&alloc_lock);
+        return 0;
+    }
+    scavenger_interval_ms = interval_ms ? interval_ms : SCAVENGE_DEFAULT_INTERVAL_MS;
+    scavenger_budget = budget_bytes ? budget_bytes : SCAVENGE_DEFAULT_BUDGET;
+    scavenger_running = 1;
+    if (pthread_create(&scavenger_thread, NULL, scavenger_main, NULL) != 0) {
+        scavenger_running = 0;
+        pthread_mutex_unlock(&alloc_lock);
+        printf("[ERROR] Failed to start scavenger thread\n");
+        return -1;
+    }
+    pthread_mutex_unlock(&alloc_lock);
+    printf("[treealoc] Scavenger started: every %u ms, up to %zu bytes\n", scavenger_interval_ms, scavenger_budget);
+    return 0;
+}
+
+void treealoc_scavenger_stop(void) {
+    pthread_mutex_lock(&alloc_lock);
+    int was_running = scavenger_running;
+    scavenger_running = 0;
+    pthread_cond_signal(&scavenger_cond);
+    pthread_mutex_unlock(&alloc_lock);
+    if (was_running) pthread_join(scavenger_thread, NULL);
+}
+
+// Пул TLSF или системы близнецов виден в B-дереве одним занятым блоком
+static void register_engine_pool(void* base, size_t size) {
+    btree_insert(size, base);
+}
+
+static const char* engine_name(int id) {
+    switch (id) {
+        case TREEALOC_ENGINE_TLSF: return "tlsf";
+        case TREEALOC_ENGINE_BUDDY: return "buddy";
+        default: return "best-fit";
     }
 }
 
+int treealoc_set_engine(int new_engine, size_t reserve_bytes) {
+    if (new_engine < TREEALOC_ENGINE_BESTFIT || new_engine > TREEALOC_ENGINE_BUDDY) return -1;
+    pthread_mutex_lock(&alloc_lock);
+    int rc = 0;
+    // Освобождение идёт по владельцу из карты страниц, поэтому уже выданные блоки
+    // остаются корректными при любом переключении
+    engine = new_engine;
+    if (engine == TREEALOC_ENGINE_TLSF) {
+        tlsf_set_pool_hook(register_engine_pool);
+        if (reserve_bytes) rc = tlsf_reserve(reserve_bytes);
+    } else if (engine == TREEALOC_ENGINE_BUDDY) {
+        buddy_set_pool_hook(register_engine_pool);
+        if (reserve_bytes) rc = buddy_reserve(reserve_bytes);
+    }
+    pthread_mutex_unlock(&alloc_lock);
+    printf("[treealoc] Engine: %s\n", engine_name(new_engine));
+    return rc;
+}
+
+void treealoc_set_hugepages(int mode) {
+    pthread_mutex_lock(&alloc_lock);
+    region_set_huge_mode(mode);
+    pthread_mutex_unlock(&alloc_lock);
+}
+
+double treealoc_hugepage_coverage(void) {
+    pthread_mutex_lock(&alloc_lock);
+    publish_hugepages();
+    size_t mapped = region_mapped_bytes();
+    size_t huge = region_huge_backed_bytes();
+    pthread_mutex_unlock(&alloc_lock);
+    return mapped ? (double)huge / (double)mapped : 0.0;
+}
+
+void treealoc_latency_enable(int on) {
+    latency_enable(on);
+    if (on) latency_install_signal();
+}
+
+void treealoc_dump_histograms(int fd) {
+    latency_dump(fd < 0 ? 2 : fd);
+}
+
+int treealoc_guard_enable(unsigned sample_rate, unsigned slots) {
+    pthread_mutex_lock(&alloc_lock);
+    int rc = guard_enable(sample_rate, slots);
+    pthread_mutex_unlock(&alloc_lock);
+    return rc;
+}
+
+int treealoc_profile_start(size_t mean_interval_bytes) {
+    pthread_mutex_lock(&alloc_lock);
+    int rc = profiler_start(mean_interval_bytes);
+    pthread_mutex_unlock(&alloc_lock);
+    return rc;
+}
+
+void treealoc_profile_stop(void) {
+    pthread_mutex_lock(&alloc_lock);
+    profiler_stop();
+    pthread_mutex_unlock(&alloc_lock);
+}
+
+int treealoc_profile_dump(const char* path, int format) {
+    pthread_mutex_lock(&alloc_lock);
+    int rc = profiler_dump(path, format);
+    pthread_mutex_unlock(&alloc_lock);
+    return rc;
+}
+
 void treealoc_init() {
     if (!initialized) {
         log_file = fopen("treealoc.log", "a");
@@ -121,20 +854,179 @@ void treealoc_init() {
             printf("[ERROR] Failed to open log file\n");
         }
         initialized = 1;
+        telemetry_init();
+        shard_init();
         printf("[treealoc] Initialized!\n");
         log_to_file("[treealoc] Initialized!");
+
+        const char* eng = getenv("TREEALOC_ENGINE");
+        if (eng && (strcmp(eng, "tlsf") == 0 || strcmp(eng, "buddy") == 0)) {
+            const char* reserve = getenv("TREEALOC_ENGINE_RESERVE");
+            treealoc_set_engine(strcmp(eng, "tlsf") == 0 ? TREEALOC_ENGINE_TLSF : TREEALOC_ENGINE_BUDDY,
+                                reserve ? (size_t)strtoull(reserve, NULL, 10) : 0);
+        }
+
+        const char* shards = getenv("TREEALOC_SHARDS");
+        if (shards && atoi(shards) > 1) {
+            const char* policy = getenv("TREEALOC_SHARD_POLICY");
+            treealoc_set_shards((unsigned)atoi(shards),
+                                policy && strcmp(policy, "hash") == 0 ? TREEALOC_SHARD_HASH : TREEALOC_SHARD_ROUND_ROBIN);
+        }
+
+        const char* node_layout = getenv("TREEALOC_NODE_LAYOUT");
+        if (node_layout && strcmp(node_layout, "veb") == 0) treealoc_set_node_layout(TREEALOC_LAYOUT_VEB);
+        else if (node_layout && strcmp(node_layout, "bfs") == 0) treealoc_set_node_layout(TREEALOC_LAYOUT_BFS);
+
+        const char* isolate = getenv("TREEALOC_ISOLATE");
+        if (isolate && atol(isolate) > 0) treealoc_set_isolation((size_t)atol(isolate));
+
+        const char* remote = getenv("TREEALOC_REMOTE_FREE");
+        if (remote && strcmp(remote, "1") == 0) treealoc_remote_free_enable(1);
+
+        const char* cpucache = getenv("TREEALOC_CPUCACHE");
+        if (cpucache && strcmp(cpucache, "1") == 0) treealoc_cpucache_enable(1);
+
+        const char* lat = getenv("TREEALOC_LATENCY");
+        if (lat && strcmp(lat, "1") == 0) treealoc_latency_enable(1);
+
+        const char* guard = getenv("TREEALOC_GUARD");
+        if (guard && atoi(guard) > 0) {
+            const char* guard_slots = getenv("TREEALOC_GUARD_SLOTS");
+            treealoc_guard_enable((unsigned)atoi(guard), guard_slots ? (unsigned)atoi(guard_slots) : 0);
+        }
+
+        const char* profile = getenv("TREEALOC_PROFILE");
+        if (profile && atol(profile) > 0) {
+            // "1" - интервал по умолчанию, иначе средний интервал в байтах
+            treealoc_profile_start(atol(profile) == 1 ? 0 : (size_t)atol(profile));
+        }
+
+        const char* huge = getenv("TREEALOC_HUGEPAGES");
+        if (huge && strcmp(huge, "hugetlb") == 0) {
+            treealoc_set_hugepages(TREEALOC_HUGE_HUGETLB);
+        } else if (huge && strcmp(huge, "thp") == 0) {
+            treealoc_set_hugepages(TREEALOC_HUGE_THP);
+        }
+
+        const char* scavenge_ms = getenv("TREEALOC_SCAVENGE_MS");
+        if (scavenge_ms && atoi(scavenge_ms) > 0) {
+            const char* budget = getenv("TREEALOC_SCAVENGE_BYTES");
+            treealoc_scavenger_start((unsigned)atoi(scavenge_ms), budget ? (size_t)strtoull(budget, NULL, 10) : 0);
+        }
     }
 }
 
 void treealoc_cleanup() {
+    const char* profile_out = getenv("TREEALOC_PROFILE_OUT");
+    if (profile_out && profiler_active()) treealoc_profile_dump(profile_out, PROFILE_FOLDED_INUSE);
     if (log_file) {
         log_to_file("[treealoc] Cleanup");
         fclose(log_file);
         log_file = NULL;
     }
+    lock_heap();
+    shard_cleanup();
     btree_cleanup();
+    nodepool_release();
+    tlsf_release_all();
+    buddy_release_all();
+    region_release_all();
+    scavenger_reset();
+    sizecache_reset();
+    cpucache_reset();
+    publish_released();
+    publish_hugepages();
+    pthread_mutex_unlock(&alloc_lock);
 }
 
 void treealoc_debug() {
+    pthread_mutex_lock(&alloc_lock);
+    drain_caches();
     btree_debug();
-}
\ No newline at end of file
+    if (shard_count() > 1) {
+        shard_debug();
+        for (unsigned i = 0; i < shard_count(); i++) {
+            ShardStats s;
+            shard_stats(i, &s);
+            printf("[treealoc] Shard %u: %llu blocks, %llu bytes in use, %llu free, %llu allocs (%llu reused), "
+                   "%llu frees, %llu contended, %llu remote frees, height %d\n",
+                   i, (unsigned long long)s.blocks, (unsigned long long)s.bytes_in_use,
+                   (unsigned long long)s.free_retained, (unsigned long long)s.allocs,
+                   (unsigned long long)s.reuse_hits, (unsigned long long)s.frees,
+                   (unsigned long long)s.contended, (unsigned long long)s.remote_frees, s.height);
+        }
+    }
+    pthread_mutex_unlock(&alloc_lock);
+}
+
+// Кэши сливаются в дерево, чтобы обход видел освобождённые блоки свободными
+void treealoc_heap_walk(void* start, void* end, treealoc_walk_fn fn, void* ctx) {
+    if (!fn) return;
+    pthread_mutex_lock(&alloc_lock);
+    drain_caches();
+    btree_walk_range(start, end, fn, ctx);
+    if (shard_count() > 1) shard_walk(start, end, fn, ctx);
+    pthread_mutex_unlock(&alloc_lock);
+}
+
+int treealoc_set_shards(unsigned count, int policy) {
+    if (count < 1 || count > TREEALOC_MAX_SHARDS) return -1;
+    pthread_mutex_lock(&alloc_lock);
+    shard_configure(count, policy == TREEALOC_SHARD_HASH ? SHARD_HASH : SHARD_ROUND_ROBIN);
+    pthread_mutex_unlock(&alloc_lock);
+    return 0;
+}
+
+unsigned treealoc_shard_count(void) {
+    return shard_count();
+}
+
+int treealoc_shard_stats(unsigned index, TreealocShardStats* out) {
+    if (index >= TREEALOC_MAX_SHARDS || !out) return -1;
+    ShardStats s;
+    pthread_mutex_lock(&alloc_lock);
+    shard_stats((int)index, &s);
+    pthread_mutex_unlock(&alloc_lock);
+    out->allocs = s.allocs;
+    out->reuse_hits = s.reuse_hits;
+    out->frees = s.frees;
+    out->blocks = s.blocks;
+    out->bytes_in_use = s.bytes_in_use;
+    out->free_retained = s.free_retained;
+    out->contended = s.contended;
+    out->remote_frees = s.remote_frees;
+    out->height = s.height;
+    return 0;
+}
+
+int treealoc_persist_open(const char* path, size_t size) {
+    char log_msg[256];
+    pthread_mutex_lock(&alloc_lock);
+    int rc = pheap_open(path, size);
+    pthread_mutex_unlock(&alloc_lock);
+    snprintf(log_msg, sizeof(log_msg), "[treealoc] persist_open(%s, %zu) = %d", path, size, rc);
+    log_to_file(log_msg);
+    return rc;
+}
+
+int treealoc_persist_checkpoint(void) {
+    pthread_mutex_lock(&alloc_lock);
+    int rc = pheap_checkpoint();
+    pthread_mutex_unlock(&alloc_lock);
+    return rc;
+}
+
+void treealoc_persist_close(void) {
+    pthread_mutex_lock(&alloc_lock);
+    pheap_close();
+    pthread_mutex_unlock(&alloc_lock);
+    log_to_file("[treealoc] persist_close");
+}
+
+void* treealoc_persist_root(void) {
+    return pheap_root();
+}
+
+void treealoc_persist_set_root(void* ptr) {
+    pheap_set_root(ptr);
+}
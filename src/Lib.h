@@ -3,12 +3,149 @@
 
 #include <stddef.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TREEALOC_ALIGNMENT 16 // Выравнивание любого блока, выданного treealoc
+
 void treealoc_init(void);
 void treealoc_cleanup(void);
 void* treealoc_malloc(size_t size);
 void* treealoc_realloc(void* ptr, size_t size);
 void* treealoc_calloc(size_t nmemb, size_t size);
 void treealoc_free(void* ptr);
+// Освобождение с известным размером (тем, что передавался в malloc): без поиска блока в дереве
+void treealoc_free_sized(void* ptr, size_t size);
+// Принадлежность указателя treealoc и ёмкость блока - через карту страниц, без обхода дерева
+int treealoc_owns(void* ptr);
+size_t treealoc_usable_size(void* ptr);
 void treealoc_debug(void);
 
-#endif
\ No newline at end of file
+// Обход блоков B-деревьев с адресами из [start, end) (end == NULL - до конца кучи), по возрастанию
+// адресов внутри кучи: сначала основная куча, затем шарды. Записи идут подряд по цепочке листов.
+// fn вызывается под блокировкой аллокатора и не должна выделять или освобождать память treealoc.
+typedef void (*treealoc_walk_fn)(void* block, size_t size, int is_free, void* ctx);
+void treealoc_heap_walk(void* start, void* end, treealoc_walk_fn fn, void* ctx);
+
+// Размещение против ложного разделения строк кэша. Изолированный блок выровнен по строке
+// и занимает целые строки, на которые не попадает ни один другой блок. TREEALOC_F_ISOLATED -
+// для явно конкурентных объектов (счётчики потоков, блокировки); порог (или TREEALOC_ISOLATE=<байт>)
+// изолирует все блоки от threshold байт, 0 - выключено. realloc сохраняет изоляцию только по порогу.
+#define TREEALOC_CACHE_LINE 64
+#define TREEALOC_F_ISOLATED 1
+void* treealoc_malloc_flags(size_t size, int flags);
+void treealoc_set_isolation(size_t threshold);
+
+// Пул объектов одного размера: объекты нарезаются из крупных блоков,
+// в B-дереве одна запись на блок, освобождённые объекты выдаются первыми.
+// align - степень двойки (0 - выравнивание указателя).
+typedef struct TreealocPool TreealocPool;
+TreealocPool* treealoc_pool_create(size_t object_size, size_t align);
+void* treealoc_pool_alloc(TreealocPool* pool);
+void treealoc_pool_free(TreealocPool* pool, void* obj);
+void treealoc_pool_destroy(TreealocPool* pool); // Вместе со всеми объектами пула
+
+// Арена: выделение сдвигом указателя из блоков treealoc (chunk_size, 0 - 64 КБ),
+// без записей в B-дереве на объект. reset за O(1) забывает все объекты,
+// блоки остаются за ареной и используются заново; destroy возвращает их.
+typedef struct TreealocArena TreealocArena;
+TreealocArena* treealoc_arena_create(size_t chunk_size);
+void* treealoc_arena_alloc(TreealocArena* arena, size_t size);
+void treealoc_arena_reset(TreealocArena* arena);
+void treealoc_arena_destroy(TreealocArena* arena);
+
+// Возврат свободных страниц ядру (madvise); фоновый поток делает то же с ограничением объёма
+size_t treealoc_trim(void);
+int treealoc_scavenger_start(unsigned interval_ms, size_t budget_bytes);
+void treealoc_scavenger_stop(void);
+
+// Гистограммы задержек malloc/free/realloc/calloc и операций дерева (или TREEALOC_LATENCY=1).
+// Вывод в fd (при fd < 0 - stderr); при включённом замере то же делает SIGUSR2.
+void treealoc_latency_enable(int on);
+void treealoc_dump_histograms(int fd);
+
+// Защитные страницы для выборочных выделений: ловят выход за границы и use-after-free
+// (или TREEALOC_GUARD=<1 из N>, TREEALOC_GUARD_SLOTS=<число страниц>)
+int treealoc_guard_enable(unsigned sample_rate, unsigned slots);
+
+// Выборочный профиль кучи со стеками вызовов (или TREEALOC_PROFILE=<байт>, TREEALOC_PROFILE_OUT=<файл>)
+#define TREEALOC_PROFILE_FOLDED_INUSE 0 // Свёрнутые стеки занятой памяти (flamegraph.pl)
+#define TREEALOC_PROFILE_FOLDED_ALLOC 1 // Свёрнутые стеки всех выделений
+#define TREEALOC_PROFILE_PPROF 2        // Текстовый heap-профиль для pprof
+int treealoc_profile_start(size_t mean_interval_bytes); // 0 - интервал по умолчанию (512 КБ)
+void treealoc_profile_stop(void);
+int treealoc_profile_dump(const char* path, int format);
+
+// Кэши мелких (до 1 КБ) свободных блоков перед общей блокировкой (или TREEALOC_CPUCACHE=1):
+// на процессор через rseq, без rseq - на поток. Возвращает режим вызывающего потока.
+#define TREEALOC_CPUCACHE_OFF 0
+#define TREEALOC_CPUCACHE_PERCPU 1
+#define TREEALOC_CPUCACHE_PERTHREAD 2
+int treealoc_cpucache_enable(int on);
+
+// Освобождение без ожидания блокировки (или TREEALOC_REMOTE_FREE=1): если куча занята
+// другим потоком, блок ставится в очередь без блокировок, и её забирает пачкой
+// следующий поток, получивший блокировку
+void treealoc_remote_free_enable(int on);
+
+// Независимые кучи best-fit (или TREEALOC_SHARDS=<n>, TREEALOC_SHARD_POLICY=hash): у каждой
+// своё B-дерево, области и блокировка. Поток закрепляется за шардом по кругу или по хешу,
+// блок освобождается в шард, которому принадлежит его область. Шард 0 - основная куча.
+#define TREEALOC_MAX_SHARDS 64
+#define TREEALOC_SHARD_ROUND_ROBIN 0
+#define TREEALOC_SHARD_HASH 1
+
+typedef struct {
+    unsigned long long allocs;       // Выдачи из дерева (новые и повторные)
+    unsigned long long reuse_hits;
+    unsigned long long frees;
+    unsigned long long blocks;       // Записей в дереве шарда
+    unsigned long long bytes_in_use;
+    unsigned long long free_retained;
+    unsigned long long contended;    // Блокировка шарда оказалась занята
+    unsigned long long remote_frees; // Освобождения через очередь
+    int height;
+} TreealocShardStats;
+
+int treealoc_set_shards(unsigned count, int policy);
+unsigned treealoc_shard_count(void);
+int treealoc_shard_stats(unsigned index, TreealocShardStats* out);
+
+// Раскладка узлов B-дерева в их пуле (или TREEALOC_NODE_LAYOUT=bfs|veb, по умолчанию NONE):
+// по мере роста основного дерева узлы переставляются в порядке обхода в ширину или
+// van Emde Boas, чтобы спуск шёл по соседним строкам кэша; оно переставляется и сразу
+#define TREEALOC_LAYOUT_NONE 0
+#define TREEALOC_LAYOUT_BFS 1
+#define TREEALOC_LAYOUT_VEB 2
+void treealoc_set_node_layout(int layout);
+
+// Движок выделения (или TREEALOC_ENGINE=tlsf|buddy, TREEALOC_ENGINE_RESERVE=<байт>).
+// BESTFIT - поиск по B-дереву; TLSF - malloc/free за O(1) в худшем случае;
+// BUDDY - блоки степеней двойки до 4 МБ без заголовков, крупнее - как BESTFIT.
+// У TLSF и BUDDY в дереве только пулы по 4 МБ; reserve_bytes заводит их заранее.
+// Переключать можно в любой момент: блоки освобождаются тем движком, которым выданы.
+#define TREEALOC_ENGINE_BESTFIT 0
+#define TREEALOC_ENGINE_TLSF 1
+#define TREEALOC_ENGINE_BUDDY 2
+int treealoc_set_engine(int engine, size_t reserve_bytes);
+
+// Большие страницы для областей: задавать до первых выделений (или TREEALOC_HUGEPAGES=thp|hugetlb)
+#define TREEALOC_HUGE_OFF 0
+#define TREEALOC_HUGE_THP 1
+#define TREEALOC_HUGE_HUGETLB 2
+void treealoc_set_hugepages(int mode);
+double treealoc_hugepage_coverage(void); // Доля отображённых байтов, покрытых большими страницами
+
+// Персистентная куча в файле: после open malloc/free/realloc/calloc работают с ней
+int treealoc_persist_open(const char* path, size_t size);
+int treealoc_persist_checkpoint(void);
+void treealoc_persist_close(void);
+void* treealoc_persist_root(void);
+void treealoc_persist_set_root(void* ptr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
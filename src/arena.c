@@ -0,0 +1,83 @@
+#include "arena.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct ArenaChunk {
+    struct ArenaChunk* next;
+    char* end;
+    char data[] __attribute__((aligned(ARENA_ALIGN)));
+} ArenaChunk;
+
+struct Arena {
+    size_t chunk_size;    // Полезный размер обычного блока
+    ArenaChunk* first;    // Блоки в порядке заполнения
+    ArenaChunk* current;  // Блок, из которого идёт выделение
+    char* bump;
+    arena_chunk_alloc_fn alloc;
+    arena_chunk_free_fn release;
+};
+
+Arena* arena_create(size_t chunk_size, arena_chunk_alloc_fn alloc, arena_chunk_free_fn release) {
+    Arena* arena = malloc(sizeof(Arena));
+    if (!arena) return NULL;
+    if (chunk_size == 0) chunk_size = ARENA_CHUNK_BYTES;
+    arena->chunk_size = (chunk_size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    arena->first = NULL;
+    arena->current = NULL;
+    arena->bump = NULL;
+    arena->alloc = alloc;
+    arena->release = release;
+    printf("[arena] Created arena %p with %zu-byte chunks\n", arena, arena->chunk_size);
+    return arena;
+}
+
+// Новый блок встаёт сразу за текущим, чтобы после сброса порядок сохранялся
+static ArenaChunk* add_chunk(Arena* arena, size_t size) {
+    size_t bytes = size > arena->chunk_size ? size : arena->chunk_size;
+    ArenaChunk* chunk = arena->alloc(sizeof(ArenaChunk) + bytes);
+    if (!chunk) return NULL;
+    chunk->end = chunk->data + bytes;
+    if (arena->current) {
+        chunk->next = arena->current->next;
+        arena->current->next = chunk;
+    } else {
+        chunk->next = arena->first;
+        arena->first = chunk;
+    }
+    return chunk;
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+    if (size == 0) size = 1;
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (arena->current && (size_t)(arena->current->end - arena->bump) >= size) {
+        void* ptr = arena->bump;
+        arena->bump += size;
+        return ptr;
+    }
+    // Следующий сохранённый блок, если подходит по размеру, иначе новый
+    ArenaChunk* next = arena->current ? arena->current->next : arena->first;
+    if (!next || (size_t)(next->end - next->data) < size) {
+        next = add_chunk(arena, size);
+        if (!next) return NULL;
+    }
+    arena->current = next;
+    arena->bump = next->data + size;
+    return next->data;
+}
+
+void arena_reset(Arena* arena) {
+    arena->current = NULL;
+    arena->bump = NULL;
+}
+
+void arena_destroy(Arena* arena) {
+    if (!arena) return;
+    while (arena->first) {
+        ArenaChunk* next = arena->first->next;
+        arena->release(arena->first);
+        arena->first = next;
+    }
+    free(arena);
+}
@@ -0,0 +1,23 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Арена: последовательное выделение из крупных блоков treealoc и сброс всех
+// объектов разом. Блоки после сброса не возвращаются, а используются заново.
+
+#define ARENA_CHUNK_BYTES (64 * 1024)
+#define ARENA_ALIGN 16
+
+typedef void* (*arena_chunk_alloc_fn)(size_t size);
+typedef void (*arena_chunk_free_fn)(void* ptr);
+
+typedef struct Arena Arena;
+
+// Вызывающий держит блокировку аллокатора
+Arena* arena_create(size_t chunk_size, arena_chunk_alloc_fn alloc, arena_chunk_free_fn release);
+void* arena_alloc(Arena* arena, size_t size);
+void arena_reset(Arena* arena);
+void arena_destroy(Arena* arena);
+
+#endif
@@ -1,4 +1,6 @@
 #include "b_tree.h"
+#include "latency.h"
+#include "nodepool.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,25 +8,133 @@
 
 BNode* root = NULL;
 int tree_modified = 0;
+int btree_prefetch_enabled = 1;
+
+static int layout = BTREE_LAYOUT_NONE;
+// Счётчики только основного дерева (под блокировкой аллокатора): деревья шардов
+// автоматически не переставляются
+static size_t main_nodes = 0;
+static size_t main_created = 0; // Создано после последней перестановки
+
+// Дерево, с которым работает поток: основное или дерево шарда, выбранное под его блокировкой
+static __thread BNode** current_tree = NULL;
+#define TREE (*(current_tree ? current_tree : &root))
+
+void btree_select(BNode** tree_root) {
+    current_tree = tree_root;
+}
+
+int btree_main_selected(void) {
+    return current_tree == NULL;
+}
+
+static struct {
+    btree_listener_fn fn;
+    void* ctx;
+    int concurrent;
+} listeners[BTREE_MAX_LISTENERS];
+
+static int add_listener(btree_listener_fn fn, void* ctx, int concurrent) {
+    for (int i = 0; i < BTREE_MAX_LISTENERS; i++) {
+        if (!listeners[i].fn) {
+            listeners[i].ctx = ctx;
+            listeners[i].concurrent = concurrent;
+            listeners[i].fn = fn;
+            return 0;
+        }
+    }
+    printf("[btree] No free listener slots\n");
+    return -1;
+}
+
+int btree_add_listener(btree_listener_fn fn, void* ctx) {
+    return add_listener(fn, ctx, 0);
+}
+
+int btree_add_concurrent_listener(btree_listener_fn fn, void* ctx) {
+    return add_listener(fn, ctx, 1);
+}
+
+void btree_remove_listener(btree_listener_fn fn, void* ctx) {
+    for (int i = 0; i < BTREE_MAX_LISTENERS; i++) {
+        if (listeners[i].fn == fn && listeners[i].ctx == ctx) {
+            listeners[i].fn = NULL;
+            listeners[i].ctx = NULL;
+        }
+    }
+}
+
+static void notify(int type, void* block, size_t size, size_t old_size, int is_free) {
+    BTreeEvent ev = {type, block, size, old_size, is_free};
+    for (int i = 0; i < BTREE_MAX_LISTENERS; i++) {
+        // События деревьев шардов приходят параллельно из разных потоков
+        if (current_tree && !listeners[i].concurrent) continue;
+        if (listeners[i].fn) listeners[i].fn(&ev, listeners[i].ctx);
+    }
+}
+
+// Перенос ключа вместе с размером и флагом
+static inline void copy_key(BNode* dst, int di, const BNode* src, int si) {
+#ifdef TREEALOC_COMPACT_NODES
+    dst->keys[di] = src->keys[si];
+    dst->granules[di] = src->granules[si];
+#else
+    dst->blocks[di] = src->blocks[si];
+    dst->sizes[di] = src->sizes[si];
+#endif
+    bnode_set_free(dst, di, bnode_is_free(src, si));
+}
+
+static inline void set_key(BNode* node, int i, void* block, size_t size, int is_free) {
+    bnode_set_block(node, i, block);
+    bnode_set_size(node, i, size);
+    bnode_set_free(node, i, is_free);
+}
 
 static BNode* create_node(int leaf) {
-    BNode* node = malloc(sizeof(BNode));
+    BNode* node = nodepool_alloc();
     if (!node) return NULL;
-    node->n = 0;
-    node->leaf = leaf;
-    for (int i = 0; i < 2*T; i++) {
-        node->children[i] = NULL;
-    }
-    for (int i = 0; i < 2*T-1; i++) {
-        node->sizes[i] = 0;
-        node->blocks[i] = NULL; // Initialize block pointers to NULL
-        node->is_free[i] = 0;
+    if (!current_tree) {
+        main_nodes++;
+        main_created++;
     }
+    memset(node, 0, sizeof(BNode)); // Записи, разделители, дети и ссылка на следующий лист
+    node->leaf = leaf;
     printf("[btree] Created node %p (leaf=%d)\n", node, leaf);
     tree_modified = 1;
     return node;
 }
 
+static void free_node(BNode* node) {
+    if (!current_tree) main_nodes--;
+    nodepool_free(node);
+}
+
+static int node_full(const BNode* node) {
+    return node->n == (node->leaf ? BTREE_LEAF_KEYS : BTREE_FANOUT - 1);
+}
+
+static int node_minimal(const BNode* node) {
+    return node->n <= (node->leaf ? BTREE_LEAF_MIN : BTREE_INNER_MIN);
+}
+
+// Ребёнок, в поддереве которого лежит key
+static int child_index(const BNode* node, BKey key) {
+    int i = 0;
+    while (i < node->n && node->seps[i] <= key) i++;
+    return i;
+}
+
+// Первая запись листа с ключом не меньше key
+static int leaf_position(const BNode* leaf, BKey key) {
+    int i = 0;
+    while (i < leaf->n && bnode_key(leaf, i) < key) i++;
+    return i;
+}
+
+// Делит полного ребёнка пополам. Лист отдаёт правую половину записей новому листу,
+// встающему за ним в цепочку, и в родителя уходит копия первого ключа нового листа.
+// Внутренний узел отдаёт правые разделители с детьми, а средний разделитель поднимается.
 static void split_child(BNode* parent, int i, BNode* child) {
     BNode* new_node = create_node(child->leaf);
     if (!new_node) {
@@ -32,109 +142,114 @@ static void split_child(BNode* parent, int i, BNode* child) {
         perror("[btree] Failed to create node in split_child");
         return;
     }
-    new_node->n = T-1;
-
-    for (int j = 0; j < T-1; j++) {
-        new_node->sizes[j] = child->sizes[j+T];
-        new_node->blocks[j] = child->blocks[j+T];
-        new_node->is_free[j] = child->is_free[j+T];
-    }
-
-    if (!child->leaf) {
-        for (int j = 0; j < T; j++) {
-            new_node->children[j] = child->children[j+T];
-            child->children[j+T] = NULL; // Nullify moved children pointers
+    BKey sep;
+    if (child->leaf) {
+        int keep = (BTREE_LEAF_KEYS + 1) / 2;
+        new_node->n = child->n - keep;
+        for (int j = 0; j < new_node->n; j++) {
+            copy_key(new_node, j, child, keep + j);
         }
+        child->n = keep;
+        new_node->next = child->next;
+        child->next = new_node;
+        sep = bnode_key(new_node, 0);
+    } else {
+        int keep = (BTREE_FANOUT - 1) / 2;
+        sep = child->seps[keep];
+        new_node->n = child->n - keep - 1;
+        for (int j = 0; j < new_node->n; j++) {
+            new_node->seps[j] = child->seps[keep + 1 + j];
+        }
+        for (int j = 0; j <= new_node->n; j++) {
+            new_node->children[j] = child->children[keep + 1 + j];
+            child->children[keep + 1 + j] = NULL; // Nullify moved children pointers
+        }
+        child->n = keep;
     }
 
-    child->n = T-1; // child now has T-1 keys
-
-    // Shift children in parent to make space for new_node
-    for (int j = parent->n; j > i; j--) { // Note: j > i, not j >= i
+    // Shift separators and children in parent to make space for new_node
+    for (int j = parent->n; j > i; j--) {
         parent->children[j+1] = parent->children[j];
+        parent->seps[j] = parent->seps[j-1];
     }
-    parent->children[i+1] = new_node; // Link new_node
-
-    // Shift keys in parent
-    for (int j = parent->n-1; j >= i; j--) {
-        parent->sizes[j+1] = parent->sizes[j];
-        parent->blocks[j+1] = parent->blocks[j];
-        parent->is_free[j+1] = parent->is_free[j];
-    }
-
-    // Copy middle key from child to parent
-    parent->sizes[i] = child->sizes[T-1];
-    parent->blocks[i] = child->blocks[T-1];
-    parent->is_free[i] = child->is_free[T-1];
+    parent->children[i+1] = new_node;
+    parent->seps[i] = sep;
     parent->n++;
 
-    // Nullify the moved key in the original child (optional, but good practice)
-    // child->blocks[T-1] = NULL; // As its content is now in parent
-
     printf("[btree] Split child %p at index %d, new node %p\n", child, i, new_node);
     tree_modified = 1;
 }
 
+// Спуск сверху вниз за один проход: полный узел делится до того, как в него спуститься,
+// поэтому родитель всегда может принять новый разделитель и возвращаться вверх не нужно
 static void insert_nonfull(BNode* node, size_t size, void* ptr) {
-    int i = node->n - 1;
-
-    if (node->leaf) {
-        // Find location for new key and shift greater keys
-        while (i >= 0 && node->blocks[i] > ptr) { // Assuming B-Tree ordered by block addresses
-            node->sizes[i+1] = node->sizes[i];
-            node->blocks[i+1] = node->blocks[i];
-            node->is_free[i+1] = node->is_free[i];
-            i--;
-        }
-        node->sizes[i+1] = size;
-        node->blocks[i+1] = ptr;
-        node->is_free[i+1] = 0; // Mark as used
-        node->n++;
-        printf("[btree] Inserted block %p (size %zu) into leaf node %p\n", ptr, size, node);
-        tree_modified = 1;
-    } else {
-        // Find child to insert into
-        while (i >= 0 && node->blocks[i] > ptr) i--;
-        i++; // Child index
+    BKey key = btree_key(ptr);
+    while (!node->leaf) {
+        bnode_prefetch_children(node);
+        int i = child_index(node, key);
 
-        if (node->children[i]->n == 2*T-1) { // If child is full
+        if (node_full(node->children[i])) {
             split_child(node, i, node->children[i]);
             // Determine which child the key now goes into after split
-            if (node->blocks[i] < ptr) i++;
+            if (node->seps[i] <= key) i++;
         }
-        insert_nonfull(node->children[i], size, ptr);
+        node = node->children[i];
     }
+
+    // Find location for new key and shift greater keys
+    int i = node->n - 1;
+    while (i >= 0 && bnode_key(node, i) > key) { // Assuming B-Tree ordered by block addresses
+        copy_key(node, i+1, node, i);
+        i--;
+    }
+    set_key(node, i+1, ptr, size, 0); // Mark as used
+    node->n++;
+    printf("[btree] Inserted block %p (size %zu) into leaf node %p\n", ptr, size, node);
+    tree_modified = 1;
 }
 
-void btree_insert(size_t size, void* ptr) {
-    if (!root) {
-        root = create_node(1); // Create root as leaf
-        if(!root) {
+static void relayout_tree(void);
+
+// Перестановка стоит O(n log n) и случается после n созданий узлов, поэтому на вставку приходится O(log n)
+static void maybe_relayout(void) {
+    if (layout == BTREE_LAYOUT_NONE || current_tree) return;
+    if (main_created >= BTREE_RELAYOUT_MIN && main_created >= main_nodes) relayout_tree();
+}
+
+static void insert_block(size_t size, void* ptr) {
+    if (!btree_addressable(ptr)) {
+        printf("[btree] Block %p is outside the compact key window, not indexed\n", ptr);
+        return;
+    }
+    if (!TREE) {
+        TREE = create_node(1); // Create root as leaf
+        if(!TREE) {
             perror("[btree] Failed to create root node");
             return;
         }
-        root->sizes[0] = size;
-        root->blocks[0] = ptr;
-        root->is_free[0] = 0;
-        root->n = 1;
+        set_key(TREE, 0, ptr, size, 0);
+        TREE->n = 1;
         printf("[btree] Inserted block %p (size %zu) as root\n", ptr, size);
         tree_modified = 1;
+        notify(BTREE_EV_INSERT, ptr, size, 0, 0);
         return;
     }
 
-    if (root->n == 2*T-1) { // If root is full
+    if (node_full(TREE)) { // If root is full
         BNode* new_root = create_node(0); // New root is internal
         if(!new_root) {
              perror("[btree] Failed to create new root node during split");
             return;
         }
-        new_root->children[0] = root;
-        split_child(new_root, 0, root);
-        root = new_root;
-        insert_nonfull(root, size, ptr);
+        new_root->children[0] = TREE;
+        split_child(new_root, 0, TREE);
+        TREE = new_root;
+        insert_nonfull(TREE, size, ptr);
     } else {
-        insert_nonfull(root, size, ptr);
+        insert_nonfull(TREE, size, ptr);
     }
+    notify(BTREE_EV_INSERT, ptr, size, 0, 0);
+    maybe_relayout();
 }
 
 static void print_node(BNode* node, int depth) {
@@ -143,7 +258,8 @@ static void print_node(BNode* node, int depth) {
     for (int k = 0; k < depth; k++) printf("  ");
     printf("↳ (%p) [ ", node); // Print node address for debugging
     for (int k = 0; k < node->n; k++) {
-        printf("%zu@%p(%s) ", node->sizes[k], node->blocks[k], node->is_free[k] ? "free" : "used");
+        if (node->leaf) printf("%zu@%p(%s) ", bnode_size(node, k), bnode_block(node, k), bnode_is_free(node, k) ? "free" : "used");
+        else printf("%p ", btree_key_ptr(node->seps[k]));
     }
     printf("] %s (n=%d)\n", node->leaf ? "leaf" : "internal", node->n);
 
@@ -155,85 +271,58 @@ static void print_node(BNode* node, int depth) {
 }
 
 void btree_debug() {
-    printf("[DEBUG] B-tree structure (T=%d):\n", T);
-    print_node(root, 0);
+    printf("[DEBUG] B+ tree structure (leaf keys %d, fanout %d):\n", BTREE_LEAF_KEYS, BTREE_FANOUT);
+    print_node(TREE, 0);
 }
 
-static int find_key_or_subtree(BNode* node, void* ptr, int* found_in_node) {
-    int i = 0;
-    *found_in_node = 0;
-    while (i < node->n) {
-        if (node->blocks[i] == ptr) { // Сначала проверяем на точное совпадение
-            *found_in_node = 1;
-            return i;
-        }
-        if (node->blocks[i] > ptr) { // Предполагаем, что указатели можно так сравнивать для порядка
-            break; // ptr должен быть в children[i]
-        }
-        i++;
+// Лист, в котором лежит или должен лежать key
+static BNode* find_leaf(BNode* node, BKey key) {
+    while (!node->leaf) {
+        bnode_prefetch_children(node);
+        node = node->children[child_index(node, key)];
     }
-    // Если дошли до конца или нашли ключ больше (i указывает на место/ребенка)
-    return i;
+    return node;
 }
 
-
 BNode* find_node(BNode* current_node, void* ptr, int* index_in_node) {
-    if (!current_node) {
-        // printf("[btree] find_node: current_node is NULL for ptr %p\n", ptr);
-        return NULL;
-    }
-
-    int found_here;
-    int i = find_key_or_subtree(current_node, ptr, &found_here);
-
-    if (found_here) { // Key is in current_node
-        *index_in_node = i;
-        printf("[btree] Found block %p at index %d in node %p\n", ptr, i, current_node);
-        return current_node;
-    }
-
-    // Key not in current_node
-    if (current_node->leaf) { // And it's a leaf
-        // printf("[btree] Block %p not found in leaf node %p\n", ptr, current_node);
-        return NULL; // Key not found
-    }
-
-    return find_node(current_node->children[i], ptr, index_in_node);
+    if (!current_node || !btree_addressable(ptr)) return NULL;
+    BKey key = btree_key(ptr);
+    BNode* leaf = find_leaf(current_node, key);
+    int i = leaf_position(leaf, key);
+    if (i == leaf->n || bnode_key(leaf, i) != key) return NULL;
+    *index_in_node = i;
+    printf("[btree] Found block %p at index %d in node %p\n", ptr, i, leaf);
+    return leaf;
 }
 
 
+// Перенос через разделитель родителя: у листа переезжает крайняя запись, и разделитель
+// становится первым ключом правого узла; у внутреннего узла разделитель опускается в ребёнка,
+// а на его место встаёт крайний разделитель брата вместе с крайним поддеревом
 static void borrow_from_prev(BNode* parent_node, int child_idx) {
     BNode* child = parent_node->children[child_idx];
     BNode* sibling = parent_node->children[child_idx-1];
 
-    // Shift all keys and children in child one step to the right
-    for (int i = child->n-1; i >= 0; i--) {
-        child->sizes[i+1] = child->sizes[i];
-        child->blocks[i+1] = child->blocks[i];
-        child->is_free[i+1] = child->is_free[i];
-    }
-    if (!child->leaf) {
+    if (child->leaf) {
+        for (int i = child->n-1; i >= 0; i--) {
+            copy_key(child, i+1, child, i);
+        }
+        copy_key(child, 0, sibling, sibling->n-1);
+        parent_node->seps[child_idx-1] = bnode_key(child, 0);
+    } else {
+        // Shift all separators and children in child one step to the right
+        for (int i = child->n-1; i >= 0; i--) {
+            child->seps[i+1] = child->seps[i];
+        }
         for (int i = child->n; i >= 0; i--) {
             child->children[i+1] = child->children[i];
         }
-    }
-
-    // Move key from parent to child
-    child->sizes[0] = parent_node->sizes[child_idx-1];
-    child->blocks[0] = parent_node->blocks[child_idx-1];
-    child->is_free[0] = parent_node->is_free[child_idx-1];
-
-    // Move rightmost child of sibling to child's first child pointer
-    if (!child->leaf) {
+        child->seps[0] = parent_node->seps[child_idx-1];
         child->children[0] = sibling->children[sibling->n];
         sibling->children[sibling->n] = NULL; // Nullify moved pointer
+        parent_node->seps[child_idx-1] = sibling->seps[sibling->n-1];
     }
 
-    // Move rightmost key of sibling to parent
-    parent_node->sizes[child_idx-1] = sibling->sizes[sibling->n-1];
-    parent_node->blocks[child_idx-1] = sibling->blocks[sibling->n-1];
-    parent_node->is_free[child_idx-1] = sibling->is_free[sibling->n-1];
-
     child->n++;
     sibling->n--;
     tree_modified = 1;
@@ -244,91 +333,68 @@ static void borrow_from_next(BNode* parent_node, int child_idx) {
     BNode* child = parent_node->children[child_idx];
     BNode* sibling = parent_node->children[child_idx+1];
 
-    // Move key from parent to child's last key
-    child->sizes[child->n] = parent_node->sizes[child_idx];
-    child->blocks[child->n] = parent_node->blocks[child_idx];
-    child->is_free[child->n] = parent_node->is_free[child_idx];
-
-    // Move leftmost child of sibling to child's last child pointer
-    if (!child->leaf) {
+    if (child->leaf) {
+        copy_key(child, child->n, sibling, 0);
+        for (int i = 0; i < sibling->n-1; i++) {
+            copy_key(sibling, i, sibling, i+1);
+        }
+        parent_node->seps[child_idx] = bnode_key(sibling, 0);
+    } else {
+        child->seps[child->n] = parent_node->seps[child_idx];
         child->children[child->n+1] = sibling->children[0];
-        // sibling->children[0] = NULL; // Will be shifted
-    }
-
-    // Move leftmost key of sibling to parent
-    parent_node->sizes[child_idx] = sibling->sizes[0];
-    parent_node->blocks[child_idx] = sibling->blocks[0];
-    parent_node->is_free[child_idx] = sibling->is_free[0];
-
-    // Shift keys and children in sibling one step to the left
-    for (int i = 0; i < sibling->n-1; i++) {
-        sibling->sizes[i] = sibling->sizes[i+1];
-        sibling->blocks[i] = sibling->blocks[i+1];
-        sibling->is_free[i] = sibling->is_free[i+1];
-    }
-    if (!sibling->leaf) {
-        for (int i = 0; i < sibling->n; i++) { // up to n, not n+1
+        parent_node->seps[child_idx] = sibling->seps[0];
+        // Shift separators and children in sibling one step to the left
+        for (int i = 0; i < sibling->n-1; i++) {
+            sibling->seps[i] = sibling->seps[i+1];
+        }
+        for (int i = 0; i < sibling->n; i++) {
             sibling->children[i] = sibling->children[i+1];
         }
-         sibling->children[sibling->n] = NULL; // Nullify last moved child ptr
+        sibling->children[sibling->n] = NULL; // Nullify last moved child ptr
     }
 
-
     child->n++;
     sibling->n--;
     tree_modified = 1;
     printf("[btree] Borrowed from next sibling for child %p at index %d\n", child, child_idx);
 }
-// В merge_nodes, убедимся, что индексы для children верны:
-static void merge_nodes(BNode* parent_node, int idx_of_key_in_parent) {
-    BNode* child = parent_node->children[idx_of_key_in_parent]; // Это левый ребенок (в который сливаем)
-    BNode* sibling = parent_node->children[idx_of_key_in_parent+1]; // Это правый ребенок (из которого сливаем)
-
-    // Сохраняем исходное количество ключей/детей в 'child' перед тем, как он начнет расти
-    int original_child_n = child->n; // Должно быть T-1
-
-    // 1. Ключ из parent_node спускается в child
-    child->sizes[original_child_n] = parent_node->sizes[idx_of_key_in_parent];
-    child->blocks[original_child_n] = parent_node->blocks[idx_of_key_in_parent];
-    child->is_free[original_child_n] = parent_node->is_free[idx_of_key_in_parent];
-    child->n++; // Теперь у child original_child_n + 1 ключей (T ключей)
-
-    // 2. Ключи из sibling копируются в child
-    for (int i = 0; i < sibling->n; i++) {
-        child->sizes[child->n] = sibling->sizes[i];
-        child->blocks[child->n] = sibling->blocks[i];
-        child->is_free[child->n] = sibling->is_free[i];
-        child->n++;
-    }
-    // Теперь у child original_child_n + 1 + sibling->n ключей ( T-1 + 1 + T-1 = 2T-1 ключей)
-
-    // 3. Если не листья, дети из sibling копируются в child
-    if (!child->leaf) {
-        // У child было original_child_n+1 детей (T детей) до копирования детей sibling.
-        // Индекс первого нового ребенка в child будет original_child_n + 1.
+
+// Правый ребёнок (children[idx+1]) вливается в левый. Листья просто складывают записи,
+// и левый лист забирает ссылку на следующий; внутренние узлы сливаются вокруг разделителя родителя.
+static void merge_nodes(BNode* parent_node, int idx) {
+    BNode* child = parent_node->children[idx];
+    BNode* sibling = parent_node->children[idx+1];
+
+    if (child->leaf) {
+        for (int i = 0; i < sibling->n; i++) {
+            copy_key(child, child->n + i, sibling, i);
+        }
+        child->n += sibling->n;
+        child->next = sibling->next;
+    } else {
+        child->seps[child->n] = parent_node->seps[idx];
+        for (int i = 0; i < sibling->n; i++) {
+            child->seps[child->n + 1 + i] = sibling->seps[i];
+        }
         for (int i = 0; i <= sibling->n; i++) {
-            child->children[original_child_n + 1 + i] = sibling->children[i];
-            sibling->children[i] = NULL; // Обнуляем указатель в sibling
+            child->children[child->n + 1 + i] = sibling->children[i];
         }
+        child->n += sibling->n + 1;
     }
 
-    // 4. Удаляем ключ и указатель на sibling из parent_node
-    for (int i = idx_of_key_in_parent; i < parent_node->n - 1; i++) {
-        parent_node->sizes[i] = parent_node->sizes[i+1];
-        parent_node->blocks[i] = parent_node->blocks[i+1];
-        parent_node->is_free[i] = parent_node->is_free[i+1];
+    // Удаляем разделитель и указатель на sibling из parent_node
+    for (int i = idx; i < parent_node->n - 1; i++) {
+        parent_node->seps[i] = parent_node->seps[i+1];
     }
-    // Сдвигаем указатели на детей в parent_node
-    for (int i = idx_of_key_in_parent + 1; i < parent_node->n; i++) { // Начиная с указателя ПОСЛЕ удаленного sibling
+    for (int i = idx + 1; i < parent_node->n; i++) {
         parent_node->children[i] = parent_node->children[i+1];
     }
     parent_node->children[parent_node->n] = NULL;
     parent_node->n--;
 
-
     printf("[btree] Merged child %p (was children[%d]) and sibling %p. Freed sibling %p.\n",
-           child, idx_of_key_in_parent, sibling, sibling);
-    free(sibling); 
+           child, idx, sibling, sibling);
+    free_node(sibling);
     tree_modified = 1;
 }
 
@@ -338,19 +404,19 @@ static void fix_underflow(BNode* parent_node, int child_idx_in_parent) {
     if (!parent_node) return; // Не должно происходить при правильном вызове
     BNode* child = parent_node->children[child_idx_in_parent];
 
-    if (!child || child->n >= T) {
-        // Если узел имеет T или более ключей, он не недозаполнен согласно цели.
+    if (!child || !node_minimal(child)) {
+        // После удаления из такого узла он не опустится ниже минимума
         return;
     }
 
     printf("[btree] Fixing underflow for child %p (index %d in parent %p), current n=%d\n", child, child_idx_in_parent, parent_node, child->n);
 
     // Случай 1: Заимствование у предыдущего брата
-    if (child_idx_in_parent > 0 && parent_node->children[child_idx_in_parent-1]->n >= T) {
+    if (child_idx_in_parent > 0 && !node_minimal(parent_node->children[child_idx_in_parent-1])) {
         borrow_from_prev(parent_node, child_idx_in_parent);
     }
     // Случай 2: Заимствование у следующего брата
-    else if (child_idx_in_parent < parent_node->n && parent_node->children[child_idx_in_parent+1]->n >= T) {
+    else if (child_idx_in_parent < parent_node->n && !node_minimal(parent_node->children[child_idx_in_parent+1])) {
         borrow_from_next(parent_node, child_idx_in_parent);
     }
     // Случай 3: Слияние
@@ -361,200 +427,250 @@ static void fix_underflow(BNode* parent_node, int child_idx_in_parent) {
         } else if (child_idx_in_parent > 0) { // Слияние с левым братом
             merge_nodes(parent_node, child_idx_in_parent-1);
         }
-        if (parent_node == root && parent_node->n == 0) {
+        if (parent_node == TREE && parent_node->n == 0) {
             // После merge_nodes, child - это объединенный узел, который должен быть единственным дочерним.
-            root = parent_node->children[0];
-            free(parent_node); // Освобождаем старый корень
-            printf("[btree] New root is %p\n", root);
+            TREE = parent_node->children[0];
+            free_node(parent_node); // Освобождаем старый корень
+            printf("[btree] New root is %p\n", TREE);
             tree_modified = 1;
         }
     }
 }
 
-static void remove_entry_from_leaf(BNode* leaf_node, int index_in_leaf, int actually_free_payload) {
+static void remove_entry_from_leaf(BNode* leaf_node, int index_in_leaf) {
     if (!leaf_node || !leaf_node->leaf || index_in_leaf < 0 || index_in_leaf >= leaf_node->n) {
         printf("[btree] Invalid args to remove_entry_from_leaf: node %p, index %d, n %d\n", leaf_node, index_in_leaf, leaf_node ? leaf_node->n : -1);
         return;
     }
 
-    void* block_ptr_in_leaf = leaf_node->blocks[index_in_leaf];
-
-    if (actually_free_payload && block_ptr_in_leaf) {
-        printf("[btree] System freeing block %p from leaf %p at index %d (flag=true)\n", block_ptr_in_leaf, leaf_node, index_in_leaf);
-        free(block_ptr_in_leaf);
-    } else if (!actually_free_payload && block_ptr_in_leaf) {
-        printf("[btree] Removing entry for block %p from leaf %p at index %d (flag=false, block NOT freed here)\n", block_ptr_in_leaf, leaf_node, index_in_leaf);
-    }
-    
-    leaf_node->blocks[index_in_leaf] = NULL; // Запись удаляется в любом случае
-
+    printf("[btree] Removing entry for block %p from leaf %p at index %d\n", bnode_block(leaf_node, index_in_leaf), leaf_node, index_in_leaf);
     for (int i = index_in_leaf; i < leaf_node->n - 1; i++) {
-        leaf_node->sizes[i] = leaf_node->sizes[i + 1];
-        leaf_node->blocks[i] = leaf_node->blocks[i + 1];
-        leaf_node->is_free[i] = leaf_node->is_free[i + 1];
+        copy_key(leaf_node, i, leaf_node, i + 1);
     }
-    leaf_node->sizes[leaf_node->n - 1] = 0;
-    leaf_node->blocks[leaf_node->n - 1] = NULL;
-    leaf_node->is_free[leaf_node->n - 1] = 0;
     leaf_node->n--;
     tree_modified = 1;
 }
 
-// Gets predecessor: finds rightmost key in subtree rooted at node->children[child_idx_for_key]
-static void get_predecessor(BNode* parent_node, int child_idx_for_key, BNode** pred_node_out, int* pred_idx_out) {
-    BNode* current = parent_node->children[child_idx_for_key];
-    while (!current->leaf) {
-        current = current->children[current->n]; // Go to rightmost child
-    }
-    *pred_node_out = current;
-    *pred_idx_out = current->n - 1; // Rightmost key in leaf
-}
-
-// Gets successor: finds leftmost key in subtree rooted at node->children[child_idx_for_key + 1]
-static void get_successor(BNode* parent_node, int child_idx_for_key, BNode** succ_node_out, int* succ_idx_out) {
-    BNode* current = parent_node->children[child_idx_for_key + 1];
-    while (!current->leaf) {
-        current = current->children[0]; // Go to leftmost child
-    }
-    *succ_node_out = current;
-    *succ_idx_out = 0; // Leftmost key in leaf
-}
-
-static void btree_remove_recursive(BNode* current_node, void* ptr_to_delete, int actually_free_payload) {
-    if (!current_node) return;
-
-    int found_in_current;
-    int idx = find_key_or_subtree(current_node, ptr_to_delete, &found_in_current);
-
-    if (found_in_current) { // Ключ ptr_to_delete находится в current_node
-        if (current_node->leaf) {
-            printf("[btree_rec] Removing %p from leaf %p at index %d (free_payload=%d)\n", ptr_to_delete, current_node, idx, actually_free_payload);
-            remove_entry_from_leaf(current_node, idx, actually_free_payload); // Используем флаг
-        } else { // Ключ во внутреннем узле current_node
-            printf("[btree_rec] Removing %p from internal node %p at index %d (free_payload=%d)\n", ptr_to_delete, current_node, idx, actually_free_payload);
-            BNode* left_child = current_node->children[idx];
-            BNode* right_child = current_node->children[idx+1];
-
-            if (left_child && left_child->n >= T) { // Случай 1: Предшественник из левого ребенка
-                BNode* pred_node;
-                int pred_idx;
-                get_predecessor(current_node, idx, &pred_node, &pred_idx);
-
-                // Блок ptr_to_delete (== current_node->blocks[idx]) заменяется.
-                // Освобождаем его, если текущий рекурсивный вызов должен это сделать.
-                if (actually_free_payload) {
-                     printf("[btree_rec] System freeing current internal block %p (ptr_to_delete) before replacing with pred %p\n", current_node->blocks[idx], pred_node->blocks[pred_idx]);
-                     if (current_node->blocks[idx] == ptr_to_delete) { // Доп. проверка, что освобождаем именно то, что должны
-                        free(current_node->blocks[idx]);
-                     } else {
-                        printf("[btree_rec] WARNING: Mismatch! ptr_to_delete %p != current_node->blocks[idx] %p\n", ptr_to_delete, current_node->blocks[idx]);
-                        // Возможно, стоит освободить ptr_to_delete, если он гарантированно является тем, что нужно
-                     }
-                }
-
-                // Заменяем ключ в current_node на предшественника
-                current_node->sizes[idx] = pred_node->sizes[pred_idx];
-                current_node->blocks[idx] = pred_node->blocks[pred_idx]; // Блок предшественника перемещается вверх
-                current_node->is_free[idx] = pred_node->is_free[pred_idx];
-                
-                btree_remove_recursive(left_child, current_node->blocks[idx], 0 /* НЕ освобождать этот payload */);
-
-            } else if (right_child && right_child->n >= T) { // Случай 2: Преемник из правого ребенка
-                BNode* succ_node;
-                int succ_idx;
-                get_successor(current_node, idx, &succ_node, &succ_idx);
-
-                if (actually_free_payload) {
-                    printf("[btree_rec] System freeing current internal block %p (ptr_to_delete) before replacing with succ %p\n", current_node->blocks[idx], succ_node->blocks[succ_idx]);
-                     if (current_node->blocks[idx] == ptr_to_delete) {
-                        free(current_node->blocks[idx]);
-                     } else {
-                        printf("[btree_rec] WARNING: Mismatch! ptr_to_delete %p != current_node->blocks[idx] %p\n", ptr_to_delete, current_node->blocks[idx]);
-                     }
-                }
-
-                current_node->sizes[idx] = succ_node->sizes[succ_idx];
-                current_node->blocks[idx] = succ_node->blocks[succ_idx]; // Блок преемника перемещается вверх
-                current_node->is_free[idx] = succ_node->is_free[succ_idx];
-                
-                btree_remove_recursive(right_child, current_node->blocks[idx], 0 /* НЕ освобождать этот payload */);
-
-            } else { // Случай 3: Слияние левого ребенка, ключа из current_node и правого ребенка
-                void* key_to_delete_in_merged_child = current_node->blocks[idx]; // Это ptr_to_delete
-
-                printf("[btree_rec] Merging children of node %p around key %p (idx %d)\n", current_node, key_to_delete_in_merged_child, idx);
-                                
-                merge_nodes(current_node, idx); 
-                
-                btree_remove_recursive(current_node->children[idx], key_to_delete_in_merged_child, actually_free_payload);
-            }
+// Основная функция удаления. Один проход от корня к листу: прежде чем спуститься
+// в узел с минимумом записей, он пополняется (fix_underflow), поэтому удаление из листа
+// никогда не требует подъёма обратно. Записи есть только в листьях, так что замена
+// предшественником не нужна; разделитель удалённого ключа остаётся верной границей.
+static void remove_block(void* ptr) {
+    if (!TREE || !btree_addressable(ptr)) {
+        printf("[btree] Tree is empty, cannot remove %p\n", ptr);
+        return;
+    }
+
+    // Памятью блоков владеют области (region.c), дерево удаляет только запись
+    printf("[btree] Attempting to remove block %p from tree.\n", ptr);
+    BNode* node = TREE;
+    BKey key = btree_key(ptr);
+
+    while (!node->leaf) {
+        bnode_prefetch_children(node);
+        int idx = child_index(node, key);
+        if (node_minimal(node->children[idx])) {
+            // Пополняем ребёнка и повторяем поиск в этом же узле: при слиянии с левым
+            // братом индекс ребёнка меняется, а при схлопывании корня меняется сам узел
+            int was_root = node == TREE;
+            fix_underflow(node, idx);
+            if (was_root && node != TREE) node = TREE;
+            continue;
         }
-    } else { // Ключ ptr_to_delete не в current_node, должен быть в дочернем узле current_node->children[idx]
-        if (!found_in_current) { // Явно используем флаг, чтобы отделить от предыдущего if-блока
-            if (current_node->leaf) {
-                // Если мы здесь, значит find_node нашел блок, а рекурсивный поиск - нет, или это ошибка логики.
-                printf("[btree_rec] Ptr %p NOT found by find_key_or_subtree in leaf %p (idx %d), but should exist. Aborting path.\n", ptr_to_delete, current_node, idx);
-                return;
-            }
-    
-            // Определяем, в какого ребенка спускаться (idx уже есть от find_key_or_subtree)
-            BNode* child_to_descend = current_node->children[idx];
-    
-            if (!child_to_descend) { // Такого быть не должно в корректном B-дереве, если узел не листовой
-                 printf("[btree_rec] Error: child_to_descend (children[%d]) is NULL for ptr %p at non-leaf node %p.\n", idx, ptr_to_delete, current_node);
-                 return;
-            }
-    
-            // Если у дочернего узла, в который мы собираемся спуститься, T-1 ключей (минимальное количество)
-            if (child_to_descend->n < T) { // T-1 ключ == child->n == T-1. Если < T, значит, child->n == T-1
-                printf("[btree_rec] Child %p (idx %d in parent %p) has n=%d (T-1 keys), calling fix_underflow to ensure it has >= T keys or is merged.\n", child_to_descend, idx, current_node, child_to_descend->n);
-                fix_underflow(current_node, idx); // fix_underflow вызывается для родителя current_node, чтобы исправить его ребенка children[idx]
-                btree_remove_recursive(current_node, ptr_to_delete, actually_free_payload);
-                return; // Важно! Предотвращаем двойной спуск.
-            }
-            // Если у ребенка достаточно ключей (>= T), просто спускаемся
-            btree_remove_recursive(child_to_descend, ptr_to_delete, actually_free_payload);
+        node = node->children[idx];
+    }
+
+    int idx = leaf_position(node, key);
+    if (idx == node->n || bnode_key(node, idx) != key) {
+        printf("[btree] Block %p not found in tree. Cannot remove.\n", ptr);
+        return;
+    }
+    size_t removed_size = bnode_size(node, idx);
+    int removed_free = bnode_is_free(node, idx);
+    remove_entry_from_leaf(node, idx);
+
+    if (TREE->leaf && TREE->n == 0) {
+        printf("[btree] Root (leaf) %p became empty. Tree is now empty.\n", TREE);
+        free_node(TREE);
+        TREE = NULL;
+        tree_modified = 1;
+    }
+    printf("[btree] Finished removal of block %p.\n", ptr);
+    notify(BTREE_EV_REMOVE, ptr, removed_size, 0, removed_free);
+}
+
+
+void btree_update_size(BNode* node, int index, size_t size) {
+    if (!node || index < 0 || index >= node->n) return;
+    size_t old_size = bnode_size(node, index);
+    bnode_set_size(node, index, size);
+    tree_modified = 1;
+    notify(BTREE_EV_RESIZE, bnode_block(node, index), size, old_size, bnode_is_free(node, index));
+}
+
+// Спуск к листу start, дальше - последовательно по цепочке листов без возврата к корню.
+// Разделители сравниваются как адреса: start может лежать вне окна компактных ключей.
+void btree_walk_range(void* start, void* end, btree_walk_fn fn, void* ctx) {
+    BNode* leaf = TREE;
+    if (!leaf) return;
+    while (!leaf->leaf) {
+        int i = 0;
+        while (i < leaf->n && (uintptr_t)btree_key_ptr(leaf->seps[i]) <= (uintptr_t)start) i++;
+        leaf = leaf->children[i];
+    }
+    for (; leaf; leaf = leaf->next) {
+        bnode_prefetch_next(leaf);
+        for (int i = 0; i < leaf->n; i++) {
+            void* block = bnode_block(leaf, i);
+            if ((uintptr_t)block < (uintptr_t)start) continue;
+            if (end && (uintptr_t)block >= (uintptr_t)end) return;
+            fn(block, bnode_size(leaf, i), bnode_is_free(leaf, i), ctx);
         }
-    } 
+    }
 }
 
-// Основная функция удаления
-void btree_remove(void* ptr) {
-    if (!root) {
-        printf("[btree] Tree is empty, cannot remove %p\n", ptr);
+void btree_walk(btree_walk_fn fn, void* ctx) {
+    btree_walk_range(NULL, NULL, fn, ctx);
+}
+
+typedef struct {
+    BNode* node;  // Слот узла
+    size_t order; // Место узла в порядке обхода
+} NodeSlot;
+
+static int compare_slots(const void* a, const void* b) {
+    uintptr_t x = (uintptr_t)((const NodeSlot*)a)->node;
+    uintptr_t y = (uintptr_t)((const NodeSlot*)b)->node;
+    return x < y ? -1 : x > y;
+}
+
+static size_t count_nodes(BNode* node) {
+    size_t count = 1;
+    if (!node->leaf) {
+        for (int i = 0; i <= node->n; i++) count += count_nodes(node->children[i]);
+    }
+    return count;
+}
+
+// Очередь обхода в ширину - сам массив order
+static void layout_bfs(BNode* tree, BNode** order, size_t* n) {
+    order[(*n)++] = tree;
+    for (size_t i = 0; i < *n; i++) {
+        BNode* node = order[i];
+        if (node->leaf) continue;
+        for (int k = 0; k <= node->n; k++) order[(*n)++] = node->children[k];
+    }
+}
+
+static void layout_veb(BNode* node, int height, BNode** order, size_t* n);
+
+static void layout_veb_bottoms(BNode* node, int depth, int height, BNode** order, size_t* n) {
+    if (depth == 0) {
+        layout_veb(node, height, order, n);
         return;
     }
+    for (int k = 0; k <= node->n; k++) layout_veb_bottoms(node->children[k], depth - 1, height, order, n);
+}
 
-    int temp_idx;
-    BNode* node_check = find_node(root, ptr, &temp_idx); // find_node должен быть надежным
-    if (!node_check || (node_check->blocks[temp_idx] != ptr && !node_check->is_free[temp_idx])) { // Добавил !is_free для более точной проверки "не найден"
-        printf("[btree] Block %p not found in tree or consistency issue. Cannot remove.\n", ptr);
+// Верхние height уровней поддерева: сначала верхняя половина уровней, затем по порядку
+// каждое поддерево нижней половины. Все листья B-дерева на одной глубине, поэтому
+// высоты поддеревьев одного уровня совпадают.
+static void layout_veb(BNode* node, int height, BNode** order, size_t* n) {
+    if (height == 1) {
+        order[(*n)++] = node;
         return;
     }
-    // Если блок найден, но помечен как is_free, это может быть состояние для субаллокатора.
-    // btree_remove подразумевает полное удаление и освобождение.
-    // if (node_check->is_free[temp_idx]) {
-    //     printf("[btree] Block %p is marked as 'is_free'. Proceeding with full removal.\n", ptr);
-    // }
+    int top = height / 2;
+    layout_veb(node, top, order, n);
+    layout_veb_bottoms(node, top, height - top, order, n);
+}
 
-    printf("[btree] Attempting to remove block %p from tree.\n", ptr);
-    btree_remove_recursive(root, ptr, 1 /* initial call: actually_free_payload is true */);
+// Новое место узла: слот, отданный узлу с его местом в порядке обхода
+static BNode* relocated(BNode* node, const NodeSlot* slots, size_t count) {
+    NodeSlot key = {node, 0};
+    const NodeSlot* slot = bsearch(&key, slots, count, sizeof(NodeSlot), compare_slots);
+    return slots[slot->order].node;
+}
 
-    if (root && root->n == 0 && !root->leaf && root->children[0]) {
-        BNode* old_root = root;
-        root = root->children[0];
-        printf("[btree] Root %p became empty, new root is child %p.\n", old_root, root);
-        free(old_root);
-        tree_modified = 1;
-    } else if (root && root->n == 0 && root->leaf) {
-        printf("[btree] Root (leaf) %p became empty. Tree is now empty.\n", root);
-        free(root);
-        root = NULL;
-        tree_modified = 1;
+// Узлы переставляются по слотам, которые дерево уже занимает: i-й в порядке обхода
+// получает i-й по адресу слот. Новой памяти в пуле не требуется, дерево не растёт.
+static void relayout_tree(void) {
+    if (!current_tree) main_created = 0;
+    if (!TREE || TREE->leaf || layout == BTREE_LAYOUT_NONE) return;
+    size_t count = count_nodes(TREE);
+    BNode** order = malloc(count * sizeof(BNode*));
+    NodeSlot* slots = malloc(count * sizeof(NodeSlot));
+    BNode* copies = malloc(count * sizeof(BNode));
+    if (!order || !slots || !copies) {
+        printf("[btree] Not enough memory to relayout %zu nodes\n", count);
+        free(order);
+        free(slots);
+        free(copies);
+        return;
     }
-    printf("[btree] Finished removal of block %p.\n", ptr);
+    size_t n = 0;
+    if (layout == BTREE_LAYOUT_BFS) layout_bfs(TREE, order, &n);
+    else layout_veb(TREE, btree_height(), order, &n);
+
+    for (size_t i = 0; i < count; i++) {
+        slots[i] = (NodeSlot){order[i], i};
+        copies[i] = *order[i];
+    }
+    qsort(slots, count, sizeof(NodeSlot), compare_slots);
+    // slots[j].node - j-й по адресу слот, он достаётся узлу order[j]
+    for (size_t j = 0; j < count; j++) {
+        BNode* copy = &copies[j];
+        if (copy->leaf) {
+            if (copy->next) copy->next = relocated(copy->next, slots, count);
+            continue;
+        }
+        for (int k = 0; k <= copy->n; k++) copy->children[k] = relocated(copy->children[k], slots, count);
+    }
+    for (size_t j = 0; j < count; j++) *slots[j].node = copies[j];
+    TREE = slots[0].node;
+    tree_modified = 1;
+    printf("[btree] Relayout of %zu nodes in %s order\n", count, layout == BTREE_LAYOUT_BFS ? "breadth-first" : "van Emde Boas");
+    free(order);
+    free(slots);
+    free(copies);
+}
+
+void btree_set_layout(int mode) {
+    layout = mode;
+}
+
+int btree_layout(void) {
+    return layout;
+}
+
+void btree_relayout(void) {
+    relayout_tree();
+}
+
+int btree_height(void) {
+    int height = 0;
+    for (BNode* node = TREE; node; node = node->leaf ? NULL : node->children[0]) {
+        height++;
+    }
+    return height;
 }
 
+static size_t mark_free_block(void* ptr) {
+    int index;
+    BNode* node = find_node(TREE, ptr, &index);
+    if (!node) {
+        printf("[btree] Block %p not found, cannot mark free.\n", ptr);
+        return 0;
+    }
+    if (bnode_is_free(node, index)) {
+        printf("[btree] Double free of block %p detected.\n", ptr);
+        return 0;
+    }
+    bnode_set_free(node, index, 1);
+    tree_modified = 1;
+    notify(BTREE_EV_RELEASE, ptr, bnode_size(node, index), 0, 1);
+    return bnode_size(node, index);
+}
 
 void btree_full_free(void* ptr) {
     btree_remove(ptr); // btree_remove now handles full deallocation
@@ -564,6 +680,7 @@ void btree_cleanup_node(BNode* node) {
     if (!node) return;
 
     // Recursively cleanup children first
+    bnode_prefetch_children(node);
     if (!node->leaf) {
         for (int i = 0; i <= node->n; i++) {
             btree_cleanup_node(node->children[i]);
@@ -571,78 +688,106 @@ void btree_cleanup_node(BNode* node) {
         }
     }
 
-    // Free blocks held by this node
-    for (int i = 0; i < node->n; i++) {
-        if (node->blocks[i]) {
-            printf("[btree_cleanup] Freeing block %p (size %zu, is_free %d) from node %p\n",
-                   node->blocks[i], node->sizes[i], node->is_free[i], node);
-            free(node->blocks[i]); // System free the data block
-            node->blocks[i] = NULL;
-        }
-    }
+    // Блоки не освобождаются здесь: их память возвращается вместе с областями
     // Free the B-Tree node structure itself
     printf("[btree_cleanup] Freeing BNode structure %p\n", node);
-    free(node);
+    free_node(node);
 }
 
 void btree_cleanup() {
-    if (root) {
-        btree_cleanup_node(root);
-        root = NULL;
+    if (TREE) {
+        btree_cleanup_node(TREE);
+        TREE = NULL;
         tree_modified = 1; // Indicate tree structure changed (it's gone)
         printf("[btree] Cleaned up B-tree.\n");
+        notify(BTREE_EV_CLEAR, NULL, 0, 0, 0);
     } else {
         printf("[btree] Cleanup called on an empty tree.\n");
     }
 }
 
-static void search_best_fit_recursive(BNode* node, size_t size,
-                                      void** best_block_ptr, size_t* best_diff_ptr,
-                                      int* best_index_ptr, BNode** best_node_ptr) {
-    if (!node) return;
-
-    for (int i = 0; i < node->n; i++) {
-        if (node->is_free[i] && node->blocks[i] && node->sizes[i] >= size) {
-            size_t current_diff = node->sizes[i] - size;
-            if (current_diff < *best_diff_ptr) {
-                *best_block_ptr = node->blocks[i];
-                *best_diff_ptr = current_diff;
-                *best_index_ptr = i;
-                *best_node_ptr = node;
-                if (current_diff == 0) return; // Exact fit found, no need to search further
-            }
-        }
-    }
-
-    if (!node->leaf) {
-        for (int i = 0; i <= node->n; i++) {
-            // Pruning: if best_diff is already 0 (exact fit), stop.
-            if (*best_diff_ptr == 0) return;
-            search_best_fit_recursive(node->children[i], size, best_block_ptr, best_diff_ptr, best_index_ptr, best_node_ptr);
-        }
-    }
-}
-
-void* btree_find_best_fit(size_t size) {
-    if (!root || size == 0) return NULL;
+// Блоки упорядочены по адресу, а не по размеру, поэтому best-fit просматривает все записи:
+// по цепочке листов подряд, внутренние узлы после спуска к первому листу не нужны.
+static void* find_best_fit_block(size_t size, size_t align) {
+    if (!TREE || size == 0) return NULL;
 
     void* best_block = NULL;
     size_t best_diff = SIZE_MAX; // Using SIZE_MAX from <stdint.h>
     int best_index = -1;
     BNode* best_node = NULL;
 
-    search_best_fit_recursive(root, size, &best_block, &best_diff, &best_index, &best_node);
+    BNode* leaf = TREE;
+    while (!leaf->leaf) leaf = leaf->children[0];
+    for (; leaf && best_diff != 0; leaf = leaf->next) {
+        bnode_prefetch_next(leaf);
+        for (int i = 0; i < leaf->n; i++) {
+            if (!bnode_is_free(leaf, i)) continue;
+            void* block = bnode_block(leaf, i);
+            size_t block_size = bnode_size(leaf, i);
+            if (block_size >= size && block_size - size < best_diff && !((uintptr_t)block & (align - 1))) {
+                best_block = block;
+                best_diff = block_size - size;
+                best_index = i;
+                best_node = leaf;
+                if (best_diff == 0) break; // Exact fit found, no need to search further
+            }
+        }
+    }
 
     if (best_block) {
         printf("[btree] Found best fit block %p (actual size %zu) for requested size %zu in node %p at index %d.\n",
-               best_block, best_node->sizes[best_index], size, best_node, best_index);
-        best_node->is_free[best_index] = 0; // Mark as used
+               best_block, bnode_size(best_node, best_index), size, best_node, best_index);
+        bnode_set_free(best_node, best_index, 0); // Mark as used
         // Optionally, if the chosen block is much larger, consider splitting it
         // and adding the remainder as a new free block (more complex).
         tree_modified = 1;
+        notify(BTREE_EV_REUSE, best_block, bnode_size(best_node, best_index), 0, 0);
         return best_block;
     }
 
     printf("[btree] No suitable free block found for size %zu.\n", size);
     return NULL;
-}
\ No newline at end of file
+}
+
+// Замер задержек внутренних операций дерева (latency.c)
+void btree_insert(size_t size, void* ptr) {
+    uint64_t start = latency_start();
+    insert_block(size, ptr);
+    latency_stop(LAT_INSERT, start);
+}
+
+void btree_remove(void* ptr) {
+    uint64_t start = latency_start();
+    remove_block(ptr);
+    latency_stop(LAT_REMOVE, start);
+}
+
+// Без отладочного вывода find_node: вызывается на пути шарда
+size_t btree_block_size(void* ptr) {
+    if (!TREE || !btree_addressable(ptr)) return 0;
+    BKey key = btree_key(ptr);
+    BNode* leaf = find_leaf(TREE, key);
+    int i = leaf_position(leaf, key);
+    return i < leaf->n && bnode_key(leaf, i) == key ? bnode_size(leaf, i) : 0;
+}
+
+size_t btree_mark_free(void* ptr) {
+    uint64_t start = latency_start();
+    size_t size = mark_free_block(ptr);
+    latency_stop(LAT_MARK_FREE, start);
+    return size;
+}
+
+void* btree_find_best_fit(size_t size) {
+    uint64_t start = latency_start();
+    void* block = find_best_fit_block(size, 1);
+    latency_stop(LAT_BEST_FIT, start);
+    return block;
+}
+
+void* btree_find_best_fit_aligned(size_t size, size_t align) {
+    uint64_t start = latency_start();
+    void* block = find_best_fit_block(size, align);
+    latency_stop(LAT_BEST_FIT, start);
+    return block;
+}
@@ -2,29 +2,189 @@
 #define B_TREE_H
 
 #include <stddef.h>
+#include <stdint.h>
 
-#define T 2 // Минимальная степень B-дерева
+#define BTREE_LINE 64 // Строка кэша: шаг слотов пула узлов и единица подгрузки
+
+// B+-дерево: записи о блоках (адрес, размер, флаг) хранятся только в листьях, листья
+// связаны по возрастанию адресов. Внутренние узлы держат лишь разделители и детей,
+// поэтому ветвление у них больше, чем записей в листе. Разделитель seps[i] не больше
+// наименьшего ключа поддерева children[i+1] и больше всех ключей children[i].
+#ifdef TREEALOC_COMPACT_NODES
+// Компактный формат (сборка с -DTREEALOC_COMPACT_NODES): адрес блока - 32-битное смещение
+// от базы окна областей в гранулах, размер - в гранулах, флаги свободы - битовая карта.
+// 8 байт на запись вместо 20, узел занимает одну строку кэша (64 байта вместо 128).
+// Индексировать можно только блоки окна (region.h); остальные btree_insert не принимает.
+#include "region.h"
+
+#define BTREE_GRANULE REGION_ALIGN
+#define BTREE_LEAF_KEYS 6 // Записей в листе
+#define BTREE_FANOUT 5    // Детей внутреннего узла
+
+typedef uint32_t BKey;
 
 typedef struct BNode {
-    int n;              // Количество ключей в узле
+    uint8_t n;                    // Записей в листе или разделителей во внутреннем узле
+    uint8_t leaf;
+    uint8_t freed;
+    uint8_t free_bits;            // Бит i - блок i свободен
+    union {
+        struct {
+            BKey keys[BTREE_LEAF_KEYS];         // (адрес - region_window_base) / BTREE_GRANULE
+            uint32_t granules[BTREE_LEAF_KEYS]; // Размер блока в гранулах
+            struct BNode* next;                 // Следующий лист
+        };
+        struct {
+            BKey seps[BTREE_FANOUT-1];
+            struct BNode* children[BTREE_FANOUT];
+        };
+    };
+} BNode;
+
+_Static_assert(BTREE_LEAF_KEYS <= 8, "free_bits holds at most 8 keys");
+_Static_assert(sizeof(BNode) <= BTREE_LINE, "compact node must fit a cache line");
+
+static inline int btree_addressable(const void* ptr) {
+    return (uintptr_t)ptr - region_window_base < region_window_bytes;
+}
+static inline BKey btree_key(const void* ptr) {
+    return (BKey)(((uintptr_t)ptr - region_window_base) / BTREE_GRANULE);
+}
+static inline void* btree_key_ptr(BKey key) {
+    return (void*)(region_window_base + (uintptr_t)key * BTREE_GRANULE);
+}
+static inline BKey bnode_key(const BNode* node, int i) { return node->keys[i]; }
+static inline void* bnode_block(const BNode* node, int i) { return btree_key_ptr(node->keys[i]); }
+static inline size_t bnode_size(const BNode* node, int i) { return (size_t)node->granules[i] * BTREE_GRANULE; }
+static inline int bnode_is_free(const BNode* node, int i) { return (node->free_bits >> i) & 1; }
+static inline void bnode_set_block(BNode* node, int i, void* block) { node->keys[i] = btree_key(block); }
+static inline void bnode_set_size(BNode* node, int i, size_t size) { node->granules[i] = (uint32_t)(size / BTREE_GRANULE); }
+static inline void bnode_set_free(BNode* node, int i, int is_free) {
+    node->free_bits = (uint8_t)((node->free_bits & ~(1u << i)) | ((unsigned)(is_free != 0) << i));
+}
+#else
+#define BTREE_LEAF_KEYS 5 // Записей в листе
+#define BTREE_FANOUT 7    // Детей внутреннего узла; узел занимает две строки кэша
+
+typedef uintptr_t BKey; // Ключ упорядочения - адрес блока
+
+typedef struct BNode {
+    int n;              // Записей в листе или разделителей во внутреннем узле
     int leaf;           // Является ли узел листом (1 - да, 0 - нет)
-    size_t sizes[2*T-1]; // Размеры блоков
-    void* blocks[2*T-1]; // Указатели на блоки
-    int is_free[2*T-1]; // Флаги свободных блоков (0 - занят, 1 - свободен)
-    struct BNode* children[2*T]; // Указатели на дочерние узлы
+    union {
+        struct {
+            size_t sizes[BTREE_LEAF_KEYS]; // Размеры блоков
+            void* blocks[BTREE_LEAF_KEYS]; // Указатели на блоки
+            int is_free[BTREE_LEAF_KEYS];  // Флаги свободных блоков (0 - занят, 1 - свободен)
+            struct BNode* next;            // Следующий лист
+        };
+        struct {
+            BKey seps[BTREE_FANOUT-1];             // Разделители поддеревьев
+            struct BNode* children[BTREE_FANOUT];  // Указатели на дочерние узлы
+        };
+    };
     int freed;          // Флаг, указывающий, был ли узел освобождён
 } BNode;
 
+static inline int btree_addressable(const void* ptr) { (void)ptr; return 1; }
+static inline BKey btree_key(const void* ptr) { return (uintptr_t)ptr; }
+static inline void* btree_key_ptr(BKey key) { return (void*)key; }
+static inline BKey bnode_key(const BNode* node, int i) { return (uintptr_t)node->blocks[i]; }
+static inline void* bnode_block(const BNode* node, int i) { return node->blocks[i]; }
+static inline size_t bnode_size(const BNode* node, int i) { return node->sizes[i]; }
+static inline int bnode_is_free(const BNode* node, int i) { return node->is_free[i]; }
+static inline void bnode_set_block(BNode* node, int i, void* block) { node->blocks[i] = block; }
+static inline void bnode_set_size(BNode* node, int i, size_t size) { node->sizes[i] = size; }
+static inline void bnode_set_free(BNode* node, int i, int is_free) { node->is_free[i] = is_free; }
+#endif
+
+// Минимум заполнения некорневых узлов: слияние двух минимальных узлов помещается в один
+#define BTREE_LEAF_MIN (BTREE_LEAF_KEYS / 2)
+#define BTREE_INNER_MIN (BTREE_FANOUT / 2 - 1) // Разделителей
+
+// Подгрузка узла в кэш до обращения к нему (узел занимает целые строки слота пула)
+static inline void bnode_prefetch(const BNode* node) {
+    __builtin_prefetch(node);
+    if (sizeof(BNode) > BTREE_LINE) __builtin_prefetch((const char*)node + BTREE_LINE);
+}
+
+extern int btree_prefetch_enabled; // 0 - без подгрузки (для замеров)
+
+// Дети узла подгружаются одновременно, пока просматриваются ключи самого узла
+static inline void bnode_prefetch_children(const BNode* node) {
+    if (node->leaf || !btree_prefetch_enabled) return;
+    for (int i = 0; i <= node->n; i++) bnode_prefetch(node->children[i]);
+}
+
+// Следующий лист подгружается, пока просматриваются записи текущего
+static inline void bnode_prefetch_next(const BNode* leaf) {
+    if (leaf->next && btree_prefetch_enabled) bnode_prefetch(leaf->next);
+}
+
 extern BNode* root;
 extern int tree_modified;
 
+// События изменения дерева (для визуализатора и других наблюдателей)
+enum {
+    BTREE_EV_INSERT = 1, // Новый блок добавлен в дерево
+    BTREE_EV_REMOVE,     // Блок удалён из дерева
+    BTREE_EV_REUSE,      // Свободный блок снова выдан (free -> used)
+    BTREE_EV_RESIZE,     // Размер блока изменён на месте
+    BTREE_EV_CLEAR,      // Дерево полностью очищено
+    BTREE_EV_RELEASE     // Блок освобождён и остаётся в дереве (used -> free)
+};
+
+typedef struct {
+    int type;
+    void* block;
+    size_t size;      // Текущий размер блока
+    size_t old_size;  // Прежний размер (только для BTREE_EV_RESIZE)
+    int is_free;      // Состояние блока на момент события
+} BTreeEvent;
+
+typedef void (*btree_listener_fn)(const BTreeEvent* ev, void* ctx);
+typedef void (*btree_walk_fn)(void* block, size_t size, int is_free, void* ctx);
+
+#define BTREE_MAX_LISTENERS 8
+
+// Операции ниже работают с деревом, выбранным потоком (NULL - основное дерево root)
+void btree_select(BNode** tree_root);
+int btree_main_selected(void);
 void btree_insert(size_t size, void* ptr);
 void btree_debug();
 void btree_remove(void* ptr);
+size_t btree_mark_free(void* ptr); // Размер блока или 0, если блок не найден или уже свободен
+size_t btree_block_size(void* ptr); // Ёмкость блока выбранного дерева или 0
 void btree_full_free(void* ptr);
 void btree_cleanup();
 void btree_cleanup_node(BNode* node); // Добавляем прототип
 void* btree_find_best_fit(size_t size);
-BNode* find_node(BNode* node, void* ptr, int* index);
+void* btree_find_best_fit_aligned(size_t size, size_t align); // Только блоки с адресом, кратным align
+BNode* find_node(BNode* node, void* ptr, int* index); // Лист с записью блока
+void btree_update_size(BNode* node, int index, size_t size);
+int btree_height(void);
+
+// Раскладка узлов в пуле (по умолчанию выключена): когда с прошлой перестановки в
+// основном дереве создано не меньше узлов, чем в нём живёт, его узлы переставляются
+// по своим же слотам в порядке обхода в ширину или van Emde Boas. Деревья шардов
+// переставляются только явно (btree_relayout). Спуск и обходы подгружают детей заранее.
+enum {
+    BTREE_LAYOUT_NONE = 0, // Порядок создания узлов
+    BTREE_LAYOUT_BFS,
+    BTREE_LAYOUT_VEB
+};
+#define BTREE_RELAYOUT_MIN 64 // Меньшие деревья не переставляются автоматически
+
+void btree_set_layout(int layout);
+int btree_layout(void);
+void btree_relayout(void);           // Сразу, для выбранного дерева
+void btree_walk(btree_walk_fn fn, void* ctx); // Обход блоков в порядке возрастания адресов
+// Блоки с адресами из [start, end) по цепочке листов; end == NULL - до конца дерева
+void btree_walk_range(void* start, void* end, btree_walk_fn fn, void* ctx);
+// Обычные наблюдатели видят только основное дерево; concurrent - ещё и деревья
+// шардов, события которых приходят параллельно из разных потоков
+int btree_add_listener(btree_listener_fn fn, void* ctx);
+int btree_add_concurrent_listener(btree_listener_fn fn, void* ctx);
+void btree_remove_listener(btree_listener_fn fn, void* ctx);
 
 #endif
\ No newline at end of file
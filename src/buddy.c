@@ -0,0 +1,159 @@
+#include "buddy.h"
+#include "region.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct BuddyFree {
+    struct BuddyFree* next;
+    struct BuddyFree* prev;
+} BuddyFree;
+
+typedef struct BuddyPool {
+    Span span;
+    struct BuddyPool* next;
+    // Для каждого порядка: бит на блок этого размера - "свободен" и "занят"
+    uint64_t* free_bits[BUDDY_ORDERS];
+    uint64_t* used_bits[BUDDY_ORDERS];
+    uint64_t bits[]; // Память всех карт
+} BuddyPool;
+
+static BuddyFree* free_lists[BUDDY_ORDERS];
+static uint32_t nonempty; // Бит на порядок с непустым списком
+static BuddyPool* pools;
+static buddy_pool_fn pool_hook;
+
+static inline int test_bit(const uint64_t* map, size_t i) { return (map[i >> 6] >> (i & 63)) & 1; }
+static inline void set_bit(uint64_t* map, size_t i) { map[i >> 6] |= 1ull << (i & 63); }
+static inline void clear_bit(uint64_t* map, size_t i) { map[i >> 6] &= ~(1ull << (i & 63)); }
+
+static void push_free(BuddyPool* pool, int k, uintptr_t off) {
+    BuddyFree* b = (BuddyFree*)(pool->span.base + off);
+    b->prev = NULL;
+    b->next = free_lists[k];
+    if (b->next) b->next->prev = b;
+    free_lists[k] = b;
+    nonempty |= 1u << k;
+    set_bit(pool->free_bits[k], off >> (k + BUDDY_MIN_ORDER));
+}
+
+static void remove_free(BuddyPool* pool, int k, uintptr_t off) {
+    BuddyFree* b = (BuddyFree*)(pool->span.base + off);
+    if (b->prev) b->prev->next = b->next;
+    else free_lists[k] = b->next;
+    if (b->next) b->next->prev = b->prev;
+    if (!free_lists[k]) nonempty &= ~(1u << k);
+    clear_bit(pool->free_bits[k], off >> (k + BUDDY_MIN_ORDER));
+}
+
+// Пул выравнивается по своему размеру
+static BuddyPool* add_pool(void) {
+    size_t size = BUDDY_MAX_BLOCK;
+    char* base = region_map_pool(size, size);
+    if (!base) {
+        printf("[buddy] mmap of pool failed\n");
+        return NULL;
+    }
+
+    size_t words = 0;
+    for (int k = 0; k < BUDDY_ORDERS; k++) words += ((((size_t)1 << (BUDDY_ORDERS - 1 - k)) + 63) >> 6) * 2;
+    BuddyPool* pool = calloc(1, sizeof(BuddyPool) + words * sizeof(uint64_t));
+    if (!pool) {
+        region_unmap_pool(base, size);
+        return NULL;
+    }
+    uint64_t* cursor = pool->bits;
+    for (int k = 0; k < BUDDY_ORDERS; k++) {
+        size_t n = (((size_t)1 << (BUDDY_ORDERS - 1 - k)) + 63) >> 6;
+        pool->free_bits[k] = cursor;
+        pool->used_bits[k] = cursor + n;
+        cursor += 2 * n;
+    }
+    pool->span = (Span){SPAN_BUDDY, (uintptr_t)base, size, pool};
+    pagemap_set((uintptr_t)base, size, &pool->span);
+    pool->next = pools;
+    pools = pool;
+    push_free(pool, BUDDY_ORDERS - 1, 0);
+    printf("[buddy] Added %zu-byte pool at %p\n", size, base);
+    if (pool_hook) pool_hook(base, size);
+    return pool;
+}
+
+void buddy_set_pool_hook(buddy_pool_fn on_pool) {
+    pool_hook = on_pool;
+}
+
+int buddy_reserve(size_t bytes) {
+    for (size_t have = 0; have < bytes; have += BUDDY_MAX_BLOCK) {
+        if (!add_pool()) return -1;
+    }
+    return 0;
+}
+
+void* buddy_malloc(size_t size) {
+    if (size > BUDDY_MAX_BLOCK) return NULL;
+    int order = size <= ((size_t)1 << BUDDY_MIN_ORDER) ? BUDDY_MIN_ORDER : 64 - __builtin_clzll((unsigned long long)(size - 1));
+    int want = order - BUDDY_MIN_ORDER;
+    uint32_t avail = nonempty & (~0u << want);
+    if (!avail) {
+        if (!add_pool()) return NULL;
+        avail = nonempty & (~0u << want);
+    }
+    int k = __builtin_ctz(avail);
+    BuddyFree* b = free_lists[k];
+    BuddyPool* pool = pagemap_lookup(b)->owner;
+    uintptr_t off = (uintptr_t)b - pool->span.base;
+    remove_free(pool, k, off);
+    // Лишние половины уходят в списки меньших порядков
+    while (k > want) {
+        k--;
+        push_free(pool, k, off + ((uintptr_t)1 << (k + BUDDY_MIN_ORDER)));
+    }
+    set_bit(pool->used_bits[want], off >> order);
+    return b;
+}
+
+// Порядок занятого блока: первый, на котором смещение выровнено и бит занятости стоит
+static int block_order(BuddyPool* pool, uintptr_t off) {
+    for (int k = 0; k < BUDDY_ORDERS; k++) {
+        int shift = k + BUDDY_MIN_ORDER;
+        if (off & (((uintptr_t)1 << shift) - 1)) return -1;
+        if (test_bit(pool->used_bits[k], off >> shift)) return k;
+    }
+    return -1;
+}
+
+int buddy_free(Span* span, void* ptr) {
+    BuddyPool* pool = span->owner;
+    uintptr_t off = (uintptr_t)ptr - pool->span.base;
+    int k = block_order(pool, off);
+    if (k < 0) return -1;
+    clear_bit(pool->used_bits[k], off >> (k + BUDDY_MIN_ORDER));
+    while (k < BUDDY_ORDERS - 1) {
+        uintptr_t buddy = off ^ ((uintptr_t)1 << (k + BUDDY_MIN_ORDER));
+        if (!test_bit(pool->free_bits[k], buddy >> (k + BUDDY_MIN_ORDER))) break;
+        remove_free(pool, k, buddy);
+        off &= ~((uintptr_t)1 << (k + BUDDY_MIN_ORDER));
+        k++;
+    }
+    push_free(pool, k, off);
+    return 0;
+}
+
+size_t buddy_usable_size(Span* span, void* ptr) {
+    BuddyPool* pool = span->owner;
+    int k = block_order(pool, (uintptr_t)ptr - pool->span.base);
+    return k < 0 ? 0 : (size_t)1 << (k + BUDDY_MIN_ORDER);
+}
+
+void buddy_release_all(void) {
+    while (pools) {
+        BuddyPool* next = pools->next;
+        pagemap_clear(pools->span.base, pools->span.size);
+        region_unmap_pool((void*)pools->span.base, pools->span.size);
+        free(pools);
+        pools = next;
+    }
+    for (int k = 0; k < BUDDY_ORDERS; k++) free_lists[k] = NULL;
+    nonempty = 0;
+}
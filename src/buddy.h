@@ -0,0 +1,30 @@
+#ifndef BUDDY_H
+#define BUDDY_H
+
+#include "pagemap.h"
+#include <stddef.h>
+
+// Двоичная система близнецов: пул 4 МБ, выровненный по своему размеру, делится
+// пополам до блока нужной степени двойки. Адрес близнеца - смещение XOR размер,
+// поэтому слияние при освобождении - проверка бита в битовой карте порядка.
+// Заголовков у блоков нет: порядок занятого блока хранится битом в карте
+// занятых, и запросы ровно степени двойки не теряют ни байта.
+//
+// В B-дерево пул попадает одной записью, в карту страниц - участком SPAN_BUDDY.
+
+#define BUDDY_MIN_ORDER 4   // 16 байт
+#define BUDDY_MAX_ORDER 22  // 4 МБ - размер пула и самый крупный блок
+#define BUDDY_ORDERS (BUDDY_MAX_ORDER - BUDDY_MIN_ORDER + 1)
+#define BUDDY_MAX_BLOCK ((size_t)1 << BUDDY_MAX_ORDER)
+
+typedef void (*buddy_pool_fn)(void* base, size_t size);
+
+// Вызывающий держит блокировку аллокатора
+void buddy_set_pool_hook(buddy_pool_fn on_pool);
+void* buddy_malloc(size_t size);   // NULL и для запросов больше BUDDY_MAX_BLOCK
+int buddy_free(Span* span, void* ptr); // -1 - не занятый блок пула
+size_t buddy_usable_size(Span* span, void* ptr);
+int buddy_reserve(size_t bytes);
+void buddy_release_all(void);
+
+#endif
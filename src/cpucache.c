@@ -0,0 +1,347 @@
+#define _GNU_SOURCE
+#include "cpucache.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) && defined(__linux__) && __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#include <linux/membarrier.h>
+#define CPUCACHE_HAVE_RSEQ 1
+#endif
+
+typedef struct {
+    uint32_t stopped; // Кэш забирает сливающий поток: быстрый путь уходит на медленный
+    uint32_t count[CPUCACHE_CLASSES];
+    void* items[CPUCACHE_CLASSES][CPUCACHE_SLOTS];
+} __attribute__((aligned(64))) CpuCache;
+
+typedef struct {
+    unsigned generation; // Кэш прошлой эпохи (до cleanup) выбрасывается
+    uint32_t count[CPUCACHE_CLASSES];
+    void* items[CPUCACHE_CLASSES][CPUCACHE_SLOTS];
+} ThreadCache;
+
+static int enabled;
+static uint32_t capacity[CPUCACHE_CLASSES];
+static CpuCache* cpu_caches;
+static long cpu_count;
+static int fence_ok; // membarrier умеет перезапускать rseq на заданном процессоре
+static _Atomic unsigned generation;
+static void (*release_fn)(void* ptr);
+static pthread_key_t exit_key;
+static pthread_once_t exit_once = PTHREAD_ONCE_INIT;
+
+static __thread int thread_mode;
+static __thread ThreadCache* thread_cache;
+#ifdef CPUCACHE_HAVE_RSEQ
+static __thread struct rseq* thread_rseq;
+static __thread struct rseq own_rseq __attribute__((aligned(32)));
+static __thread int own_registered;
+#endif
+
+// Второе слово блока в кэше - метка (первое свободно для списков других кэшей): по ней
+// treealoc_usable_size отличает кэшированный блок от занятого. Снимается при выдаче блока.
+static inline uintptr_t mark_key(void) {
+    return (uintptr_t)&cpu_caches ^ (uintptr_t)0xc2b2ae3d27d4eb4full;
+}
+
+static inline int class_of(size_t size) {
+    return size && size <= CPUCACHE_GRANULE * CPUCACHE_CLASSES ? (int)(size / CPUCACHE_GRANULE) - 1 : -1;
+}
+
+static void flush_thread_cache(ThreadCache* cache) {
+    if (cache->generation == atomic_load(&generation)) {
+        for (int c = 0; c < CPUCACHE_CLASSES; c++) {
+            for (uint32_t i = 0; i < cache->count[c]; i++) release_fn(cache->items[c][i]);
+        }
+    }
+    munmap(cache, sizeof(ThreadCache));
+}
+
+static void thread_exit(void* arg) {
+    (void)arg;
+    ThreadCache* cache = thread_cache;
+    thread_cache = NULL;
+    thread_mode = CPUCACHE_OFF;
+    if (cache) flush_thread_cache(cache);
+#ifdef CPUCACHE_HAVE_RSEQ
+    // Ядро пишет в область rseq до её снятия с регистрации, а TLS потока сейчас освободится
+    if (own_registered) syscall(SYS_rseq, &own_rseq, 32, RSEQ_FLAG_UNREGISTER, RSEQ_SIG);
+    own_registered = 0;
+#endif
+}
+
+static void create_exit_key(void) {
+    pthread_key_create(&exit_key, thread_exit);
+}
+
+// Режим определяется при первом обращении потока
+static int thread_setup(void) {
+#ifdef CPUCACHE_HAVE_RSEQ
+    if (cpu_caches) {
+        if (__rseq_size > 0) {
+            // glibc уже зарегистрировал область rseq для потока
+            struct rseq* rs = (struct rseq*)((char*)__builtin_thread_pointer() + __rseq_offset);
+            if ((int32_t)rs->cpu_id >= 0) {
+                thread_rseq = rs;
+                return thread_mode = CPUCACHE_RSEQ;
+            }
+        } else if (syscall(SYS_rseq, &own_rseq, 32, 0, RSEQ_SIG) == 0) {
+            own_registered = 1;
+            pthread_setspecific(exit_key, (void*)1);
+            thread_rseq = &own_rseq;
+            return thread_mode = CPUCACHE_RSEQ;
+        }
+    }
+#endif
+    ThreadCache* cache = mmap(NULL, sizeof(ThreadCache), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (cache == MAP_FAILED) return CPUCACHE_OFF;
+    cache->generation = atomic_load(&generation);
+    thread_cache = cache;
+    pthread_setspecific(exit_key, cache);
+    return thread_mode = CPUCACHE_THREAD;
+}
+
+#ifdef CPUCACHE_HAVE_RSEQ
+// Последовательности: перед фиксирующей записью счётчика проверяется только
+// собственный процессор. Прерывание посреди - переход на метку abort и повтор.
+// Подпись RSEQ_SIG перед обработчиком обязательна: ядро сверяет её при перезапуске.
+#define RSEQ_DESCRIPTOR                      \
+    ".pushsection __rseq_cs, \"aw\"\n\t"     \
+    ".balign 32\n\t"                         \
+    "3:\n\t"                                 \
+    ".long 0x0, 0x0\n\t"                     \
+    ".quad 1f, (2f - 1f), 4f\n\t"            \
+    ".popsection\n\t"                        \
+    "leaq 3b(%%rip), %%rax\n\t"              \
+    "movq %%rax, %[rseq_cs]\n\t"
+
+#define RSEQ_ABORT_HANDLER                   \
+    ".pushsection __rseq_failure, \"ax\"\n\t" \
+    ".byte 0x0f, 0xb9, 0x3d\n\t"             \
+    ".long 0x53053053\n\t"                   \
+    "4:\n\t"                                 \
+    "jmp %l[abort]\n\t"                      \
+    ".popsection\n\t"
+
+// 0 - блок взят, 1 - кэш пуст или остановлен
+static int rseq_pop(int cls, void** out) {
+    struct rseq* rs = thread_rseq;
+retry:
+    __asm__ __volatile__ goto(
+        RSEQ_DESCRIPTOR
+        "1:\n\t"
+        "movl %[cpu_id], %%eax\n\t"
+        "imulq %[stride], %%rax, %%rax\n\t"
+        "addq %[base], %%rax\n\t"
+        "cmpl $0, (%%rax)\n\t"
+        "jne %l[slow]\n\t"
+        "movl %c[count](%%rax,%[cls],4), %%ecx\n\t"
+        "testl %%ecx, %%ecx\n\t"
+        "jz %l[slow]\n\t"
+        "subl $1, %%ecx\n\t"
+        "movq %[cls], %%rdx\n\t"
+        "shlq $6, %%rdx\n\t"
+        "addq %%rcx, %%rdx\n\t"
+        "movq %c[items](%%rax,%%rdx,8), %%rdx\n\t"
+        "movq %%rdx, %[out]\n\t"
+        "movl %%ecx, %c[count](%%rax,%[cls],4)\n\t"
+        "2:\n\t"
+        RSEQ_ABORT_HANDLER
+        :
+        : [cpu_id] "m"(rs->cpu_id), [rseq_cs] "m"(rs->rseq_cs), [stride] "i"(sizeof(CpuCache)),
+          [base] "r"(cpu_caches), [cls] "r"((uint64_t)cls), [count] "i"(offsetof(CpuCache, count)),
+          [items] "i"(offsetof(CpuCache, items)), [out] "m"(*out)
+        : "memory", "cc", "rax", "rcx", "rdx"
+        : abort, slow);
+    return 0;
+abort:
+    goto retry;
+slow:
+    return 1;
+}
+
+// 0 - блок положен, 1 - класс заполнен или кэш остановлен
+static int rseq_push(int cls, void* ptr) {
+    struct rseq* rs = thread_rseq;
+    uint32_t cap = capacity[cls];
+retry:
+    __asm__ __volatile__ goto(
+        RSEQ_DESCRIPTOR
+        "1:\n\t"
+        "movl %[cpu_id], %%eax\n\t"
+        "imulq %[stride], %%rax, %%rax\n\t"
+        "addq %[base], %%rax\n\t"
+        "cmpl $0, (%%rax)\n\t"
+        "jne %l[slow]\n\t"
+        "movl %c[count](%%rax,%[cls],4), %%ecx\n\t"
+        "cmpl %[cap], %%ecx\n\t"
+        "jae %l[slow]\n\t"
+        "movq %[cls], %%rdx\n\t"
+        "shlq $6, %%rdx\n\t"
+        "addq %%rcx, %%rdx\n\t"
+        "movq %[ptr], %c[items](%%rax,%%rdx,8)\n\t"
+        "addl $1, %%ecx\n\t"
+        "movl %%ecx, %c[count](%%rax,%[cls],4)\n\t"
+        "2:\n\t"
+        RSEQ_ABORT_HANDLER
+        :
+        : [cpu_id] "m"(rs->cpu_id), [rseq_cs] "m"(rs->rseq_cs), [stride] "i"(sizeof(CpuCache)),
+          [base] "r"(cpu_caches), [cls] "r"((uint64_t)cls), [count] "i"(offsetof(CpuCache, count)),
+          [items] "i"(offsetof(CpuCache, items)), [cap] "r"(cap), [ptr] "r"(ptr)
+        : "memory", "cc", "rax", "rcx", "rdx"
+        : abort, slow);
+    return 0;
+abort:
+    goto retry;
+slow:
+    return 1;
+}
+#endif
+
+int cpucache_enable(int on, void (*release_unlocked)(void* ptr)) {
+    if (!on) {
+        enabled = 0;
+        return CPUCACHE_OFF;
+    }
+    pthread_once(&exit_once, create_exit_key);
+    release_fn = release_unlocked;
+    for (int c = 0; c < CPUCACHE_CLASSES; c++) {
+        uint32_t depth = CPUCACHE_CLASS_BYTES / ((c + 1) * CPUCACHE_GRANULE);
+        capacity[c] = depth < 4 ? 4 : depth > CPUCACHE_SLOTS ? CPUCACHE_SLOTS : depth;
+    }
+#ifdef CPUCACHE_HAVE_RSEQ
+    if (!cpu_caches) {
+        cpu_count = sysconf(_SC_NPROCESSORS_CONF);
+        if (cpu_count < 1) cpu_count = 1;
+        void* mem = mmap(NULL, cpu_count * sizeof(CpuCache), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem != MAP_FAILED) cpu_caches = mem;
+        fence_ok = syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED_RSEQ, 0, 0) == 0;
+    }
+#endif
+    enabled = 1;
+    int mode = thread_mode ? thread_mode : thread_setup();
+    printf("[cpucache] Enabled: %s caches\n", mode == CPUCACHE_RSEQ ? "per-CPU (rseq)" : "per-thread");
+    return mode;
+}
+
+int cpucache_enabled(void) {
+    return enabled;
+}
+
+static int push_marked(int cls, void* ptr) {
+    int mode = thread_mode ? thread_mode : thread_setup();
+#ifdef CPUCACHE_HAVE_RSEQ
+    if (mode == CPUCACHE_RSEQ) return rseq_push(cls, ptr) == 0;
+#endif
+    if (mode != CPUCACHE_THREAD) return 0;
+    ThreadCache* cache = thread_cache;
+    if (cache->generation != atomic_load_explicit(&generation, memory_order_relaxed)) {
+        for (int c = 0; c < CPUCACHE_CLASSES; c++) cache->count[c] = 0;
+        cache->generation = atomic_load(&generation);
+    }
+    if (cache->count[cls] >= capacity[cls]) return 0;
+    cache->items[cls][cache->count[cls]++] = ptr;
+    return 1;
+}
+
+int cpucache_push(void* ptr, size_t size) {
+    int cls = class_of(size);
+    if (!enabled || cls < 0) return 0;
+    // Метка ставится до публикации: после неё блок может сразу забрать другой поток
+    ((uintptr_t*)ptr)[1] = mark_key();
+    if (push_marked(cls, ptr)) return 1;
+    ((uintptr_t*)ptr)[1] = 0;
+    return 0;
+}
+
+static void* pop_any(int cls) {
+    int mode = thread_mode ? thread_mode : thread_setup();
+#ifdef CPUCACHE_HAVE_RSEQ
+    if (mode == CPUCACHE_RSEQ) {
+        void* ptr;
+        return rseq_pop(cls, &ptr) == 0 ? ptr : NULL;
+    }
+#endif
+    if (mode != CPUCACHE_THREAD) return NULL;
+    ThreadCache* cache = thread_cache;
+    if (cache->generation != atomic_load_explicit(&generation, memory_order_relaxed) || !cache->count[cls]) return NULL;
+    return cache->items[cls][--cache->count[cls]];
+}
+
+void* cpucache_pop(size_t size) {
+    int cls = class_of(size);
+    if (!enabled || cls < 0) return NULL;
+    void* ptr = pop_any(cls);
+    if (ptr) ((uintptr_t*)ptr)[1] = 0;
+    return ptr;
+}
+
+int cpucache_marked(const void* ptr) {
+    return enabled && ((const uintptr_t*)ptr)[1] == mark_key();
+}
+
+void cpucache_unmark(void* ptr) {
+    if (cpucache_marked(ptr)) ((uintptr_t*)ptr)[1] = 0;
+}
+
+#ifdef CPUCACHE_HAVE_RSEQ
+enum { CACHE_RUNNING = 0, CACHE_STOPPED, CACHE_RETIRED };
+
+// Останавливает кэш процессора и перезапускает начатые на нём последовательности:
+// после этого счётчики и слоты меняет только вызывающий. -1 - кэш трогать нельзя.
+static int stop_cache(long cpu) {
+    _Atomic uint32_t* stopped = (_Atomic uint32_t*)&cpu_caches[cpu].stopped;
+    uint32_t running = CACHE_RUNNING;
+    if (!atomic_compare_exchange_strong(stopped, &running, CACHE_STOPPED)) return -1;
+    if (!fence_ok || syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED_RSEQ, MEMBARRIER_CMD_FLAG_CPU, (int)cpu) != 0) {
+        // Без барьера кэш не трогаем: последовательность на процессоре могла быть в середине
+        atomic_store(stopped, CACHE_RUNNING);
+        return -1;
+    }
+    return 0;
+}
+#endif
+
+void cpucache_drain(void (*release)(void* ptr)) {
+#ifdef CPUCACHE_HAVE_RSEQ
+    // Чужой кэш можно забрать только после перезапуска всех начатых на том процессоре последовательностей
+    if (!cpu_caches || !fence_ok) return;
+    for (long cpu = 0; cpu < cpu_count; cpu++) {
+        CpuCache* cache = &cpu_caches[cpu];
+        if (stop_cache(cpu) != 0) continue;
+        for (int c = 0; c < CPUCACHE_CLASSES; c++) {
+            for (uint32_t i = 0; i < cache->count[c]; i++) release(cache->items[c][i]);
+            cache->count[c] = 0;
+        }
+        atomic_store((_Atomic uint32_t*)&cache->stopped, CACHE_RUNNING);
+    }
+#else
+    (void)release;
+#endif
+}
+
+void cpucache_reset(void) {
+    atomic_fetch_add(&generation, 1);
+#ifdef CPUCACHE_HAVE_RSEQ
+    if (!cpu_caches) return;
+    for (long cpu = 0; cpu < cpu_count; cpu++) {
+        CpuCache* cache = &cpu_caches[cpu];
+        if (stop_cache(cpu) != 0) {
+            // Незавершённая вставка могла бы оставить в кэше блок уже возвращённой области:
+            // процессор больше не кэширует
+            atomic_store((_Atomic uint32_t*)&cache->stopped, CACHE_RETIRED);
+            continue;
+        }
+        for (int c = 0; c < CPUCACHE_CLASSES; c++) cache->count[c] = 0;
+        atomic_store((_Atomic uint32_t*)&cache->stopped, CACHE_RUNNING);
+    }
+#endif
+}
@@ -0,0 +1,41 @@
+#ifndef CPUCACHE_H
+#define CPUCACHE_H
+
+#include <stddef.h>
+
+// Кэши мелких свободных блоков перед общей блокировкой аллокатора. На Linux
+// x86-64 кэш свой у каждого процессора: push/pop выполняются restartable
+// sequence (rseq) - ядро перезапускает последовательность, если поток вытеснен
+// или перенесён на другой процессор, поэтому быстрый путь обходится без
+// атомарных операций и блокировок, а память кэшей не растёт с числом потоков.
+// Без rseq у каждого потока свой кэш; он сливается при завершении потока.
+//
+// Для B-дерева блоки в кэше остаются занятыми, как в кэше free_sized.
+
+#define CPUCACHE_GRANULE 16
+#define CPUCACHE_CLASSES 64      // Классы 16, 32, ..., 1024 байт
+#define CPUCACHE_SLOTS 64        // Предельная глубина класса
+#define CPUCACHE_CLASS_BYTES 4096 // Глубина класса - столько байт, но от 4 до CPUCACHE_SLOTS блоков
+
+enum {
+    CPUCACHE_OFF = 0,
+    CPUCACHE_RSEQ,   // Кэш на процессор
+    CPUCACHE_THREAD  // Кэш на поток
+};
+
+// release_unlocked освобождает блок в обход кэшей, сам беря блокировку (слив при выходе потока)
+int cpucache_enable(int on, void (*release_unlocked)(void* ptr)); // Режим вызывающего потока
+int cpucache_enabled(void);
+
+// Без блокировки аллокатора; size - ёмкость блока, уже кратная CPUCACHE_GRANULE
+int cpucache_push(void* ptr, size_t size); // 0 - класса нет или он заполнен
+void* cpucache_pop(size_t size);
+// Метка блока, лежащего в кэше (или слитого из него и ещё не выданного снова)
+int cpucache_marked(const void* ptr);
+void cpucache_unmark(void* ptr); // Блок снова выдан из дерева
+
+// Под блокировкой аллокатора
+void cpucache_drain(void (*release)(void* ptr)); // Кэши процессоров; кэши потоков - при их выходе
+void cpucache_reset(void);                       // Забыть блоки (области уже возвращены)
+
+#endif
@@ -0,0 +1,252 @@
+#include "guard.h"
+#include "pagemap.h"
+#include <execinfo.h>
+#include <stdatomic.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+enum { SLOT_EMPTY = 0, SLOT_LIVE, SLOT_FREED };
+
+typedef struct {
+    uintptr_t ptr;
+    size_t size;
+    int state;
+    int alloc_tid, free_tid;
+    int alloc_depth, free_depth;
+    void* alloc_stack[GUARD_STACK_DEPTH];
+    void* free_stack[GUARD_STACK_DEPTH];
+} Slot;
+
+// Пул: [guard][slot 0][guard][slot 1]...[slot N-1][guard]
+static char* pool = NULL;
+static size_t pool_size = 0;
+static size_t page = 0;
+static Slot* slots = NULL;
+static unsigned slot_count = 0;
+static unsigned next_fresh = 0;       // Слоты, ещё ни разу не выданные
+static unsigned* quarantine = NULL;   // Очередь освобождённых слотов: выдаётся самый давний
+static unsigned q_head = 0, q_len = 0;
+
+static unsigned rate = 0;
+// Отсчёт выборки свой у каждого потока: шарды проверяют его без блокировки аллокатора
+static __thread long countdown = 0;
+static __thread uint64_t rng_state = 0;
+static struct sigaction prev_segv;
+static Span pool_span;
+static _Atomic int enabled = 0; // Для путей без блокировки аллокатора (шарды)
+
+static uint64_t next_random(void) {
+    if (!rng_state) rng_state = 0x2545F4914F6CDD1DULL ^ (uintptr_t)&rng_state;
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static void reset_countdown(void) {
+    // Равномерно в [1, 2*rate-1]: в среднем каждое rate-е выделение, без периодичности
+    countdown = (long)(next_random() % (2 * (uint64_t)rate - 1)) + 1;
+}
+
+static char* slot_page(unsigned i) {
+    return pool + (2 * (size_t)i + 1) * page;
+}
+
+static int gettid_int(void) {
+    return (int)syscall(SYS_gettid);
+}
+
+static void print_stack(const char* title, int tid, void* const* stack, int depth) {
+    char line[96];
+    int n = snprintf(line, sizeof(line), "  %s by thread %d:\n", title, tid);
+    ssize_t rc = write(STDERR_FILENO, line, (size_t)n);
+    (void)rc;
+    // backtrace_symbols_fd не выделяет память - годится внутри обработчика сигнала
+    backtrace_symbols_fd(stack, depth, STDERR_FILENO);
+}
+
+static void report(const char* kind, uintptr_t addr, const Slot* s) {
+    char line[192];
+    int n = snprintf(line, sizeof(line), "[guard] %s at %p: block %p of %zu bytes\n", kind, (void*)addr,
+                     (void*)s->ptr, s->size);
+    ssize_t rc = write(STDERR_FILENO, line, (size_t)n);
+    (void)rc;
+    print_stack("allocated", s->alloc_tid, s->alloc_stack, s->alloc_depth);
+    if (s->state == SLOT_FREED) print_stack("freed", s->free_tid, s->free_stack, s->free_depth);
+}
+
+// Слот, к которому относится адрес: страница самого слота или соседняя защитная
+static int classify(uintptr_t addr, const char** kind) {
+    size_t pidx = (addr - (uintptr_t)pool) / page;
+    if (pidx % 2 == 1) {
+        unsigned i = (unsigned)(pidx / 2);
+        const Slot* s = &slots[i];
+        if (s->state == SLOT_FREED) *kind = "use-after-free";
+        else if (s->state == SLOT_LIVE && addr < s->ptr) *kind = "buffer underflow";
+        else if (s->state == SLOT_LIVE) *kind = "buffer overflow";
+        else *kind = "access to unused guard slot";
+        return s->state == SLOT_EMPTY ? -1 : (int)i;
+    }
+    // Защитная страница: ближайший к адресу живой или освобождённый блок по обе стороны
+    int left = pidx >= 1 && pidx / 2 >= 1 ? (int)(pidx / 2 - 1) : -1;
+    int right = pidx / 2 < slot_count ? (int)(pidx / 2) : -1;
+    uintptr_t dl = left >= 0 && slots[left].state ? addr - (slots[left].ptr + slots[left].size) : UINTPTR_MAX;
+    uintptr_t dr = right >= 0 && slots[right].state ? slots[right].ptr - addr : UINTPTR_MAX;
+    if (dl == UINTPTR_MAX && dr == UINTPTR_MAX) {
+        *kind = "access to guard page";
+        return -1;
+    }
+    int i = dl <= dr ? left : right;
+    if (slots[i].state == SLOT_FREED) *kind = "use-after-free (out of bounds)";
+    else *kind = i == left ? "buffer overflow" : "buffer underflow";
+    return i;
+}
+
+static void on_segv(int sig, siginfo_t* info, void* uctx) {
+    uintptr_t addr = (uintptr_t)info->si_addr;
+    if (pool && addr >= (uintptr_t)pool && addr < (uintptr_t)pool + pool_size) {
+        const char* kind;
+        int i = classify(addr, &kind);
+        if (i >= 0) {
+            report(kind, addr, &slots[i]);
+        } else {
+            char line[96];
+            int n = snprintf(line, sizeof(line), "[guard] %s at %p\n", kind, (void*)addr);
+            ssize_t rc = write(STDERR_FILENO, line, (size_t)n);
+            (void)rc;
+        }
+        // Повторное обращение после возврата завершит процесс обычным образом (с core dump)
+        signal(SIGSEGV, SIG_DFL);
+        return;
+    }
+    // Чужой SIGSEGV - предыдущему обработчику
+    if (prev_segv.sa_flags & SA_SIGINFO) {
+        prev_segv.sa_sigaction(sig, info, uctx);
+    } else if (prev_segv.sa_handler != SIG_DFL && prev_segv.sa_handler != SIG_IGN) {
+        prev_segv.sa_handler(sig);
+    } else {
+        signal(SIGSEGV, SIG_DFL);
+    }
+}
+
+int guard_enable(unsigned sample_rate, unsigned count) {
+    if (pool) return 0;
+    rate = sample_rate ? sample_rate : GUARD_DEFAULT_RATE;
+    slot_count = count ? count : GUARD_DEFAULT_SLOTS;
+    page = (size_t)sysconf(_SC_PAGESIZE);
+    pool_size = (2 * (size_t)slot_count + 1) * page;
+    size_t meta = slot_count * (sizeof(Slot) + sizeof(unsigned));
+
+    // Метаданные берутся через mmap: обработчик сигнала читает их без блокировок
+    char* mem = mmap(NULL, pool_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    void* meta_mem = mmap(NULL, meta, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED || meta_mem == MAP_FAILED) {
+        perror("[guard] mmap");
+        if (mem != MAP_FAILED) munmap(mem, pool_size);
+        if (meta_mem != MAP_FAILED) munmap(meta_mem, meta);
+        return -1;
+    }
+    slots = meta_mem;
+    quarantine = (unsigned*)(slots + slot_count);
+    rng_state ^= (uint64_t)(uintptr_t)mem;
+    reset_countdown();
+
+    // Первый backtrace подгружает libgcc_s через malloc - не внутри аллокатора
+    void* probe[1];
+    backtrace(probe, 1);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = on_segv;
+    sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGSEGV, &sa, &prev_segv);
+    pool = mem;
+    pool_span = (Span){SPAN_GUARD, (uintptr_t)mem, pool_size, NULL};
+    pagemap_set((uintptr_t)mem, pool_size, &pool_span);
+    atomic_store_explicit(&enabled, 1, memory_order_release);
+    printf("[guard] Sampling 1 in ~%u allocations into %u guarded slots\n", rate, slot_count);
+    return 0;
+}
+
+int guard_enabled(void) {
+    return atomic_load_explicit(&enabled, memory_order_acquire);
+}
+
+int guard_should_sample(size_t size) {
+    if (!pool || size > page) return 0;
+    if (!countdown) reset_countdown(); // Первое выделение потока
+    if (--countdown > 0) return 0;
+    reset_countdown();
+    return 1;
+}
+
+void* guard_alloc(size_t size, uintptr_t* zero_lo, uintptr_t* zero_hi) {
+    unsigned i;
+    if (next_fresh < slot_count) {
+        i = next_fresh++;
+    } else if (q_len) {
+        i = quarantine[q_head];
+        q_head = (q_head + 1) % slot_count;
+        q_len--;
+    } else {
+        return NULL; // Все слоты заняты живыми блоками
+    }
+    char* p = slot_page(i);
+    if (mprotect(p, page, PROT_READ | PROT_WRITE) != 0) return NULL;
+
+    // Случайно прижимаем блок к началу или к концу страницы, чтобы ловить оба направления выхода
+    size_t rounded = size ? (size + 15) & ~(size_t)15 : 16;
+    uintptr_t ptr = (next_random() & 1) ? (uintptr_t)p + page - rounded : (uintptr_t)p;
+    Slot* s = &slots[i];
+    s->ptr = ptr;
+    s->size = size;
+    s->state = SLOT_LIVE;
+    s->alloc_tid = gettid_int();
+    s->alloc_depth = backtrace(s->alloc_stack, GUARD_STACK_DEPTH);
+    s->free_depth = 0;
+    // Страница либо новая, либо сброшена MADV_DONTNEED при освобождении
+    *zero_lo = ptr;
+    *zero_hi = ptr + size;
+    return (void*)ptr;
+}
+
+int guard_owns(const void* ptr) {
+    return pool && (uintptr_t)ptr >= (uintptr_t)pool && (uintptr_t)ptr < (uintptr_t)pool + pool_size;
+}
+
+static Slot* slot_of(const void* ptr) {
+    size_t pidx = ((uintptr_t)ptr - (uintptr_t)pool) / page;
+    return pidx % 2 == 1 ? &slots[pidx / 2] : NULL;
+}
+
+void guard_free(void* ptr) {
+    Slot* s = slot_of(ptr);
+    if (!s || s->state == SLOT_EMPTY || s->ptr != (uintptr_t)ptr) {
+        const char* kind = "invalid free";
+        if (s && s->state != SLOT_EMPTY) report(kind, (uintptr_t)ptr, s);
+        else fprintf(stderr, "[guard] %s of %p\n", kind, ptr);
+        return;
+    }
+    if (s->state == SLOT_FREED) {
+        report("double free", (uintptr_t)ptr, s);
+        return;
+    }
+    s->state = SLOT_FREED;
+    s->free_tid = gettid_int();
+    s->free_depth = backtrace(s->free_stack, GUARD_STACK_DEPTH);
+    char* p = slot_page((unsigned)(s - slots));
+    madvise(p, page, MADV_DONTNEED);
+    mprotect(p, page, PROT_NONE);
+    quarantine[(q_head + q_len) % slot_count] = (unsigned)(s - slots);
+    q_len++;
+}
+
+size_t guard_usable_size(const void* ptr) {
+    Slot* s = slot_of(ptr);
+    return s && s->state == SLOT_LIVE ? s->size : 0;
+}
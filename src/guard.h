@@ -0,0 +1,26 @@
+#ifndef GUARD_H
+#define GUARD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Выборочная проверка ошибок памяти (по образцу GWP-ASan). Редкие выделения
+// размещаются на отдельной странице пула, окружённой страницами PROT_NONE;
+// после free страница снова закрывается и какое-то время не выдаётся.
+// Выход за границу или обращение после free дают SIGSEGV в пуле, и обработчик
+// печатает стеки выделения и освобождения блока.
+
+#define GUARD_DEFAULT_RATE 1000 // В среднем одно выделение из стольких
+#define GUARD_DEFAULT_SLOTS 64
+#define GUARD_STACK_DEPTH 16
+
+// Вызывающий держит блокировку аллокатора
+int guard_enable(unsigned sample_rate, unsigned slots);
+int guard_enabled(void);                    // Можно без блокировки: шарды берут её, только когда выборка сработала
+int guard_should_sample(size_t size);       // Дешёвая проверка на горячем пути, без блокировки (отсчёт на поток)
+void* guard_alloc(size_t size, uintptr_t* zero_lo, uintptr_t* zero_hi);
+int guard_owns(const void* ptr);
+void guard_free(void* ptr);
+size_t guard_usable_size(const void* ptr);
+
+#endif
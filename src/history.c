@@ -0,0 +1,377 @@
+#include "history.h"
+#include "b_tree.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+    BTreeEvent ev;
+    unsigned long long time_ms;
+} HistoryEvent;
+
+typedef struct {
+    unsigned long seq; // Состояние после seq событий
+    HistoryBlock* blocks;
+    size_t count;
+    int ready;         // 0 - слепок ещё собирает фоновый поток
+} Checkpoint;
+
+typedef struct {
+    HistoryBlock* data;
+    size_t count;
+    size_t cap;
+} BlockVec;
+
+static pthread_mutex_t history_lock = PTHREAD_MUTEX_INITIALIZER;
+static int enabled = 0;
+static HistoryEvent* events = NULL; // Событие N хранится в events[(N-1) % HISTORY_EVENTS]
+static unsigned long last_seq = 0;
+static Checkpoint checkpoints[HISTORY_CHECKPOINTS]; // Кольцо, от старых к новым
+static int cp_head = 0;
+static int cp_count = 0;
+static struct timespec start_time;
+
+// Фоновый поток собирает слепки из предыдущего состояния и событий, чтобы
+// обработчик события под блокировкой аллокатора не обходил дерево
+static pthread_t builder_thread;
+static pthread_cond_t builder_cond = PTHREAD_COND_INITIALIZER;
+static int builder_running = 0;
+
+static unsigned long long now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)(now.tv_sec - start_time.tv_sec) * 1000ULL +
+           (unsigned long long)((now.tv_nsec - start_time.tv_nsec) / 1000000L);
+}
+
+static int vec_reserve(BlockVec* v, size_t need) {
+    if (need <= v->cap) return 0;
+    size_t cap = v->cap ? v->cap * 2 : 256;
+    while (cap < need) cap *= 2;
+    HistoryBlock* data = realloc(v->data, cap * sizeof(HistoryBlock));
+    if (!data) return -1;
+    v->data = data;
+    v->cap = cap;
+    return 0;
+}
+
+static void snapshot_cb(void* block, size_t size, int is_free, void* ctx) {
+    BlockVec* v = ctx;
+    if (vec_reserve(v, v->count + 1) != 0) return;
+    v->data[v->count].addr = (uintptr_t)block;
+    v->data[v->count].size = size;
+    v->data[v->count].is_free = is_free;
+    v->count++;
+}
+
+static Checkpoint* checkpoint_at(int i) {
+    return &checkpoints[(cp_head + i) % HISTORY_CHECKPOINTS];
+}
+
+static void drop_oldest_checkpoint(void) {
+    free(checkpoint_at(0)->blocks);
+    checkpoint_at(0)->blocks = NULL;
+    cp_head = (cp_head + 1) % HISTORY_CHECKPOINTS;
+    cp_count--;
+}
+
+static void apply_event(BlockVec* v, const BTreeEvent* ev);
+
+static void push_checkpoint(HistoryBlock* blocks, size_t count, int ready) {
+    if (cp_count == HISTORY_CHECKPOINTS) drop_oldest_checkpoint();
+    Checkpoint* cp = checkpoint_at(cp_count);
+    cp->seq = last_seq;
+    cp->blocks = blocks;
+    cp->count = count;
+    cp->ready = ready;
+    cp_count++;
+}
+
+// Полный обход дерева - только при включении записи, не из обработчика события
+static void take_checkpoint(void) {
+    BlockVec v = {0};
+    btree_walk(snapshot_cb, &v);
+    push_checkpoint(v.data, v.count, 1);
+}
+
+// Собирает слепок c из предыдущего готового и событий между ними
+static void build_checkpoint(int c) {
+    Checkpoint* base = checkpoint_at(c - 1);
+    Checkpoint* cp = checkpoint_at(c);
+    BlockVec v = {0};
+    if (vec_reserve(&v, base->count + 1) != 0) return;
+    memcpy(v.data, base->blocks, base->count * sizeof(HistoryBlock));
+    v.count = base->count;
+    for (unsigned long s = base->seq + 1; s <= cp->seq; s++) {
+        apply_event(&v, &events[(s - 1) % HISTORY_EVENTS].ev);
+    }
+    cp->blocks = v.data;
+    cp->count = v.count;
+    cp->ready = 1;
+}
+
+static void on_event(const BTreeEvent* ev, void* ctx) {
+    (void)ctx;
+    pthread_mutex_lock(&history_lock);
+    if (enabled) {
+        // Запись вытеснит первое событие после самого старого слепка - он больше не нужен,
+        // но следующий должен быть готов. Собирать его здесь приходится, только если
+        // фоновый поток отстал на всё кольцо.
+        while (cp_count > 1 && last_seq + 1 - checkpoint_at(0)->seq > HISTORY_EVENTS) {
+            if (!checkpoint_at(1)->ready) build_checkpoint(1);
+            drop_oldest_checkpoint();
+        }
+        HistoryEvent* rec = &events[last_seq % HISTORY_EVENTS];
+        rec->ev = *ev;
+        rec->time_ms = now_ms();
+        last_seq++;
+        if (ev->type == BTREE_EV_CLEAR) {
+            push_checkpoint(NULL, 0, 1);
+        } else if (last_seq % HISTORY_CHECKPOINT_INTERVAL == 0) {
+            push_checkpoint(NULL, 0, 0);
+            pthread_cond_signal(&builder_cond);
+        }
+    }
+    pthread_mutex_unlock(&history_lock);
+}
+
+// Первый несобранный слепок после seq или -1
+static int next_pending(unsigned long seq) {
+    for (int c = 1; c < cp_count; c++) {
+        if (!checkpoint_at(c)->ready && checkpoint_at(c)->seq > seq) return c;
+    }
+    return -1;
+}
+
+// Поток ведёт собственную копию состояния и догоняет журнал порциями: под
+// блокировкой копируются только события, применяются они уже без неё
+static void* builder_main(void* arg) {
+    (void)arg;
+    BlockVec state = {0};
+    unsigned long state_seq = 0;
+    int synced = 0;
+    BTreeEvent* chunk = malloc(HISTORY_CHECKPOINT_INTERVAL * sizeof(BTreeEvent));
+    if (!chunk) return NULL;
+
+    pthread_mutex_lock(&history_lock);
+    while (builder_running) {
+        int c = next_pending(synced ? state_seq : 0);
+        if (c < 0) {
+            pthread_cond_wait(&builder_cond, &history_lock);
+            continue;
+        }
+        unsigned long target = checkpoint_at(c)->seq;
+
+        // Нужные события вытеснены или копии ещё нет: начинаем с последнего готового слепка
+        if (!synced || state_seq < checkpoint_at(0)->seq) {
+            int base = c - 1;
+            while (!checkpoint_at(base)->ready) base--;
+            Checkpoint* cp = checkpoint_at(base);
+            if (vec_reserve(&state, cp->count + 1) != 0) break;
+            memcpy(state.data, cp->blocks, cp->count * sizeof(HistoryBlock));
+            state.count = cp->count;
+            state_seq = cp->seq;
+            synced = 1;
+        }
+
+        unsigned long n = target - state_seq;
+        if (n > HISTORY_CHECKPOINT_INTERVAL) n = HISTORY_CHECKPOINT_INTERVAL;
+        for (unsigned long i = 0; i < n; i++) {
+            chunk[i] = events[(state_seq + i) % HISTORY_EVENTS].ev;
+        }
+        pthread_mutex_unlock(&history_lock);
+
+        for (unsigned long i = 0; i < n; i++) apply_event(&state, &chunk[i]);
+        HistoryBlock* copy = NULL;
+        if (state_seq + n == target && state.count > 0) {
+            copy = malloc(state.count * sizeof(HistoryBlock));
+            if (copy) memcpy(copy, state.data, state.count * sizeof(HistoryBlock));
+        }
+
+        pthread_mutex_lock(&history_lock);
+        state_seq += n;
+        if (state_seq != target) continue;
+        if (state.count > 0 && !copy) {
+            synced = 0;
+            continue;
+        }
+        // Слепок могли вытеснить или собрать в обработчике события, пока шла сборка
+        int installed = 0;
+        for (int i = 0; i < cp_count; i++) {
+            Checkpoint* cp = checkpoint_at(i);
+            if (cp->seq == target && !cp->ready) {
+                cp->blocks = copy;
+                cp->count = state.count;
+                cp->ready = 1;
+                installed = 1;
+                break;
+            }
+        }
+        if (!installed) free(copy);
+    }
+    pthread_mutex_unlock(&history_lock);
+    free(chunk);
+    free(state.data);
+    return NULL;
+}
+
+void history_enable(void) {
+    pthread_mutex_lock(&history_lock);
+    if (enabled) {
+        pthread_mutex_unlock(&history_lock);
+        return;
+    }
+    events = calloc(HISTORY_EVENTS, sizeof(HistoryEvent));
+    if (!events) {
+        pthread_mutex_unlock(&history_lock);
+        printf("[history] Failed to allocate event buffer\n");
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    last_seq = 0;
+    cp_head = 0;
+    cp_count = 0;
+    take_checkpoint();
+    enabled = 1;
+    builder_running = 1;
+    if (pthread_create(&builder_thread, NULL, builder_main, NULL) != 0) {
+        // Без фонового потока слепки соберёт обработчик события при вытеснении
+        builder_running = 0;
+        printf("[history] Failed to start checkpoint thread\n");
+    }
+    pthread_mutex_unlock(&history_lock);
+    btree_add_listener(on_event, NULL);
+    printf("[history] Recording enabled\n");
+}
+
+void history_disable(void) {
+    btree_remove_listener(on_event, NULL);
+    pthread_mutex_lock(&history_lock);
+    int was_running = builder_running;
+    builder_running = 0;
+    pthread_cond_signal(&builder_cond);
+    pthread_mutex_unlock(&history_lock);
+    if (was_running) pthread_join(builder_thread, NULL);
+
+    pthread_mutex_lock(&history_lock);
+    if (enabled) {
+        while (cp_count > 0) drop_oldest_checkpoint();
+        free(events);
+        events = NULL;
+        enabled = 0;
+    }
+    pthread_mutex_unlock(&history_lock);
+}
+
+int history_enabled(void) {
+    return enabled;
+}
+
+unsigned long history_first_seq(void) {
+    pthread_mutex_lock(&history_lock);
+    unsigned long seq = cp_count ? checkpoint_at(0)->seq : 0;
+    pthread_mutex_unlock(&history_lock);
+    return seq;
+}
+
+unsigned long history_last_seq(void) {
+    pthread_mutex_lock(&history_lock);
+    unsigned long seq = last_seq;
+    pthread_mutex_unlock(&history_lock);
+    return seq;
+}
+
+unsigned long long history_time_ms(unsigned long seq) {
+    unsigned long long t = 0;
+    pthread_mutex_lock(&history_lock);
+    if (enabled && seq > 0 && seq <= last_seq && last_seq - seq < HISTORY_EVENTS) {
+        t = events[(seq - 1) % HISTORY_EVENTS].time_ms;
+    }
+    pthread_mutex_unlock(&history_lock);
+    return t;
+}
+
+// Бинарный поиск: индекс блока addr или позиция для вставки
+static size_t lower_bound(const BlockVec* v, uintptr_t addr) {
+    size_t lo = 0, hi = v->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (v->data[mid].addr < addr) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static void apply_event(BlockVec* v, const BTreeEvent* ev) {
+    uintptr_t addr = (uintptr_t)ev->block;
+    size_t i = lower_bound(v, addr);
+    int found = i < v->count && v->data[i].addr == addr;
+
+    switch (ev->type) {
+        case BTREE_EV_INSERT:
+            if (found || vec_reserve(v, v->count + 1) != 0) return;
+            memmove(&v->data[i + 1], &v->data[i], (v->count - i) * sizeof(HistoryBlock));
+            v->data[i].addr = addr;
+            v->data[i].size = ev->size;
+            v->data[i].is_free = ev->is_free;
+            v->count++;
+            break;
+        case BTREE_EV_REMOVE:
+            if (!found) return;
+            memmove(&v->data[i], &v->data[i + 1], (v->count - i - 1) * sizeof(HistoryBlock));
+            v->count--;
+            break;
+        case BTREE_EV_REUSE:
+            if (found) v->data[i].is_free = 0;
+            break;
+        case BTREE_EV_RELEASE:
+            if (found) v->data[i].is_free = 1;
+            break;
+        case BTREE_EV_RESIZE:
+            if (found) v->data[i].size = ev->size;
+            break;
+        case BTREE_EV_CLEAR:
+            v->count = 0;
+            break;
+    }
+}
+
+int history_state_at(unsigned long seq, HistoryBlock** blocks, size_t* count) {
+    pthread_mutex_lock(&history_lock);
+    if (!enabled || cp_count == 0 || seq < checkpoint_at(0)->seq || seq > last_seq) {
+        pthread_mutex_unlock(&history_lock);
+        return -1;
+    }
+
+    // Ближайший готовый слепок не позже seq; самый старый готов всегда
+    int c = cp_count - 1;
+    while (c > 0 && (checkpoint_at(c)->seq > seq || !checkpoint_at(c)->ready)) c--;
+    Checkpoint* cp = checkpoint_at(c);
+    if (!cp->ready) {
+        pthread_mutex_unlock(&history_lock);
+        return -1;
+    }
+
+    BlockVec v = {0};
+    if (vec_reserve(&v, cp->count + 1) != 0) {
+        pthread_mutex_unlock(&history_lock);
+        return -1;
+    }
+    memcpy(v.data, cp->blocks, cp->count * sizeof(HistoryBlock));
+    v.count = cp->count;
+
+    for (unsigned long s = cp->seq + 1; s <= seq; s++) {
+        apply_event(&v, &events[(s - 1) % HISTORY_EVENTS].ev);
+    }
+    pthread_mutex_unlock(&history_lock);
+
+    *blocks = v.data;
+    *count = v.count;
+    return 0;
+}
+
+void history_free_state(HistoryBlock* blocks) {
+    free(blocks);
+}
@@ -0,0 +1,37 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Журнал событий B-дерева для перемотки состояния аллокатора назад и вперёд.
+// События хранятся в кольцевом буфере, каждые HISTORY_CHECKPOINT_INTERVAL
+// событий появляется полный слепок блоков. Слепок собирает фоновый поток из
+// предыдущего слепка и журнала, дерево обходится только при включении записи.
+// Состояние на любой момент восстанавливается от ближайшего готового слепка.
+
+#define HISTORY_EVENTS (1 << 16)            // Ёмкость кольцевого буфера событий
+#define HISTORY_CHECKPOINT_INTERVAL 4096    // Событий между слепками
+#define HISTORY_CHECKPOINTS (HISTORY_EVENTS / HISTORY_CHECKPOINT_INTERVAL + 2)
+
+typedef struct {
+    uintptr_t addr;
+    size_t size;
+    int is_free;
+} HistoryBlock;
+
+void history_enable(void);
+void history_disable(void);
+int history_enabled(void);
+
+// Диапазон номеров состояний, которые можно восстановить (состояние N - после N-го события)
+unsigned long history_first_seq(void);
+unsigned long history_last_seq(void);
+unsigned long long history_time_ms(unsigned long seq); // Время события относительно начала записи
+
+// Восстанавливает отсортированный по адресу список блоков на момент seq.
+// Возвращает 0 при успехе; массив освобождается через history_free_state.
+int history_state_at(unsigned long seq, HistoryBlock** blocks, size_t* count);
+void history_free_state(HistoryBlock* blocks);
+
+#endif
@@ -0,0 +1,244 @@
+#include "latency.h"
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define LAT_USE_TSC 1
+#endif
+
+typedef struct LatThread {
+    struct LatThread* next;
+    _Atomic int in_use; // 0 - поток завершился, запись заберёт следующий новый поток
+    _Atomic uint64_t counts[LAT_OPS][LAT_BUCKETS];
+    _Atomic uint64_t max[LAT_OPS];
+    _Atomic uint64_t sum[LAT_OPS];
+} LatThread;
+
+int latency_on = 0;
+
+// Записи потоков только добавляются в голову и никогда не освобождаются:
+// обход безопасен из любого потока и из обработчика сигнала. Запись завершившегося
+// потока (деструктор ключа) переходит к новому потоку вместе с накопленными счётчиками,
+// поэтому записей не больше, чем потоков, живших одновременно.
+static _Atomic(LatThread*) threads = NULL;
+static __thread LatThread* self = NULL;
+static pthread_key_t exit_key;
+static pthread_once_t exit_once = PTHREAD_ONCE_INIT;
+static double ns_per_tick = 1.0;
+
+static const char* op_names[LAT_OPS] = {
+    "malloc", "free", "realloc", "calloc", "btree_find_best_fit", "btree_insert", "btree_remove", "btree_mark_free"
+};
+
+static void thread_exit(void* arg) {
+    atomic_store_explicit(&((LatThread*)arg)->in_use, 0, memory_order_release);
+}
+
+static void create_exit_key(void) {
+    pthread_key_create(&exit_key, thread_exit);
+}
+
+static uint64_t monotonic_raw_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+uint64_t latency_ticks(void) {
+#ifdef LAT_USE_TSC
+    return __rdtsc();
+#else
+    return monotonic_raw_ns();
+#endif
+}
+
+static void calibrate(void) {
+#ifdef LAT_USE_TSC
+    struct timespec pause = {0, 10 * 1000000L};
+    uint64_t ns0 = monotonic_raw_ns();
+    uint64_t t0 = __rdtsc();
+    nanosleep(&pause, NULL);
+    uint64_t ns1 = monotonic_raw_ns();
+    uint64_t t1 = __rdtsc();
+    if (t1 > t0) ns_per_tick = (double)(ns1 - ns0) / (double)(t1 - t0);
+#endif
+}
+
+static int bucket_of(uint64_t v) {
+    if (v < LAT_LINEAR) return (int)v;
+    int e = 63 - __builtin_clzll(v);
+    int sub = (int)((v >> (e - LAT_SUB_BITS)) & ((1 << LAT_SUB_BITS) - 1));
+    return LAT_LINEAR + (e - 4) * (1 << LAT_SUB_BITS) + sub;
+}
+
+// Верхняя граница корзины (не включительно) в тиках
+static uint64_t bucket_upper(int b) {
+    if (b < LAT_LINEAR) return (uint64_t)b + 1;
+    int e = (b - LAT_LINEAR) / (1 << LAT_SUB_BITS) + 4;
+    uint64_t sub = (uint64_t)((b - LAT_LINEAR) % (1 << LAT_SUB_BITS));
+    uint64_t step = 1ULL << (e - LAT_SUB_BITS);
+    return ((1ULL << LAT_SUB_BITS) + sub) * step + step;
+}
+
+static LatThread* register_thread(void) {
+    pthread_once(&exit_once, create_exit_key);
+    LatThread* t;
+    for (t = atomic_load_explicit(&threads, memory_order_acquire); t; t = t->next) {
+        int idle = 0;
+        if (atomic_compare_exchange_strong_explicit(&t->in_use, &idle, 1, memory_order_acquire, memory_order_relaxed)) break;
+    }
+    if (!t) {
+        // mmap, а не malloc: запись может понадобиться внутри самого malloc
+        t = mmap(NULL, sizeof(LatThread), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (t == MAP_FAILED) return NULL;
+        t->in_use = 1;
+        LatThread* head = atomic_load_explicit(&threads, memory_order_relaxed);
+        do {
+            t->next = head;
+        } while (!atomic_compare_exchange_weak_explicit(&threads, &head, t, memory_order_release, memory_order_relaxed));
+    }
+    pthread_setspecific(exit_key, t);
+    self = t;
+    return t;
+}
+
+void latency_record(int op, uint64_t start) {
+    uint64_t d = latency_ticks() - start;
+    LatThread* t = self ? self : register_thread();
+    if (!t) return;
+    // Пишет только поток-владелец, поэтому load+store вместо атомарного RMW
+    _Atomic uint64_t* c = &t->counts[op][bucket_of(d)];
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_store_explicit(&t->sum[op], atomic_load_explicit(&t->sum[op], memory_order_relaxed) + d,
+                          memory_order_relaxed);
+    if (d > atomic_load_explicit(&t->max[op], memory_order_relaxed)) {
+        atomic_store_explicit(&t->max[op], d, memory_order_relaxed);
+    }
+}
+
+void latency_enable(int on) {
+    if (on && !latency_on) calibrate();
+    latency_on = on;
+}
+
+void latency_reset(void) {
+    for (LatThread* t = atomic_load_explicit(&threads, memory_order_acquire); t; t = t->next) {
+        for (int op = 0; op < LAT_OPS; op++) {
+            for (int b = 0; b < LAT_BUCKETS; b++) atomic_store_explicit(&t->counts[op][b], 0, memory_order_relaxed);
+            atomic_store_explicit(&t->max[op], 0, memory_order_relaxed);
+            atomic_store_explicit(&t->sum[op], 0, memory_order_relaxed);
+        }
+    }
+}
+
+// Форматирование без stdio: printf не безопасен в обработчике сигнала
+typedef struct {
+    char buf[512];
+    size_t len;
+} Line;
+
+static void put_str(Line* l, const char* s) {
+    while (*s && l->len < sizeof(l->buf) - 1) l->buf[l->len++] = *s++;
+}
+
+static void put_u64(Line* l, uint64_t v, int width) {
+    char tmp[24];
+    int n = 0;
+    do {
+        tmp[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    for (int i = n; i < width; i++) put_str(l, " ");
+    while (n && l->len < sizeof(l->buf) - 1) l->buf[l->len++] = tmp[--n];
+}
+
+static void flush_line(Line* l, int fd) {
+    l->buf[l->len++] = '\n';
+    ssize_t rc = write(fd, l->buf, l->len);
+    (void)rc;
+    l->len = 0;
+}
+
+static uint64_t to_ns(uint64_t ticks) {
+    return (uint64_t)((double)ticks * ns_per_tick + 0.5);
+}
+
+void latency_dump(int fd) {
+    static const int pct_milli[] = {500, 900, 990, 999};
+    static const char* pct_names[] = {"p50", "p90", "p99", "p99.9"};
+    uint64_t merged[LAT_BUCKETS];
+    Line l = {{0}, 0};
+
+    put_str(&l, latency_on ? "[latency] per-operation histograms, ns (upper bucket bound)"
+                           : "[latency] disabled (TREEALOC_LATENCY=1 or treealoc_latency_enable)");
+    flush_line(&l, fd);
+    for (int op = 0; op < LAT_OPS; op++) {
+        uint64_t count = 0, sum = 0, max = 0;
+        memset(merged, 0, sizeof(merged));
+        for (LatThread* t = atomic_load_explicit(&threads, memory_order_acquire); t; t = t->next) {
+            for (int b = 0; b < LAT_BUCKETS; b++) {
+                uint64_t c = atomic_load_explicit(&t->counts[op][b], memory_order_relaxed);
+                merged[b] += c;
+                count += c;
+            }
+            sum += atomic_load_explicit(&t->sum[op], memory_order_relaxed);
+            uint64_t m = atomic_load_explicit(&t->max[op], memory_order_relaxed);
+            if (m > max) max = m;
+        }
+        if (!count) continue;
+
+        put_str(&l, "  ");
+        put_str(&l, op_names[op]);
+        put_str(&l, ": count ");
+        put_u64(&l, count, 0);
+        put_str(&l, " mean ");
+        put_u64(&l, to_ns(sum / count), 0);
+        for (int p = 0; p < 4; p++) {
+            // Ранг с округлением вверх: p99 из 100 значений - это 99-е
+            uint64_t rank = (count * (uint64_t)pct_milli[p] + 999) / 1000;
+            uint64_t seen = 0;
+            int b = 0;
+            for (; b < LAT_BUCKETS - 1; b++) {
+                seen += merged[b];
+                if (seen >= rank) break;
+            }
+            put_str(&l, " ");
+            put_str(&l, pct_names[p]);
+            put_str(&l, " ");
+            put_u64(&l, to_ns(bucket_upper(b)), 0);
+        }
+        put_str(&l, " max ");
+        put_u64(&l, to_ns(max), 0);
+        flush_line(&l, fd);
+
+        for (int b = 0; b < LAT_BUCKETS; b++) {
+            if (!merged[b]) continue;
+            put_str(&l, "    < ");
+            put_u64(&l, to_ns(bucket_upper(b)), 10);
+            put_str(&l, " ns ");
+            put_u64(&l, merged[b], 10);
+            flush_line(&l, fd);
+        }
+    }
+}
+
+static void on_sigusr2(int sig) {
+    (void)sig;
+    latency_dump(STDERR_FILENO);
+}
+
+void latency_install_signal(void) {
+    struct sigaction old;
+    if (sigaction(SIGUSR2, NULL, &old) != 0 || old.sa_handler != SIG_DFL) return;
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_sigusr2;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR2, &sa, NULL);
+}
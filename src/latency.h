@@ -0,0 +1,48 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+
+// Гистограммы задержек операций аллокатора. Каждый поток пишет в свои
+// счётчики без блокировок; при выводе потоки сливаются. Время - rdtsc на x86-64
+// (тики переводятся в нс по калибровке), иначе CLOCK_MONOTONIC_RAW.
+//
+// Корзины лог-линейные: значения до 16 точно, дальше 8 корзин на каждую
+// степень двойки, т.е. относительная погрешность не больше 12.5%.
+
+enum {
+    LAT_MALLOC = 0,
+    LAT_FREE,
+    LAT_REALLOC,
+    LAT_CALLOC,
+    LAT_BEST_FIT,     // btree_find_best_fit
+    LAT_INSERT,       // btree_insert
+    LAT_REMOVE,       // btree_remove
+    LAT_MARK_FREE,    // btree_mark_free - обычный путь free
+    LAT_OPS
+};
+
+#define LAT_SUB_BITS 3
+#define LAT_LINEAR 16
+#define LAT_BUCKETS (LAT_LINEAR + (64 - 4) * (1 << LAT_SUB_BITS))
+
+extern int latency_on;
+
+uint64_t latency_ticks(void);
+void latency_record(int op, uint64_t start);
+
+// 0, если замер выключен: тогда latency_stop ничего не делает
+static inline uint64_t latency_start(void) {
+    return latency_on ? latency_ticks() : 0;
+}
+
+static inline void latency_stop(int op, uint64_t start) {
+    if (start) latency_record(op, start);
+}
+
+void latency_enable(int on);
+void latency_reset(void);
+void latency_dump(int fd);              // Только write(2): можно вызывать из обработчика сигнала
+void latency_install_signal(void);      // SIGUSR2 -> latency_dump(2), если сигнал не занят приложением
+
+#endif
@@ -0,0 +1,69 @@
+#include "nodepool.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+
+typedef struct NodeRun {
+    struct NodeRun* next;
+} NodeRun;
+
+// Узлы деревьев шардов создаются параллельно, поэтому у пула своя блокировка
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static NodeRun* runs = NULL;
+static char* bump = NULL;
+static char* bump_end = NULL;
+static void* free_nodes = NULL; // Ссылка на следующий свободный узел хранится в самом узле
+static _Atomic size_t live = 0; // Читается без блокировки для решения о перестановке
+
+BNode* nodepool_alloc(void) {
+    pthread_mutex_lock(&pool_lock);
+    void* node = free_nodes;
+    if (node) {
+        free_nodes = *(void**)node;
+    } else {
+        if (bump == bump_end) {
+            NodeRun* run = mmap(NULL, NODEPOOL_RUN_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (run == MAP_FAILED) {
+                pthread_mutex_unlock(&pool_lock);
+                printf("[nodepool] mmap of node run failed\n");
+                return NULL;
+            }
+            run->next = runs;
+            runs = run;
+            bump = (char*)run + NODEPOOL_STRIDE; // Первый слот занят заголовком
+            bump_end = (char*)run + NODEPOOL_RUN_BYTES / NODEPOOL_STRIDE * NODEPOOL_STRIDE;
+        }
+        node = bump;
+        bump += NODEPOOL_STRIDE;
+    }
+    atomic_fetch_add_explicit(&live, 1, memory_order_relaxed);
+    pthread_mutex_unlock(&pool_lock);
+    return node;
+}
+
+void nodepool_free(BNode* node) {
+    if (!node) return;
+    pthread_mutex_lock(&pool_lock);
+    *(void**)node = free_nodes;
+    free_nodes = node;
+    atomic_fetch_sub_explicit(&live, 1, memory_order_relaxed);
+    pthread_mutex_unlock(&pool_lock);
+}
+
+void nodepool_release(void) {
+    pthread_mutex_lock(&pool_lock);
+    if (live == 0) {
+        while (runs) {
+            NodeRun* next = runs->next;
+            munmap(runs, NODEPOOL_RUN_BYTES);
+            runs = next;
+        }
+        bump = bump_end = NULL;
+        free_nodes = NULL;
+    } else {
+        printf("[nodepool] %zu nodes still in use, runs kept\n", (size_t)live);
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
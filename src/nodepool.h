@@ -0,0 +1,19 @@
+#ifndef NODEPOOL_H
+#define NODEPOOL_H
+
+#include "b_tree.h"
+#include <stddef.h>
+
+// Пул узлов B-дерева. Узлы нарезаются из отображений по 64 КБ с шагом, кратным
+// строке кэша: узел не делит строку с чужими данными, а узлы одного дерева лежат
+// плотно, что и нужно для раскладки в порядке обхода (btree_relayout).
+// Память возвращается ядру, только когда все узлы освобождены (nodepool_release).
+
+#define NODEPOOL_RUN_BYTES (64 * 1024)
+#define NODEPOOL_STRIDE ((sizeof(BNode) + BTREE_LINE - 1) & ~(size_t)(BTREE_LINE - 1))
+
+BNode* nodepool_alloc(void);
+void nodepool_free(BNode* node);
+void nodepool_release(void); // При пустых деревьях (treealoc_cleanup)
+
+#endif
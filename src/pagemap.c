@@ -0,0 +1,80 @@
+#include "pagemap.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <sys/mman.h>
+
+#define LEVEL_SIZE (1u << PAGEMAP_LEVEL_BITS)
+#define LEVEL_MASK (LEVEL_SIZE - 1)
+
+// Писатели держат разные блокировки (region_lock, блокировка аллокатора), а поиск идёт
+// без блокировок: узлы ставятся через CAS, ссылки публикуются с release и читаются с acquire
+typedef struct Leaf {
+    Span* _Atomic spans[LEVEL_SIZE];
+} Leaf;
+
+typedef struct {
+    struct Leaf* _Atomic leaves[LEVEL_SIZE];
+} Mid;
+
+static Mid* _Atomic top[LEVEL_SIZE];
+
+// Узлы по 32 КБ берутся у ядра напрямую: они уже обнулены и не зависят от malloc
+static void* map_node(size_t size) {
+    void* node = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (node == MAP_FAILED) {
+        perror("[pagemap] mmap");
+        return NULL;
+    }
+    return node;
+}
+
+// Узел по ссылке *ref; при create недостающий узел создаётся, и проигравший гонку отдаёт свою копию
+static void* child(void* _Atomic* ref, size_t size, int create) {
+    void* node = atomic_load_explicit(ref, memory_order_acquire);
+    if (node || !create) return node;
+    void* fresh = map_node(size);
+    if (!fresh) return NULL;
+    if (atomic_compare_exchange_strong_explicit(ref, &node, fresh, memory_order_acq_rel, memory_order_acquire)) {
+        return fresh;
+    }
+    munmap(fresh, size);
+    return node;
+}
+
+static Span* _Atomic* slot_for(uintptr_t page, int create) {
+    unsigned i1 = (unsigned)(page >> (2 * PAGEMAP_LEVEL_BITS)) & LEVEL_MASK;
+    unsigned i2 = (unsigned)(page >> PAGEMAP_LEVEL_BITS) & LEVEL_MASK;
+    unsigned i3 = (unsigned)page & LEVEL_MASK;
+    Mid* mid = child((void* _Atomic*)&top[i1], sizeof(Mid), create);
+    if (!mid) return NULL;
+    Leaf* leaf = child((void* _Atomic*)&mid->leaves[i2], sizeof(Leaf), create);
+    return leaf ? &leaf->spans[i3] : NULL;
+}
+
+int pagemap_set(uintptr_t base, size_t size, Span* span) {
+    uintptr_t first = base >> PAGEMAP_SHIFT;
+    uintptr_t last = (base + size - 1) >> PAGEMAP_SHIFT;
+    if ((base + size - 1) >> PAGEMAP_ADDR_BITS) return -1;
+    for (uintptr_t page = first; page <= last; page++) {
+        Span* _Atomic* slot = slot_for(page, 1);
+        if (!slot) return -1;
+        atomic_store_explicit(slot, span, memory_order_release);
+    }
+    return 0;
+}
+
+void pagemap_clear(uintptr_t base, size_t size) {
+    uintptr_t first = base >> PAGEMAP_SHIFT;
+    uintptr_t last = (base + size - 1) >> PAGEMAP_SHIFT;
+    for (uintptr_t page = first; page <= last; page++) {
+        Span* _Atomic* slot = slot_for(page, 0);
+        if (slot) atomic_store_explicit(slot, NULL, memory_order_release);
+    }
+}
+
+Span* pagemap_lookup(const void* ptr) {
+    uintptr_t addr = (uintptr_t)ptr;
+    if (addr >> PAGEMAP_ADDR_BITS) return NULL;
+    Span* _Atomic* slot = slot_for(addr >> PAGEMAP_SHIFT, 0);
+    return slot ? atomic_load_explicit(slot, memory_order_acquire) : NULL;
+}
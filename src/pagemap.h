@@ -0,0 +1,37 @@
+#ifndef PAGEMAP_H
+#define PAGEMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Радикс-дерево "номер страницы -> владеющий участок" (как pagemap в tcmalloc).
+// Три уровня по 12 бит над 4-КБ страницами покрывают 48-битное адресное
+// пространство; промежуточные узлы создаются при первой записи и не удаляются.
+// Поиск владельца указателя - три обращения к памяти, без спуска по B-дереву.
+
+#define PAGEMAP_SHIFT 12
+#define PAGEMAP_LEVEL_BITS 12
+#define PAGEMAP_ADDR_BITS (PAGEMAP_SHIFT + 3 * PAGEMAP_LEVEL_BITS)
+
+enum {
+    SPAN_REGION = 1, // Область из region.c
+    SPAN_PHEAP,      // Персистентная куча
+    SPAN_GUARD,      // Пул защитных страниц
+    SPAN_TLSF,       // Пул движка TLSF
+    SPAN_BUDDY       // Пул системы близнецов
+};
+
+typedef struct {
+    int kind;
+    uintptr_t base;
+    size_t size;
+    void* owner;
+} Span;
+
+// Диапазон выровнен по 4 КБ. Запись - под блокировкой владельца диапазона (разные диапазоны
+// пишутся параллельно), поиск - без блокировок
+int pagemap_set(uintptr_t base, size_t size, Span* span);
+void pagemap_clear(uintptr_t base, size_t size);
+Span* pagemap_lookup(const void* ptr);
+
+#endif
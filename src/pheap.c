@@ -0,0 +1,564 @@
+#include "pheap.h"
+#include "pagemap.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PHEAP_MAGIC 0x5041454854524545ULL // "TREEHEAP"
+#define PHEAP_VERSION 2
+#define PHEAP_PAGE 4096
+#define PHEAP_MAX_KEYS (2*PHEAP_T-1)
+#define PHEAP_OP_RESERVE 64 // Запас журнала на одну операцию (узлы на путях обоих деревьев + разбиения)
+#define PHEAP_OP_NODES 32   // Запас новых узлов на вставку блока в оба дерева
+
+typedef struct {
+    int32_t n;
+    int32_t leaf;
+    uint64_t logged_epoch;              // Эпоха, в которой узел уже попал в журнал
+    uint64_t offs[PHEAP_MAX_KEYS];      // Смещения блоков от начала файла
+    uint64_t sizes[PHEAP_MAX_KEYS];
+    uint32_t children[2*PHEAP_T];       // Индекс узла + 1 (0 - нет)
+    uint32_t free_count[2*PHEAP_T];     // Дерево размеров: свободных блоков в поддереве children[i]
+    uint8_t is_free[PHEAP_MAX_KEYS];
+} PNode;
+
+typedef struct {
+    uint64_t root;        // Индекс корня + 1 (0 - дерево пусто)
+    uint64_t size_root;   // Корень дерева тех же блоков по (размер, смещение)
+    uint64_t node_count;  // Узлы [0, node_count) заняты
+    uint64_t data_bump;   // Конец выделенной части области данных
+    uint64_t user_root;   // Смещение корневого объекта приложения
+    uint64_t block_count;
+    uint64_t generation;  // Номер последней контрольной точки
+} PHeapMeta;
+
+typedef struct {
+    uint64_t magic;
+    uint64_t version;
+    uint64_t file_size;
+    uint64_t node_off;
+    uint64_t node_capacity;
+    uint64_t undo_off;
+    uint64_t undo_capacity;
+    uint64_t data_off;
+    PHeapMeta committed;  // Состояние на последней контрольной точке
+    PHeapMeta live;       // Текущее состояние
+    uint64_t undo_epoch;  // Эпоха, к которой относится журнал
+    uint64_t undo_count;
+} PHeapHeader;
+
+typedef struct {
+    uint64_t node;
+    PNode copy;
+} PUndo;
+
+static int heap_fd = -1;
+static char* base = NULL;
+static Span heap_span;
+static PHeapHeader* hdr = NULL;
+
+static PNode* node_at(uint64_t ref) {
+    return (PNode*)(base + hdr->node_off) + (ref - 1);
+}
+
+static PUndo* undo_at(uint64_t i) {
+    return (PUndo*)(base + hdr->undo_off) + i;
+}
+
+static uint64_t current_epoch(void) {
+    return hdr->committed.generation + 1;
+}
+
+static void sync_range(void* addr, size_t len) {
+    uintptr_t start = (uintptr_t)addr & ~(uintptr_t)(PHEAP_PAGE - 1);
+    uintptr_t end = (uintptr_t)addr + len;
+    msync((void*)start, end - start, MS_SYNC);
+}
+
+// Сохраняет исходное содержимое узла перед первым изменением в эпохе
+static void touch(uint64_t ref) {
+    PNode* node = node_at(ref);
+    if (ref > hdr->committed.node_count) return; // Узел создан в этой эпохе
+    if (node->logged_epoch == current_epoch()) return;
+
+    PUndo* entry = undo_at(hdr->undo_count);
+    entry->node = ref;
+    entry->copy = *node;
+    sync_range(entry, sizeof(PUndo));
+    hdr->undo_epoch = current_epoch();
+    hdr->undo_count++;
+    sync_range(&hdr->undo_count, sizeof(hdr->undo_count));
+    node->logged_epoch = current_epoch();
+}
+
+static uint64_t new_node(int leaf) {
+    if (hdr->live.node_count >= hdr->node_capacity) {
+        printf("[pheap] Node area exhausted (%llu nodes)\n", (unsigned long long)hdr->node_capacity);
+        return 0;
+    }
+    uint64_t ref = ++hdr->live.node_count;
+    PNode* node = node_at(ref);
+    memset(node, 0, sizeof(PNode));
+    node->leaf = leaf;
+    return ref;
+}
+
+// Свободных блоков в поддереве узла дерева размеров
+static uint64_t subtree_free(const PNode* node) {
+    uint64_t total = 0;
+    for (int i = 0; i < node->n; i++) total += node->is_free[i];
+    if (!node->leaf) {
+        for (int i = 0; i <= node->n; i++) total += node->free_count[i];
+    }
+    return total;
+}
+
+static int split_child(uint64_t parent_ref, int i, uint64_t child_ref, int by_size) {
+    uint64_t new_ref = new_node(node_at(child_ref)->leaf);
+    if (!new_ref) return -1;
+    touch(child_ref);
+    PNode* parent = node_at(parent_ref);
+    PNode* child = node_at(child_ref);
+    PNode* sibling = node_at(new_ref);
+
+    sibling->n = PHEAP_T - 1;
+    for (int j = 0; j < PHEAP_T - 1; j++) {
+        sibling->offs[j] = child->offs[j + PHEAP_T];
+        sibling->sizes[j] = child->sizes[j + PHEAP_T];
+        sibling->is_free[j] = child->is_free[j + PHEAP_T];
+    }
+    if (!child->leaf) {
+        for (int j = 0; j < PHEAP_T; j++) {
+            sibling->children[j] = child->children[j + PHEAP_T];
+            sibling->free_count[j] = child->free_count[j + PHEAP_T];
+            child->children[j + PHEAP_T] = 0;
+            child->free_count[j + PHEAP_T] = 0;
+        }
+    }
+    child->n = PHEAP_T - 1;
+
+    for (int j = parent->n; j > i; j--) {
+        parent->children[j + 1] = parent->children[j];
+        parent->free_count[j + 1] = parent->free_count[j];
+    }
+    parent->children[i + 1] = (uint32_t)new_ref;
+    for (int j = parent->n - 1; j >= i; j--) {
+        parent->offs[j + 1] = parent->offs[j];
+        parent->sizes[j + 1] = parent->sizes[j];
+        parent->is_free[j + 1] = parent->is_free[j];
+    }
+    parent->offs[i] = child->offs[PHEAP_T - 1];
+    parent->sizes[i] = child->sizes[PHEAP_T - 1];
+    parent->is_free[i] = child->is_free[PHEAP_T - 1];
+    parent->n++;
+    if (by_size) {
+        parent->free_count[i] = (uint32_t)subtree_free(child);
+        parent->free_count[i + 1] = (uint32_t)subtree_free(sibling);
+    }
+    return 0;
+}
+
+// Порядок ключей: в дереве адресов - по смещению, в дереве размеров - по (размер, смещение)
+static int key_after(const PNode* node, int i, uint64_t off, uint64_t size, int by_size) {
+    if (by_size && node->sizes[i] != size) return node->sizes[i] > size;
+    return node->offs[i] > off;
+}
+
+// Вставка занятого блока сверху вниз с упреждающим разбиением полных узлов.
+// Оба дерева живут в одном пуле узлов и одинаково покрыты журналом отката.
+static int index_insert(uint64_t* root_ref, uint64_t off, uint64_t size, int by_size) {
+    if (!*root_ref) {
+        uint64_t ref = new_node(1);
+        if (!ref) return -1;
+        *root_ref = ref;
+    }
+    if (node_at(*root_ref)->n == PHEAP_MAX_KEYS) {
+        uint64_t new_root = new_node(0);
+        if (!new_root) return -1;
+        node_at(new_root)->children[0] = (uint32_t)*root_ref;
+        if (split_child(new_root, 0, *root_ref, by_size) != 0) return -1;
+        *root_ref = new_root;
+    }
+
+    uint64_t ref = *root_ref;
+    while (1) {
+        touch(ref);
+        PNode* node = node_at(ref);
+        int i = node->n - 1;
+        if (node->leaf) {
+            while (i >= 0 && key_after(node, i, off, size, by_size)) {
+                node->offs[i + 1] = node->offs[i];
+                node->sizes[i + 1] = node->sizes[i];
+                node->is_free[i + 1] = node->is_free[i];
+                i--;
+            }
+            node->offs[i + 1] = off;
+            node->sizes[i + 1] = size;
+            node->is_free[i + 1] = 0;
+            node->n++;
+            return 0;
+        }
+        while (i >= 0 && key_after(node, i, off, size, by_size)) i--;
+        i++;
+        if (node_at(node->children[i])->n == PHEAP_MAX_KEYS) {
+            if (split_child(ref, i, node->children[i], by_size) != 0) return -1;
+            node = node_at(ref);
+            if (!key_after(node, i, off, size, by_size)) i++;
+        }
+        ref = node->children[i];
+    }
+}
+
+static PNode* index_find(uint64_t off, int* index, uint64_t* ref_out) {
+    uint64_t ref = hdr->live.root;
+    while (ref) {
+        PNode* node = node_at(ref);
+        int i = 0;
+        while (i < node->n && node->offs[i] < off) i++;
+        if (i < node->n && node->offs[i] == off) {
+            *index = i;
+            if (ref_out) *ref_out = ref;
+            return node;
+        }
+        if (node->leaf) return NULL;
+        ref = node->children[i];
+    }
+    return NULL;
+}
+
+// Best-fit по дереву размеров: первый свободный блок не меньше size в порядке (размер, смещение).
+// Поддеревья без свободных блоков пропускаются по счётчикам, поэтому спуск идёт не дальше
+// одного "пограничного" ребёнка на уровень. Найденный блок занимается, счётчики на пути уменьшаются.
+static int size_take(uint64_t ref, uint64_t size, uint64_t* off_out) {
+    PNode* node = node_at(ref);
+    for (int i = 0; i <= node->n; i++) {
+        if (!node->leaf && node->free_count[i] && (i == node->n || node->sizes[i] >= size) &&
+            size_take(node->children[i], size, off_out)) {
+            touch(ref);
+            node->free_count[i]--;
+            return 1;
+        }
+        if (i < node->n && node->is_free[i] && node->sizes[i] >= size) {
+            touch(ref);
+            node->is_free[i] = 0;
+            *off_out = node->offs[i];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Отмечает блок (off, size) свободным в дереве размеров и увеличивает счётчики на пути
+static int size_release(uint64_t ref, uint64_t off, uint64_t size) {
+    if (!ref) return -1;
+    PNode* node = node_at(ref);
+    int i = 0;
+    while (i < node->n && node->offs[i] != off && !key_after(node, i, off, size, 1)) i++;
+    if (i < node->n && node->offs[i] == off) {
+        touch(ref);
+        node->is_free[i] = 1;
+        return 0;
+    }
+    if (node->leaf || size_release(node->children[i], off, size) != 0) return -1;
+    touch(ref);
+    node->free_count[i]++;
+    return 0;
+}
+
+// Проверка структуры после восстановления: порядок ключей и границы ссылок
+static int check_node(uint64_t ref, uint64_t lo, uint64_t hi, int depth, int* leaf_depth, uint64_t* blocks) {
+    if (ref == 0 || ref > hdr->live.node_count || depth > 64) return -1;
+    PNode* node = node_at(ref);
+    if (node->n < 0 || node->n > PHEAP_MAX_KEYS) return -1;
+    for (int i = 0; i < node->n; i++) {
+        if (node->offs[i] < lo || node->offs[i] >= hi) return -1;
+        if (i > 0 && node->offs[i] <= node->offs[i - 1]) return -1;
+        if (node->offs[i] + node->sizes[i] > hdr->live.data_bump) return -1;
+    }
+    *blocks += (uint64_t)node->n;
+    if (node->leaf) {
+        if (*leaf_depth < 0) *leaf_depth = depth;
+        return *leaf_depth == depth ? 0 : -1;
+    }
+    for (int i = 0; i <= node->n; i++) {
+        uint64_t clo = i == 0 ? lo : node->offs[i - 1] + 1;
+        uint64_t chi = i == node->n ? hi : node->offs[i];
+        if (check_node(node->children[i], clo, chi, depth + 1, leaf_depth, blocks) != 0) return -1;
+    }
+    return 0;
+}
+
+// Дерево размеров: порядок (размер, смещение) в узле и счётчики свободных блоков детей
+static int check_size_node(uint64_t ref, int depth, int* leaf_depth, uint64_t* blocks, uint64_t* free_blocks) {
+    if (ref == 0 || ref > hdr->live.node_count || depth > 64) return -1;
+    PNode* node = node_at(ref);
+    if (node->n < 0 || node->n > PHEAP_MAX_KEYS) return -1;
+    for (int i = 1; i < node->n; i++) {
+        if (!key_after(node, i, node->offs[i - 1], node->sizes[i - 1], 1)) return -1;
+    }
+    *blocks += (uint64_t)node->n;
+    for (int i = 0; i < node->n; i++) *free_blocks += node->is_free[i];
+    if (node->leaf) {
+        if (*leaf_depth < 0) *leaf_depth = depth;
+        return *leaf_depth == depth ? 0 : -1;
+    }
+    for (int i = 0; i <= node->n; i++) {
+        uint64_t child_free = 0;
+        if (check_size_node(node->children[i], depth + 1, leaf_depth, blocks, &child_free) != 0) return -1;
+        if (child_free != node->free_count[i]) return -1;
+        *free_blocks += child_free;
+    }
+    return 0;
+}
+
+// Дешёвая проверка метаданных: делается при каждом открытии
+static int check_meta(void) {
+    if (hdr->live.data_bump < hdr->data_off || hdr->live.data_bump > hdr->file_size) return -1;
+    if (!hdr->live.root) return hdr->live.block_count == 0 ? 0 : -1;
+    if (hdr->live.node_count > hdr->node_capacity || hdr->live.root > hdr->live.node_count) return -1;
+    if (!hdr->live.size_root || hdr->live.size_root > hdr->live.node_count) return -1;
+    PNode* root = node_at(hdr->live.root);
+    return root->n < 0 || root->n > PHEAP_MAX_KEYS ? -1 : 0;
+}
+
+// Полный обход индекса - O(размер кучи), поэтому только после отката эпохи
+static int check_index(void) {
+    if (check_meta() != 0) return -1;
+    if (!hdr->live.root) return 0;
+    int leaf_depth = -1;
+    uint64_t blocks = 0;
+    if (check_node(hdr->live.root, hdr->data_off, hdr->file_size, 0, &leaf_depth, &blocks) != 0) return -1;
+    if (blocks != hdr->live.block_count) return -1;
+    uint64_t sized = 0, free_blocks = 0;
+    leaf_depth = -1;
+    if (check_size_node(hdr->live.size_root, 0, &leaf_depth, &sized, &free_blocks) != 0) return -1;
+    return sized == blocks ? 0 : -1;
+}
+
+// Откат незавершённой эпохи: узлы из журнала в обратном порядке, затем метаданные.
+// Возвращает 1, если узлы пришлось восстанавливать.
+static int recover(void) {
+    int rolled_back = 0;
+    if (hdr->undo_count > 0 && hdr->undo_epoch == current_epoch()) {
+        rolled_back = 1;
+        printf("[pheap] Rolling back %llu node(s) to checkpoint %llu\n",
+               (unsigned long long)hdr->undo_count, (unsigned long long)hdr->committed.generation);
+        for (uint64_t i = hdr->undo_count; i > 0; i--) {
+            PUndo* entry = undo_at(i - 1);
+            *node_at(entry->node) = entry->copy;
+        }
+    }
+    hdr->live = hdr->committed;
+    hdr->undo_count = 0;
+    msync(base, hdr->data_off, MS_SYNC);
+    return rolled_back;
+}
+
+static void format(uint64_t file_size) {
+    memset(base, 0, PHEAP_PAGE);
+    hdr->version = PHEAP_VERSION;
+    hdr->file_size = file_size;
+    hdr->node_off = PHEAP_PAGE;
+    hdr->node_capacity = file_size / 2048 + 64;
+    uint64_t undo_off = hdr->node_off + hdr->node_capacity * sizeof(PNode);
+    hdr->undo_off = (undo_off + PHEAP_PAGE - 1) & ~(uint64_t)(PHEAP_PAGE - 1);
+    hdr->undo_capacity = PHEAP_UNDO_CAPACITY;
+    uint64_t data_off = hdr->undo_off + hdr->undo_capacity * sizeof(PUndo);
+    hdr->data_off = (data_off + PHEAP_PAGE - 1) & ~(uint64_t)(PHEAP_PAGE - 1);
+    hdr->live.data_bump = hdr->data_off;
+    hdr->committed = hdr->live;
+    msync(base, PHEAP_PAGE, MS_SYNC);
+    hdr->magic = PHEAP_MAGIC;
+    msync(base, PHEAP_PAGE, MS_SYNC);
+}
+
+int pheap_open(const char* path, size_t size) {
+    if (base) {
+        printf("[pheap] Heap already open\n");
+        return -1;
+    }
+    heap_fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (heap_fd < 0) {
+        perror("[pheap] open");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(heap_fd, &st) != 0) {
+        perror("[pheap] fstat");
+        close(heap_fd);
+        heap_fd = -1;
+        return -1;
+    }
+    int fresh = st.st_size == 0;
+    uint64_t file_size = fresh ? ((uint64_t)size + PHEAP_PAGE - 1) & ~(uint64_t)(PHEAP_PAGE - 1) : (uint64_t)st.st_size;
+    if (fresh && ftruncate(heap_fd, (off_t)file_size) != 0) {
+        perror("[pheap] ftruncate");
+        close(heap_fd);
+        heap_fd = -1;
+        return -1;
+    }
+
+    base = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, heap_fd, 0);
+    if (base == MAP_FAILED) {
+        perror("[pheap] mmap");
+        base = NULL;
+        close(heap_fd);
+        heap_fd = -1;
+        return -1;
+    }
+    hdr = (PHeapHeader*)base;
+    heap_span = (Span){SPAN_PHEAP, (uintptr_t)base, (size_t)file_size, NULL};
+    pagemap_set((uintptr_t)base, (size_t)file_size, &heap_span);
+
+    if (fresh || hdr->magic == 0) {
+        format(file_size);
+        if (hdr->data_off >= file_size) {
+            printf("[pheap] File size %llu is too small\n", (unsigned long long)file_size);
+            pheap_close();
+            return -1;
+        }
+        printf("[pheap] Created heap %s (%llu bytes)\n", path, (unsigned long long)file_size);
+        return 0;
+    }
+
+    if (hdr->magic != PHEAP_MAGIC || hdr->version != PHEAP_VERSION || hdr->file_size != file_size) {
+        printf("[pheap] %s is not a compatible treealoc heap\n", path);
+        pheap_close();
+        return -1;
+    }
+    int rolled_back = recover();
+#ifdef TREEALOC_DEBUG
+    rolled_back = 1;
+#endif
+    if ((rolled_back ? check_index() : check_meta()) != 0) {
+        printf("[pheap] Index in %s is corrupted\n", path);
+        pheap_close();
+        return -1;
+    }
+    printf("[pheap] Reopened heap %s: %llu blocks, generation %llu\n", path,
+           (unsigned long long)hdr->live.block_count, (unsigned long long)hdr->live.generation);
+    return 0;
+}
+
+int pheap_checkpoint(void) {
+    if (!base) return -1;
+    // Данные и узлы на диск раньше, чем метаданные, которые на них ссылаются
+    if (msync(base, hdr->file_size, MS_SYNC) != 0) {
+        perror("[pheap] msync");
+        return -1;
+    }
+    PHeapMeta next = hdr->live;
+    next.generation = current_epoch();
+    hdr->committed = next;
+    hdr->live.generation = next.generation;
+    sync_range(&hdr->committed, sizeof(PHeapMeta));
+    // С этого момента журнал устарел: его эпоха меньше новой current_epoch()
+    hdr->undo_count = 0;
+    sync_range(hdr, sizeof(PHeapHeader));
+    if (fsync(heap_fd) != 0) {
+        perror("[pheap] fsync");
+        return -1;
+    }
+    return 0;
+}
+
+void pheap_close(void) {
+    if (base) {
+        pagemap_clear((uintptr_t)base, heap_span.size);
+        munmap(base, heap_span.size);
+    }
+    if (heap_fd >= 0) close(heap_fd);
+    base = NULL;
+    hdr = NULL;
+    heap_fd = -1;
+}
+
+int pheap_active(void) {
+    return base != NULL;
+}
+
+static void reserve_undo(void) {
+    if (hdr->undo_count + PHEAP_OP_RESERVE > hdr->undo_capacity) {
+        printf("[pheap] Undo log full, forcing checkpoint\n");
+        pheap_checkpoint();
+    }
+}
+
+void* pheap_malloc(size_t size) {
+    if (!base) return NULL;
+    if (size == 0) size = 1;
+    reserve_undo();
+
+    uint64_t off;
+    if (hdr->live.size_root && size_take(hdr->live.size_root, size, &off)) {
+        int index;
+        uint64_t ref;
+        PNode* node = index_find(off, &index, &ref);
+        touch(ref);
+        node->is_free[index] = 0;
+        return base + off;
+    }
+
+    uint64_t rounded = ((uint64_t)size + PHEAP_ALIGN - 1) & ~(uint64_t)(PHEAP_ALIGN - 1);
+    if (hdr->live.data_bump + rounded > hdr->file_size) {
+        printf("[pheap] Out of space for %zu bytes\n", size);
+        return NULL;
+    }
+    if (hdr->live.node_count + PHEAP_OP_NODES > hdr->node_capacity) {
+        printf("[pheap] Node area exhausted (%llu nodes)\n", (unsigned long long)hdr->node_capacity);
+        return NULL;
+    }
+    off = hdr->live.data_bump;
+    if (index_insert(&hdr->live.root, off, rounded, 0) != 0 ||
+        index_insert(&hdr->live.size_root, off, rounded, 1) != 0) {
+        return NULL;
+    }
+    hdr->live.block_count++;
+    hdr->live.data_bump += rounded;
+    return base + off;
+}
+
+int pheap_owns(void* ptr) {
+    return base && (char*)ptr >= base + hdr->data_off && (char*)ptr < base + hdr->file_size;
+}
+
+void pheap_free(void* ptr) {
+    if (!pheap_owns(ptr)) return;
+    reserve_undo();
+    int index;
+    uint64_t ref;
+    PNode* node = index_find((uint64_t)((char*)ptr - base), &index, &ref);
+    if (!node) {
+        printf("[pheap] free(%p): not a block of the persistent heap\n", ptr);
+        return;
+    }
+    if (node->is_free[index]) {
+        printf("[pheap] Double free of %p\n", ptr);
+        return;
+    }
+    touch(ref);
+    node->is_free[index] = 1;
+    if (size_release(hdr->live.size_root, node->offs[index], node->sizes[index]) != 0) {
+        printf("[pheap] Size index has no entry for %p\n", ptr);
+    }
+}
+
+size_t pheap_usable_size(void* ptr) {
+    if (!pheap_owns(ptr)) return 0;
+    int index;
+    PNode* node = index_find((uint64_t)((char*)ptr - base), &index, NULL);
+    return node && !node->is_free[index] ? (size_t)node->sizes[index] : 0;
+}
+
+void* pheap_root(void) {
+    return base && hdr->live.user_root ? base + hdr->live.user_root : NULL;
+}
+
+void pheap_set_root(void* ptr) {
+    if (!base) return;
+    hdr->live.user_root = ptr ? (uint64_t)((char*)ptr - base) : 0;
+}
@@ -0,0 +1,38 @@
+#ifndef PHEAP_H
+#define PHEAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Персистентная куча: файл, отображённый через mmap, хранит и данные, и индекс.
+// Индекс - B-дерево, узлы которого лежат в том же файле и ссылаются друг на
+// друга индексами, а на блоки - смещениями от начала файла. После перезапуска
+// файл отображается заново, и куча с индексом доступна без перестроения.
+//
+// Второе дерево в том же пуле узлов упорядочивает те же блоки по (размер, смещение)
+// и хранит в узлах число свободных блоков поддеревьев: best-fit в malloc - спуск
+// по нему за O(log n), а не проход по всем узлам.
+//
+// Согласованность: между контрольными точками изменённые узлы сначала
+// копируются в журнал отката. При открытии после аварийного завершения узлы
+// восстанавливаются из журнала, и куча возвращается к последней контрольной
+// точке. Содержимое блоков журналом не покрывается.
+
+#define PHEAP_T 16             // Минимальная степень дерева в файле
+#define PHEAP_UNDO_CAPACITY 1024
+#define PHEAP_ALIGN 16
+
+int pheap_open(const char* path, size_t size); // 0 - успех
+void pheap_close(void);
+int pheap_active(void);
+int pheap_checkpoint(void);
+
+void* pheap_malloc(size_t size);
+void pheap_free(void* ptr);
+size_t pheap_usable_size(void* ptr);  // 0, если ptr не принадлежит куче
+int pheap_owns(void* ptr);
+
+void* pheap_root(void);
+void pheap_set_root(void* ptr);
+
+#endif
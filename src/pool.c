@@ -0,0 +1,116 @@
+#include "pool.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct PoolChunk {
+    struct PoolChunk* next;
+    char* first;  // Первый объект (с учётом выравнивания)
+    char* end;    // Конец области объектов
+} PoolChunk;
+
+typedef struct FreeObject {
+    struct FreeObject* next;
+} FreeObject;
+
+struct Pool {
+    size_t object_size;   // С округлением до выравнивания
+    size_t align;
+    size_t chunk_size;
+    PoolChunk* chunks;    // Первый - текущий для нарезки
+    char* bump;           // Следующий ни разу не выданный объект текущего блока
+    FreeObject* free_list;
+    size_t live;
+    pool_chunk_alloc_fn alloc;
+    pool_chunk_free_fn release;
+};
+
+Pool* pool_create(size_t object_size, size_t align, pool_chunk_alloc_fn alloc, pool_chunk_free_fn release) {
+    if (align == 0) align = sizeof(void*);
+    if (align & (align - 1)) {
+        printf("[pool] Alignment %zu is not a power of two\n", align);
+        return NULL;
+    }
+    if (object_size < sizeof(FreeObject)) object_size = sizeof(FreeObject);
+    if (align < sizeof(void*)) align = sizeof(void*);
+    object_size = (object_size + align - 1) & ~(align - 1);
+
+    Pool* pool = malloc(sizeof(Pool));
+    if (!pool) return NULL;
+    pool->object_size = object_size;
+    pool->align = align;
+    // Заголовок блока + запас на выравнивание + объекты
+    size_t objects = POOL_CHUNK_BYTES / object_size;
+    if (objects < POOL_MIN_OBJECTS) objects = POOL_MIN_OBJECTS;
+    pool->chunk_size = sizeof(PoolChunk) + align + objects * object_size;
+    pool->chunks = NULL;
+    pool->bump = NULL;
+    pool->free_list = NULL;
+    pool->live = 0;
+    pool->alloc = alloc;
+    pool->release = release;
+    printf("[pool] Created pool %p: object %zu bytes, align %zu, %zu objects per chunk\n", pool, object_size, align, objects);
+    return pool;
+}
+
+static int add_chunk(Pool* pool) {
+    PoolChunk* chunk = pool->alloc(pool->chunk_size);
+    if (!chunk) return -1;
+    uintptr_t first = ((uintptr_t)(chunk + 1) + pool->align - 1) & ~(uintptr_t)(pool->align - 1);
+    chunk->first = (char*)first;
+    chunk->end = (char*)chunk + pool->chunk_size;
+    chunk->next = pool->chunks;
+    pool->chunks = chunk;
+    pool->bump = chunk->first;
+    return 0;
+}
+
+void* pool_alloc(Pool* pool) {
+    if (pool->free_list) {
+        FreeObject* obj = pool->free_list;
+        pool->free_list = obj->next;
+        pool->live++;
+        return obj;
+    }
+    if (!pool->chunks || pool->bump + pool->object_size > pool->chunks->end) {
+        if (add_chunk(pool) != 0) return NULL;
+    }
+    void* obj = pool->bump;
+    pool->bump += pool->object_size;
+    pool->live++;
+    return obj;
+}
+
+int pool_contains(const Pool* pool, const void* obj) {
+    for (const PoolChunk* chunk = pool->chunks; chunk; chunk = chunk->next) {
+        if ((const char*)obj >= chunk->first && (const char*)obj < chunk->end) {
+            return ((uintptr_t)((const char*)obj - chunk->first)) % pool->object_size == 0;
+        }
+    }
+    return 0;
+}
+
+void pool_free(Pool* pool, void* obj) {
+    if (!obj) return;
+#ifdef TREEALOC_DEBUG
+    if (!pool_contains(pool, obj)) {
+        printf("[pool] free(%p): not an object of pool %p\n", obj, pool);
+        return;
+    }
+#endif
+    FreeObject* node = obj;
+    node->next = pool->free_list;
+    pool->free_list = node;
+    pool->live--;
+}
+
+void pool_destroy(Pool* pool) {
+    if (!pool) return;
+    if (pool->live) printf("[pool] Destroying pool %p with %zu live objects\n", pool, pool->live);
+    while (pool->chunks) {
+        PoolChunk* next = pool->chunks->next;
+        pool->release(pool->chunks);
+        pool->chunks = next;
+    }
+    free(pool);
+}
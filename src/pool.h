@@ -0,0 +1,25 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+// Пул объектов одного размера. Объекты нарезаются из крупных блоков treealoc
+// (одна запись B-дерева на блок, а не на объект); освобождённые объекты
+// связываются в список через собственную память и выдаются первыми.
+
+#define POOL_CHUNK_BYTES (64 * 1024)
+#define POOL_MIN_OBJECTS 16 // Не меньше стольких объектов в блоке
+
+typedef void* (*pool_chunk_alloc_fn)(size_t size);
+typedef void (*pool_chunk_free_fn)(void* ptr);
+
+typedef struct Pool Pool;
+
+// Вызывающий держит блокировку аллокатора
+Pool* pool_create(size_t object_size, size_t align, pool_chunk_alloc_fn alloc, pool_chunk_free_fn release);
+void* pool_alloc(Pool* pool);
+void pool_free(Pool* pool, void* obj);
+int pool_contains(const Pool* pool, const void* obj);
+void pool_destroy(Pool* pool);
+
+#endif
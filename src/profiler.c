@@ -0,0 +1,357 @@
+#define _GNU_SOURCE // dladdr
+#include "profiler.h"
+#include "b_tree.h"
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    uint64_t hash;
+    int depth;
+    void* pcs[PROFILE_MAX_DEPTH];
+    // Сырые значения по выборкам (для pprof, который сам пересчитывает по интервалу)
+    uint64_t alloc_samples, alloc_sampled_bytes;
+    uint64_t live_samples, live_sampled_bytes;
+    // Оценка реальных значений: каждая выборка размера s весит 1 / (1 - exp(-s/T))
+    double alloc_count, alloc_bytes;
+    double live_count, live_bytes;
+} Stack;
+
+typedef struct {
+    uintptr_t addr;   // 0 - пустая ячейка
+    int stack;
+    size_t size;
+    double weight;
+} Sample;
+
+static int active = 0;
+// События деревьев шардов приходят из разных потоков под разными блокировками
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+static double mean_interval = PROFILE_DEFAULT_INTERVAL;
+static int64_t bytes_until_sample = 0;
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+static Stack* stacks = NULL;
+static size_t stack_count = 0, stack_cap = 0;
+static int* stack_index = NULL;     // Открытая адресация по hash, -1 - пусто
+static size_t stack_index_cap = 0;
+
+static Sample* samples = NULL;      // Открытая адресация по адресу блока
+static size_t sample_count = 0, sample_cap = 0;
+
+// Граница собственного кода: кадры аллокатора в начале стека не интересны
+static void* own_base = NULL;
+static int own_is_shared = 0;
+
+static uint64_t next_random(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static int64_t next_interval(void) {
+    // U в (0, 1]: -ln(U) * T - экспоненциальный интервал со средним T
+    double u = (double)((next_random() >> 11) + 1) / 9007199254740992.0;
+    return (int64_t)(-log(u) * mean_interval) + 1;
+}
+
+static uint64_t hash_ptr(uintptr_t p) {
+    p ^= p >> 33;
+    p *= 0xff51afd7ed558ccdULL;
+    p ^= p >> 33;
+    return p;
+}
+
+static uint64_t hash_stack(void* const* pcs, int depth) {
+    uint64_t h = 1469598103934665603ULL;
+    for (int i = 0; i < depth; i++) h = (h ^ (uintptr_t)pcs[i]) * 1099511628211ULL;
+    return h;
+}
+
+static int stack_index_grow(void) {
+    size_t cap = stack_index_cap ? stack_index_cap * 2 : 1024;
+    int* idx = malloc(cap * sizeof(int));
+    if (!idx) return -1;
+    memset(idx, 0xff, cap * sizeof(int));
+    for (size_t i = 0; i < stack_count; i++) {
+        size_t pos = stacks[i].hash & (cap - 1);
+        while (idx[pos] >= 0) pos = (pos + 1) & (cap - 1);
+        idx[pos] = (int)i;
+    }
+    free(stack_index);
+    stack_index = idx;
+    stack_index_cap = cap;
+    return 0;
+}
+
+static int intern_stack(void* const* pcs, int depth) {
+    uint64_t h = hash_stack(pcs, depth);
+    if ((stack_count + 1) * 2 > stack_index_cap && stack_index_grow() != 0) return -1;
+    size_t pos = h & (stack_index_cap - 1);
+    while (stack_index[pos] >= 0) {
+        Stack* s = &stacks[stack_index[pos]];
+        if (s->hash == h && s->depth == depth && memcmp(s->pcs, pcs, depth * sizeof(void*)) == 0) {
+            return stack_index[pos];
+        }
+        pos = (pos + 1) & (stack_index_cap - 1);
+    }
+    if (stack_count == stack_cap) {
+        size_t cap = stack_cap ? stack_cap * 2 : 256;
+        Stack* grown = realloc(stacks, cap * sizeof(Stack));
+        if (!grown) return -1;
+        stacks = grown;
+        stack_cap = cap;
+    }
+    Stack* s = &stacks[stack_count];
+    memset(s, 0, sizeof(*s));
+    s->hash = h;
+    s->depth = depth;
+    memcpy(s->pcs, pcs, depth * sizeof(void*));
+    stack_index[pos] = (int)stack_count;
+    return (int)stack_count++;
+}
+
+static int samples_grow(void) {
+    size_t cap = sample_cap ? sample_cap * 2 : 1024;
+    Sample* grown = calloc(cap, sizeof(Sample));
+    if (!grown) return -1;
+    for (size_t i = 0; i < sample_cap; i++) {
+        if (!samples[i].addr) continue;
+        size_t pos = hash_ptr(samples[i].addr) & (cap - 1);
+        while (grown[pos].addr) pos = (pos + 1) & (cap - 1);
+        grown[pos] = samples[i];
+    }
+    free(samples);
+    samples = grown;
+    sample_cap = cap;
+    return 0;
+}
+
+static void sample_put(uintptr_t addr, int stack, size_t size, double weight) {
+    if ((sample_count + 1) * 2 > sample_cap && samples_grow() != 0) return;
+    size_t pos = hash_ptr(addr) & (sample_cap - 1);
+    while (samples[pos].addr && samples[pos].addr != addr) pos = (pos + 1) & (sample_cap - 1);
+    if (!samples[pos].addr) sample_count++;
+    samples[pos] = (Sample){addr, stack, size, weight};
+}
+
+// Удаление со сдвигом назад: в таблице не остаётся надгробий
+static int sample_take(uintptr_t addr, Sample* out) {
+    if (!sample_count) return 0;
+    size_t mask = sample_cap - 1;
+    size_t pos = hash_ptr(addr) & mask;
+    while (samples[pos].addr != addr) {
+        if (!samples[pos].addr) return 0;
+        pos = (pos + 1) & mask;
+    }
+    *out = samples[pos];
+    size_t hole = pos;
+    for (size_t next = (hole + 1) & mask; samples[next].addr; next = (next + 1) & mask) {
+        size_t home = hash_ptr(samples[next].addr) & mask;
+        // Элемент можно сдвинуть в дыру, если его домашняя ячейка не лежит между дырой и ним
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            samples[hole] = samples[next];
+            hole = next;
+        }
+    }
+    samples[hole].addr = 0;
+    sample_count--;
+    return 1;
+}
+
+static void record_alloc(void* block, size_t size) {
+    bytes_until_sample -= (int64_t)size;
+    if (bytes_until_sample > 0) return;
+    bytes_until_sample = next_interval();
+
+    void* frames[PROFILE_MAX_DEPTH + 8];
+    int n = backtrace(frames, PROFILE_MAX_DEPTH + 8);
+    int skip = 2; // record_alloc и on_event
+    if (own_is_shared) {
+        Dl_info info;
+        while (skip < n && dladdr(frames[skip], &info) && info.dli_fbase == own_base) skip++;
+    }
+    int depth = n - skip > PROFILE_MAX_DEPTH ? PROFILE_MAX_DEPTH : n - skip;
+    if (depth < 0) depth = 0;
+    int id = intern_stack(frames + skip, depth);
+    if (id < 0) return;
+
+    double weight = 1.0 / (1.0 - exp(-(double)size / mean_interval));
+    Stack* s = &stacks[id];
+    s->alloc_samples++;
+    s->alloc_sampled_bytes += size;
+    s->live_samples++;
+    s->live_sampled_bytes += size;
+    s->alloc_count += weight;
+    s->alloc_bytes += weight * (double)size;
+    s->live_count += weight;
+    s->live_bytes += weight * (double)size;
+    sample_put((uintptr_t)block, id, size, weight);
+}
+
+static void record_free(void* block) {
+    Sample sm;
+    if (!sample_take((uintptr_t)block, &sm)) return;
+    Stack* s = &stacks[sm.stack];
+    s->live_samples--;
+    s->live_sampled_bytes -= sm.size;
+    s->live_count -= sm.weight;
+    s->live_bytes -= sm.weight * (double)sm.size;
+}
+
+static void drop_live(void) {
+    for (size_t i = 0; i < stack_count; i++) {
+        stacks[i].live_samples = stacks[i].live_sampled_bytes = 0;
+        stacks[i].live_count = stacks[i].live_bytes = 0;
+    }
+    if (samples) memset(samples, 0, sample_cap * sizeof(Sample));
+    sample_count = 0;
+}
+
+static void on_event(const BTreeEvent* ev, void* ctx) {
+    (void)ctx;
+    pthread_mutex_lock(&profile_lock);
+    switch (ev->type) {
+        case BTREE_EV_INSERT:
+            if (!ev->is_free) record_alloc(ev->block, ev->size);
+            break;
+        case BTREE_EV_REUSE:
+            record_alloc(ev->block, ev->size);
+            break;
+        case BTREE_EV_RELEASE:
+            record_free(ev->block);
+            break;
+        case BTREE_EV_REMOVE:
+            if (!ev->is_free) record_free(ev->block);
+            break;
+        case BTREE_EV_CLEAR:
+            drop_live();
+            break;
+    }
+    pthread_mutex_unlock(&profile_lock);
+}
+
+int profiler_start(size_t interval) {
+    if (active) return 0;
+    mean_interval = interval ? (double)interval : PROFILE_DEFAULT_INTERVAL;
+    rng_state ^= (uint64_t)(uintptr_t)&interval;
+    bytes_until_sample = next_interval();
+
+    // Первый вызов backtrace подгружает libgcc_s - делаем его заранее
+    void* probe[1];
+    backtrace(probe, 1);
+    Dl_info info;
+    if (dladdr((void*)profiler_start, &info) && info.dli_fname && strstr(info.dli_fname, ".so")) {
+        own_base = info.dli_fbase;
+        own_is_shared = 1;
+    }
+    if (btree_add_concurrent_listener(on_event, NULL) != 0) {
+        printf("[profiler] No free B-tree listener slot\n");
+        return -1;
+    }
+    active = 1;
+    printf("[profiler] Sampling every ~%.0f bytes\n", mean_interval);
+    return 0;
+}
+
+void profiler_stop(void) {
+    if (!active) return;
+    btree_remove_listener(on_event, NULL);
+    active = 0;
+    pthread_mutex_lock(&profile_lock);
+    drop_live();
+    free(stacks);
+    free(stack_index);
+    free(samples);
+    stacks = NULL;
+    stack_index = NULL;
+    samples = NULL;
+    stack_count = stack_cap = stack_index_cap = sample_cap = 0;
+    pthread_mutex_unlock(&profile_lock);
+}
+
+int profiler_active(void) {
+    return active;
+}
+
+// Имя функции кадра; без символа - модуль+смещение
+static void frame_name(void* pc, char* buf, size_t len) {
+    Dl_info info;
+    int found = dladdr(pc, &info);
+    if (found && info.dli_sname) {
+        snprintf(buf, len, "%s", info.dli_sname);
+    } else if (found && info.dli_fname) {
+        const char* base = strrchr(info.dli_fname, '/');
+        snprintf(buf, len, "%s+0x%lx", base ? base + 1 : info.dli_fname,
+                 (unsigned long)((uintptr_t)pc - (uintptr_t)info.dli_fbase));
+    } else {
+        snprintf(buf, len, "0x%lx", (unsigned long)(uintptr_t)pc);
+    }
+}
+
+static void dump_folded(FILE* out, int inuse) {
+    char name[256];
+    for (size_t i = 0; i < stack_count; i++) {
+        Stack* s = &stacks[i];
+        double bytes = inuse ? s->live_bytes : s->alloc_bytes;
+        if (bytes < 0.5) continue;
+        // Свёрнутый формат идёт от корня к листу, backtrace - наоборот
+        for (int f = s->depth - 1; f >= 0; f--) {
+            // Адрес возврата указывает за инструкцию вызова
+            frame_name((char*)s->pcs[f] - 1, name, sizeof(name));
+            fprintf(out, "%s%s", name, f ? ";" : "");
+        }
+        if (!s->depth) fprintf(out, "[unknown]");
+        fprintf(out, " %.0f\n", bytes);
+    }
+}
+
+static void dump_pprof(FILE* out) {
+    uint64_t live_n = 0, live_b = 0, alloc_n = 0, alloc_b = 0;
+    for (size_t i = 0; i < stack_count; i++) {
+        live_n += stacks[i].live_samples;
+        live_b += stacks[i].live_sampled_bytes;
+        alloc_n += stacks[i].alloc_samples;
+        alloc_b += stacks[i].alloc_sampled_bytes;
+    }
+    fprintf(out, "heap profile: %llu: %llu [%llu: %llu] @ heap_v2/%.0f\n", (unsigned long long)live_n,
+            (unsigned long long)live_b, (unsigned long long)alloc_n, (unsigned long long)alloc_b, mean_interval);
+    for (size_t i = 0; i < stack_count; i++) {
+        Stack* s = &stacks[i];
+        fprintf(out, "%llu: %llu [%llu: %llu] @", (unsigned long long)s->live_samples,
+                (unsigned long long)s->live_sampled_bytes, (unsigned long long)s->alloc_samples,
+                (unsigned long long)s->alloc_sampled_bytes);
+        for (int f = 0; f < s->depth; f++) fprintf(out, " %p", s->pcs[f]);
+        fprintf(out, "\n");
+    }
+    // pprof символизирует адреса по карте модулей
+    fprintf(out, "\nMAPPED_LIBRARIES:\n");
+    FILE* maps = fopen("/proc/self/maps", "r");
+    if (maps) {
+        char line[512];
+        while (fgets(line, sizeof(line), maps)) fputs(line, out);
+        fclose(maps);
+    }
+}
+
+int profiler_dump(const char* path, int format) {
+    FILE* out = fopen(path, "w");
+    if (!out) {
+        perror("[profiler] fopen");
+        return -1;
+    }
+    pthread_mutex_lock(&profile_lock);
+    if (format == PROFILE_PPROF) dump_pprof(out);
+    else dump_folded(out, format == PROFILE_FOLDED_INUSE);
+    size_t dumped = stack_count;
+    pthread_mutex_unlock(&profile_lock);
+    fclose(out);
+    printf("[profiler] Wrote %zu stacks to %s\n", dumped, path);
+    return 0;
+}
@@ -0,0 +1,28 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stddef.h>
+
+// Выборочный профилировщик кучи. Следующая выборка наступает через случайное
+// число байт с геометрическим распределением (как в tcmalloc), поэтому вероятность
+// попасть в выборку пропорциональна размеру блока. Для выбранного блока снимается
+// стек через backtrace(); живые выборки хранятся в таблице по адресу блока
+// и снимаются при его освобождении (события B-дерева).
+
+#define PROFILE_DEFAULT_INTERVAL (512 * 1024) // Средний интервал между выборками, байт
+#define PROFILE_MAX_DEPTH 32
+
+enum {
+    PROFILE_FOLDED_INUSE = 0, // Свёрнутые стеки "f1;f2;f3 байты" - занятая сейчас память
+    PROFILE_FOLDED_ALLOC,     // То же за всё время профилирования
+    PROFILE_PPROF             // Текстовый heap-профиль pprof (heap_v2) с картой /proc/self/maps
+};
+
+// Вызывающий держит блокировку аллокатора. События шардов приходят из разных
+// потоков, поэтому таблицы стеков защищены своей блокировкой.
+int profiler_start(size_t mean_interval);
+void profiler_stop(void);
+int profiler_active(void);
+int profiler_dump(const char* path, int format);
+
+#endif
@@ -0,0 +1,340 @@
+#include "region.h"
+#include "pagemap.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+typedef struct Region {
+    struct Region* next;
+    char* base;
+    size_t size;
+    // Публикуется с release после записи в карту размеров: region_block_size читает
+    // его без блокировки (free из кэшей процессоров и очередей)
+    _Atomic size_t used;
+    int huge;    // REGION_HUGE_* - чем фактически обеспечена область
+    int shard;   // Шард, из дерева которого выдаются блоки области
+    Span span;   // Запись в карте страниц
+    // Размер блока в гранулах по его первой грануле (0 - не начало блока).
+    // У отдельного отображения крупного блока карты нет, размер хранится целиком.
+    uint8_t* sizemap;
+    size_t large_size;
+} Region;
+
+static Region* regions = NULL;
+static Region* cursors[REGION_MAX_SHARDS]; // Текущая область для нарезки у каждого шарда
+static size_t mapped_bytes = 0;
+// Нарезка из своей области идёт под блокировкой шарда; список областей,
+// счётчики и карта страниц общие и меняются только под этой блокировкой
+static pthread_mutex_t region_lock = PTHREAD_MUTEX_INITIALIZER;
+static int huge_mode = REGION_HUGE_OFF;
+static int hugetlb_failed = 0;
+
+void region_set_huge_mode(int mode) {
+    huge_mode = mode;
+    hugetlb_failed = 0;
+    printf("[region] Huge page mode: %s\n",
+           mode == REGION_HUGE_HUGETLB ? "hugetlb" : mode == REGION_HUGE_THP ? "thp" : "off");
+}
+
+int region_huge_mode(void) {
+    return huge_mode;
+}
+
+static size_t huge_round(size_t size) {
+    return (size + REGION_HUGE_PAGE - 1) & ~(size_t)(REGION_HUGE_PAGE - 1);
+}
+
+#ifdef TREEALOC_COMPACT_NODES
+uintptr_t region_window_base = 0;
+size_t region_window_bytes = 0;
+static size_t window_used = 0;
+
+static int reserve_window(void) {
+    for (size_t size = REGION_WINDOW_MAX; size >= REGION_WINDOW_MIN; size /= 2) {
+        char* raw = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (raw == MAP_FAILED) continue;
+        // База на границе большой страницы: выравнивание внутри окна становится абсолютным
+        uintptr_t base = ((uintptr_t)raw + REGION_HUGE_PAGE - 1) & ~(uintptr_t)(REGION_HUGE_PAGE - 1);
+        region_window_base = base;
+        region_window_bytes = size - (base - (uintptr_t)raw);
+        printf("[region] Reserved %zu-byte address window at %p\n", region_window_bytes, (void*)base);
+        return 0;
+    }
+    printf("[region] Failed to reserve an address window\n");
+    return -1;
+}
+
+// Окно раздаётся по возрастанию адресов; вызывающий держит region_lock
+static void* map_pages(size_t size, size_t align, int flags) {
+    if (!region_window_bytes && reserve_window() != 0) return NULL;
+    // Выравнивание абсолютное: пулы близнецов выровнены сильнее базы окна
+    size_t off = ((region_window_base + window_used + align - 1) & ~(uintptr_t)(align - 1)) - region_window_base;
+    if (off + size > region_window_bytes) {
+        printf("[region] Address window exhausted\n");
+        return NULL;
+    }
+    void* mem = mmap((void*)(region_window_base + off), size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | flags, -1, 0);
+    if (mem == MAP_FAILED) return NULL;
+    window_used = off + size;
+    return mem;
+}
+
+// Участок окна снова только резервируется: снятое отображение мог бы занять кто-то другой
+static void unmap_pages(void* mem, size_t size) {
+    mmap(mem, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0);
+}
+#else
+// Выравнивание больше страницы: резервируется size + align и края обрезаются
+static void* map_pages(size_t size, size_t align, int flags) {
+#ifdef MAP_HUGETLB
+    if (flags & MAP_HUGETLB) align = 0; // Отображения hugetlb ядро выравнивает само
+#endif
+    if (align <= (size_t)sysconf(_SC_PAGESIZE)) {
+        void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+        return mem == MAP_FAILED ? NULL : mem;
+    }
+    size_t reserve = size + align;
+    char* raw = mmap(NULL, reserve, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+    if (raw == MAP_FAILED) return NULL;
+    char* aligned = (char*)(((uintptr_t)raw + align - 1) & ~(uintptr_t)(align - 1));
+    if (aligned > raw) munmap(raw, (size_t)(aligned - raw));
+    size_t tail = (size_t)(raw + reserve - (aligned + size));
+    if (tail) munmap(aligned + size, tail);
+    return aligned;
+}
+
+static void unmap_pages(void* mem, size_t size) {
+    munmap(mem, size);
+}
+#endif
+
+// Начало области попадает на границу большой страницы
+static void* map_huge_aligned(size_t size) {
+    void* mem = map_pages(size, REGION_HUGE_PAGE, 0);
+#ifdef MADV_HUGEPAGE
+    if (mem && madvise(mem, size, MADV_HUGEPAGE) != 0) perror("[region] madvise(MADV_HUGEPAGE)");
+#endif
+    return mem;
+}
+
+static size_t page_round(size_t size) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    return (size + page - 1) & ~(page - 1);
+}
+
+// Вызывающий держит region_lock
+static Region* map_region(size_t size, int shard) {
+    Region* region = malloc(sizeof(Region));
+    if (!region) return NULL;
+    void* mem = NULL;
+    region->huge = REGION_HUGE_OFF;
+    region->shard = shard;
+
+#ifdef MAP_HUGETLB
+    if (huge_mode == REGION_HUGE_HUGETLB && !hugetlb_failed) {
+        size = huge_round(size);
+        mem = map_pages(size, REGION_HUGE_PAGE, MAP_HUGETLB);
+        if (!mem) {
+            // Пул hugetlbfs пуст или не настроен - дальше используем THP
+            printf("[region] MAP_HUGETLB unavailable, falling back to transparent huge pages\n");
+            hugetlb_failed = 1;
+        } else {
+            region->huge = REGION_HUGE_HUGETLB;
+        }
+    }
+#endif
+    if (!mem && huge_mode != REGION_HUGE_OFF) {
+        size = huge_round(size);
+        mem = map_huge_aligned(size);
+        if (mem) region->huge = REGION_HUGE_THP;
+    }
+    if (!mem) {
+        size = page_round(size);
+        mem = map_pages(size, (size_t)sysconf(_SC_PAGESIZE), 0);
+        if (!mem) {
+            perror("[region] mmap");
+            free(region);
+            return NULL;
+        }
+    }
+    region->base = mem;
+    region->size = size;
+    region->used = 0;
+    region->sizemap = NULL;
+    region->large_size = 0;
+    region->span = (Span){SPAN_REGION, (uintptr_t)mem, size, region};
+    if (pagemap_set((uintptr_t)mem, size, &region->span) != 0) {
+        printf("[region] Failed to register %p in the page map\n", mem);
+        unmap_pages(mem, size);
+        free(region);
+        return NULL;
+    }
+    mapped_bytes += size;
+    region->next = regions;
+    regions = region;
+    printf("[region] Mapped %zu bytes at %p (huge=%d)\n", size, mem, region->huge);
+    return region;
+}
+
+void* region_alloc(size_t size) {
+    return region_alloc_shard(0, size);
+}
+
+void* region_alloc_shard(int shard, size_t size) {
+    return region_alloc_aligned(shard, size, REGION_ALIGN);
+}
+
+// Пропущенные при выравнивании гранулы не становятся блоками: их не больше align - REGION_ALIGN байт
+void* region_alloc_aligned(int shard, size_t size, size_t align) {
+    size = (size + REGION_ALIGN - 1) & ~(size_t)(REGION_ALIGN - 1);
+    if (size == 0) size = REGION_ALIGN;
+
+    size_t chunk = huge_mode != REGION_HUGE_OFF ? REGION_HUGE_CHUNK : REGION_CHUNK;
+    size_t large = huge_mode != REGION_HUGE_OFF ? REGION_HUGE_LARGE : REGION_LARGE;
+    if (size >= large) {
+        // Отдельное отображение не становится текущим, чтобы не терять хвост текущей области
+        pthread_mutex_lock(&region_lock);
+        Region* big = map_region(size, shard);
+        if (big) {
+            big->large_size = size;
+            atomic_store_explicit(&big->used, big->size, memory_order_release);
+        }
+        pthread_mutex_unlock(&region_lock);
+        return big ? big->base : NULL;
+    }
+
+    Region* cur = cursors[shard];
+    size_t used = cur ? atomic_load_explicit(&cur->used, memory_order_relaxed) : 0; // Пишет только владелец курсора
+    size_t pad = cur ? -(uintptr_t)(cur->base + used) & (align - 1) : 0;
+    if (!cur || cur->size - used < pad + size) {
+        pthread_mutex_lock(&region_lock);
+        cur = map_region(chunk, shard);
+        if (cur) {
+            // Карта размеров - 1 байт на 16 байт области; страницы карты подгружаются по мере нарезки
+            cur->sizemap = mmap(NULL, cur->size / REGION_ALIGN, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (cur->sizemap == MAP_FAILED) cur->sizemap = NULL;
+        }
+        pthread_mutex_unlock(&region_lock);
+        if (!cur) return NULL;
+        cursors[shard] = cur;
+        used = pad = 0; // Область выровнена по странице
+    }
+    used += pad;
+    void* ptr = cur->base + used;
+    if (cur->sizemap) {
+        size_t granules = size / REGION_ALIGN;
+        cur->sizemap[used / REGION_ALIGN] = granules < REGION_SIZEMAP_BIG ? (uint8_t)granules : REGION_SIZEMAP_BIG;
+    }
+    atomic_store_explicit(&cur->used, used + size, memory_order_release);
+    return ptr;
+}
+
+int region_shard(const Span* span) {
+    return ((const Region*)span->owner)->shard;
+}
+
+void* region_map_pool(size_t size, size_t align) {
+    pthread_mutex_lock(&region_lock);
+    void* mem = map_pages(size, align, 0);
+    pthread_mutex_unlock(&region_lock);
+    return mem;
+}
+
+void region_unmap_pool(void* mem, size_t size) {
+    pthread_mutex_lock(&region_lock);
+    unmap_pages(mem, size);
+    pthread_mutex_unlock(&region_lock);
+}
+
+void region_release_all(void) {
+    pthread_mutex_lock(&region_lock);
+    for (int i = 0; i < REGION_MAX_SHARDS; i++) cursors[i] = NULL;
+    while (regions) {
+        Region* next = regions->next;
+        pagemap_clear((uintptr_t)regions->base, regions->size);
+        if (regions->sizemap) munmap(regions->sizemap, regions->size / REGION_ALIGN);
+        unmap_pages(regions->base, regions->size);
+        free(regions);
+        regions = next;
+    }
+    mapped_bytes = 0;
+#ifdef TREEALOC_COMPACT_NODES
+    window_used = 0;
+#endif
+    pthread_mutex_unlock(&region_lock);
+}
+
+int region_owns(void* ptr) {
+    Span* span = pagemap_lookup(ptr);
+    return span && span->kind == SPAN_REGION;
+}
+
+size_t region_block_size(const Span* span, const void* ptr) {
+    const Region* r = span->owner;
+    uintptr_t off = (uintptr_t)ptr - (uintptr_t)r->base;
+    if (off >= atomic_load_explicit(&r->used, memory_order_acquire) || off % REGION_ALIGN) return 0;
+    if (r->large_size) return off == 0 ? r->large_size : 0;
+    if (!r->sizemap) return REGION_SIZE_UNKNOWN;
+    uint8_t code = r->sizemap[off / REGION_ALIGN];
+    return code == REGION_SIZEMAP_BIG ? REGION_SIZE_UNKNOWN : (size_t)code * REGION_ALIGN;
+}
+
+size_t region_mapped_bytes(void) {
+    return mapped_bytes;
+}
+
+static Region* region_of(uintptr_t addr) {
+    Span* span = pagemap_lookup((void*)addr);
+    return span && span->kind == SPAN_REGION ? span->owner : NULL;
+}
+
+size_t region_release_granule(uintptr_t addr) {
+    Region* r = region_of(addr);
+    // Частичный возврат разбил бы большую страницу (а для hugetlb и вовсе невозможен)
+    if (r && r->huge != REGION_HUGE_OFF) return REGION_HUGE_PAGE;
+    return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+// Для THP покрытие известно только ядру: берётся AnonHugePages из /proc/self/smaps
+// пропорционально пересечению каждого VMA с нашими областями
+size_t region_huge_backed_bytes(void) {
+    size_t total = 0;
+    pthread_mutex_lock(&region_lock);
+    for (Region* r = regions; r; r = r->next) {
+        if (r->huge == REGION_HUGE_HUGETLB) total += r->size;
+    }
+    FILE* smaps = huge_mode == REGION_HUGE_OFF ? NULL : fopen("/proc/self/smaps", "r");
+    if (!smaps) {
+        pthread_mutex_unlock(&region_lock);
+        return total;
+    }
+    char line[256];
+    uintptr_t vma_lo = 0, vma_hi = 0;
+    size_t overlap = 0;
+    while (fgets(line, sizeof(line), smaps)) {
+        unsigned long lo, hi, kb;
+        if (sscanf(line, "%lx-%lx ", &lo, &hi) == 2 && strchr(line, '-') < strchr(line, ' ')) {
+            vma_lo = lo;
+            vma_hi = hi;
+            overlap = 0;
+            for (Region* r = regions; r; r = r->next) {
+                if (r->huge != REGION_HUGE_THP) continue;
+                uintptr_t a = (uintptr_t)r->base > vma_lo ? (uintptr_t)r->base : vma_lo;
+                uintptr_t b = (uintptr_t)r->base + r->size < vma_hi ? (uintptr_t)r->base + r->size : vma_hi;
+                if (b > a) overlap += b - a;
+            }
+        } else if (overlap && sscanf(line, "AnonHugePages: %lu kB", &kb) == 1) {
+            total += (size_t)((double)kb * 1024.0 * overlap / (double)(vma_hi - vma_lo));
+        }
+    }
+    fclose(smaps);
+    pthread_mutex_unlock(&region_lock);
+    return total;
+}
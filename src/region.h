@@ -0,0 +1,65 @@
+#ifndef REGION_H
+#define REGION_H
+
+#include "pagemap.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Области памяти, полученные от ядра через mmap. Новые блоки нарезаются из
+// текущей области последовательно; крупные запросы получают отдельное отображение.
+// Памятью блоков владеют области, B-дерево только индексирует её.
+//
+// В режиме больших страниц области выравниваются по 2 МБ и помечаются
+// MADV_HUGEPAGE (или берутся из hugetlbfs через MAP_HUGETLB). Последовательная
+// нарезка держит большие страницы плотно занятыми.
+
+#define REGION_CHUNK (1 << 20)
+#define REGION_ALIGN 16
+#define REGION_LARGE (REGION_CHUNK / 4)
+
+#define REGION_HUGE_PAGE (2u << 20)
+#define REGION_HUGE_CHUNK (4 * REGION_HUGE_PAGE)
+#define REGION_HUGE_LARGE REGION_HUGE_PAGE
+
+#define REGION_SIZEMAP_BIG 255           // Блок от 255 гранул: размер только в B-дереве
+#define REGION_SIZE_UNKNOWN ((size_t)-1)
+
+enum {
+    REGION_HUGE_OFF = 0,
+    REGION_HUGE_THP,     // Прозрачные большие страницы: выравнивание + MADV_HUGEPAGE
+    REGION_HUGE_HUGETLB  // MAP_HUGETLB, при неудаче - THP
+};
+
+#define REGION_MAX_SHARDS 64
+
+#ifdef TREEALOC_COMPACT_NODES
+// Компактные узлы B-дерева хранят смещение блока от базы окна в 32-битных гранулах,
+// поэтому все области нарезаются из одного заранее зарезервированного окна адресов
+// (PROT_NONE, без памяти). Если 64 ГБ зарезервировать нельзя, окно уменьшается вдвое.
+#define REGION_WINDOW_MAX ((size_t)REGION_ALIGN << 32)
+#define REGION_WINDOW_MIN ((size_t)1 << 30)
+extern uintptr_t region_window_base;
+extern size_t region_window_bytes; // 0 - окно ещё не зарезервировано
+#endif
+
+void* region_alloc(size_t size);                 // Для основного дерева (шард 0)
+void* region_alloc_shard(int shard, size_t size); // Под блокировкой шарда
+void* region_alloc_aligned(int shard, size_t size, size_t align); // align - степень двойки до страницы
+int region_shard(const Span* span);
+void region_release_all(void);
+// Память пулов TLSF и близнецов (align - степень двойки). В компактной сборке берётся
+// из окна областей, чтобы пулы попадали в B-дерево; освобождается до region_release_all.
+void* region_map_pool(size_t size, size_t align);
+void region_unmap_pool(void* mem, size_t size);
+int region_owns(void* ptr);
+// Размер блока, начинающегося с ptr, по карте размеров области span;
+// 0 - ptr не начало блока, REGION_SIZE_UNKNOWN - блок слишком велик для карты
+size_t region_block_size(const Span* span, const void* ptr);
+size_t region_mapped_bytes(void);
+
+void region_set_huge_mode(int mode);
+int region_huge_mode(void);
+size_t region_release_granule(uintptr_t addr); // Минимальная единица возврата памяти ядру
+size_t region_huge_backed_bytes(void);        // Байты областей, реально покрытые большими страницами
+
+#endif
@@ -0,0 +1,23 @@
+#include "remotefree.h"
+
+void remote_push(RemoteQueue* queue, void* ptr) {
+    RemoteNode* node = ptr;
+    RemoteNode* old = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    do {
+        node->next = old;
+    } while (!atomic_compare_exchange_weak_explicit(&queue->head, &old, node, memory_order_release, memory_order_relaxed));
+}
+
+// Забирается весь список сразу: узлы обратно в очередь не попадают, поэтому ABA невозможна
+size_t remote_drain(RemoteQueue* queue, void (*release)(void* ptr)) {
+    if (!remote_pending(queue)) return 0;
+    RemoteNode* node = atomic_exchange_explicit(&queue->head, NULL, memory_order_acquire);
+    size_t count = 0;
+    while (node) {
+        RemoteNode* next = node->next;
+        release(node);
+        node = next;
+        count++;
+    }
+    return count;
+}
@@ -0,0 +1,31 @@
+#ifndef REMOTEFREE_H
+#define REMOTEFREE_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+// Очередь освобождений для кучи, занятой другим потоком. Освобождающий поток
+// не ждёт блокировку владельца: блок кладётся в стек без блокировок (ссылка
+// пишется в первые байты самого блока), а владелец, получив блокировку,
+// забирает весь накопленный список одним обменом и освобождает пачкой.
+// Производителей много, потребитель один - тот, кто держит блокировку кучи.
+
+typedef struct RemoteNode {
+    struct RemoteNode* next;
+} RemoteNode;
+
+typedef struct {
+    _Atomic(RemoteNode*) head;
+} RemoteQueue;
+
+#define REMOTE_QUEUE_INIT {NULL}
+
+void remote_push(RemoteQueue* queue, void* ptr);
+// Под блокировкой владельца; возвращает число освобождённых блоков
+size_t remote_drain(RemoteQueue* queue, void (*release)(void* ptr));
+
+static inline int remote_pending(RemoteQueue* queue) {
+    return atomic_load_explicit(&queue->head, memory_order_relaxed) != NULL;
+}
+
+#endif
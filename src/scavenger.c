@@ -0,0 +1,207 @@
+#include "scavenger.h"
+#include "b_tree.h"
+#include "region.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+typedef struct {
+    uintptr_t lo;
+    uintptr_t hi;
+} ReleasedRange;
+
+// Отсортированный список непересекающихся диапазонов, отданных ядру. Свой у каждой
+// кучи: шарды обновляют его под своей блокировкой, и только сумма читается снаружи.
+typedef struct {
+    ReleasedRange* spans;
+    size_t span_count;
+    size_t span_cap;
+    _Atomic size_t released_bytes;
+} ReleasedSet;
+
+static ReleasedSet heaps[REGION_MAX_SHARDS];
+
+typedef struct {
+    ReleasedSet* set;
+    uintptr_t run_lo;   // Текущая серия соседних свободных блоков
+    uintptr_t run_hi;
+    size_t budget;
+    size_t released;
+} TrimState;
+
+// Индекс первого диапазона, заканчивающегося правее addr
+static size_t span_search(const ReleasedSet* s, uintptr_t addr) {
+    size_t lo = 0, hi = s->span_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (s->spans[mid].hi <= addr) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static size_t span_covered(const ReleasedSet* s, uintptr_t lo, uintptr_t hi) {
+    size_t covered = 0;
+    for (size_t i = span_search(s, lo); i < s->span_count && s->spans[i].lo < hi; i++) {
+        uintptr_t a = s->spans[i].lo > lo ? s->spans[i].lo : lo;
+        uintptr_t b = s->spans[i].hi < hi ? s->spans[i].hi : hi;
+        covered += b - a;
+    }
+    return covered;
+}
+
+static int span_reserve(ReleasedSet* s, size_t need) {
+    if (need <= s->span_cap) return 0;
+    size_t cap = s->span_cap ? s->span_cap * 2 : 64;
+    while (cap < need) cap *= 2;
+    ReleasedRange* grown = realloc(s->spans, cap * sizeof(ReleasedRange));
+    if (!grown) return -1;
+    s->spans = grown;
+    s->span_cap = cap;
+    return 0;
+}
+
+// Добавляет [lo, hi), сливая с пересекающимися и смежными диапазонами
+static void span_add(ReleasedSet* s, uintptr_t lo, uintptr_t hi) {
+    ReleasedRange* spans = s->spans;
+    size_t first = span_search(s, lo > 0 ? lo - 1 : 0);
+    size_t last = first;
+    while (last < s->span_count && spans[last].lo <= hi) {
+        if (spans[last].lo < lo) lo = spans[last].lo;
+        if (spans[last].hi > hi) hi = spans[last].hi;
+        last++;
+    }
+    if (last == first) {
+        if (span_reserve(s, s->span_count + 1) != 0) return;
+        spans = s->spans;
+        memmove(&spans[first + 1], &spans[first], (s->span_count - first) * sizeof(ReleasedRange));
+        s->span_count++;
+    } else {
+        memmove(&spans[first + 1], &spans[last], (s->span_count - last) * sizeof(ReleasedRange));
+        s->span_count -= last - first - 1;
+    }
+    spans[first].lo = lo;
+    spans[first].hi = hi;
+}
+
+static void span_remove(ReleasedSet* s, uintptr_t lo, uintptr_t hi) {
+    size_t i = span_search(s, lo);
+    while (i < s->span_count && s->spans[i].lo < hi) {
+        ReleasedRange r = s->spans[i];
+        if (r.lo < lo && r.hi > hi) {
+            // Диапазон разрезается на две части
+            if (span_reserve(s, s->span_count + 1) != 0) return;
+            memmove(&s->spans[i + 2], &s->spans[i + 1], (s->span_count - i - 1) * sizeof(ReleasedRange));
+            s->span_count++;
+            s->spans[i].hi = lo;
+            s->spans[i + 1].lo = hi;
+            s->spans[i + 1].hi = r.hi;
+            s->released_bytes -= hi - lo;
+            return;
+        }
+        uintptr_t a = r.lo > lo ? r.lo : lo;
+        uintptr_t b = r.hi < hi ? r.hi : hi;
+        s->released_bytes -= b - a;
+        if (r.lo < lo) {
+            s->spans[i].hi = lo;
+            i++;
+        } else if (r.hi > hi) {
+            s->spans[i].lo = hi;
+            i++;
+        } else {
+            memmove(&s->spans[i], &s->spans[i + 1], (s->span_count - i - 1) * sizeof(ReleasedRange));
+            s->span_count--;
+        }
+    }
+}
+
+static void flush_run(TrimState* st) {
+    if (st->run_hi <= st->run_lo) return;
+    uintptr_t granule = region_release_granule(st->run_lo);
+    uintptr_t tail_granule = region_release_granule(st->run_hi - 1);
+    if (tail_granule > granule) granule = tail_granule;
+    uintptr_t lo = (st->run_lo + granule - 1) & ~(granule - 1);
+    uintptr_t hi = st->run_hi & ~(granule - 1);
+    st->run_lo = st->run_hi = 0;
+    if (hi <= lo || st->released >= st->budget) return;
+    // Уже отданное начало серии пропускаем, а остальное режем по остатку бюджета:
+    // иначе длинная серия выходит за бюджет, а следующий проход стоит на месте
+    for (size_t i = span_search(st->set, lo); i < st->set->span_count && st->set->spans[i].lo <= lo; i++) {
+        lo = (st->set->spans[i].hi + granule - 1) & ~(granule - 1);
+    }
+    if (hi <= lo) return;
+    size_t left = (st->budget - st->released) & ~(granule - 1);
+    if (hi - lo > left) hi = lo + left;
+    if (hi <= lo) return;
+
+    size_t fresh = (hi - lo) - span_covered(st->set, lo, hi);
+    if (!fresh) return;
+    if (madvise((void*)lo, hi - lo, MADV_DONTNEED) != 0) {
+        perror("[scavenger] madvise");
+        return;
+    }
+    span_add(st->set, lo, hi);
+    st->set->released_bytes += fresh;
+    st->released += fresh;
+}
+
+static void trim_cb(void* block, size_t size, int is_free, void* ctx) {
+    TrimState* st = ctx;
+    uintptr_t addr = (uintptr_t)block;
+    if (!is_free) {
+        flush_run(st);
+        return;
+    }
+    if (st->run_hi == addr && st->run_hi) {
+        st->run_hi += size;
+        return;
+    }
+    flush_run(st);
+    st->run_lo = addr;
+    st->run_hi = addr + size;
+}
+
+size_t scavenger_trim(int heap, size_t budget) {
+    TrimState st = {&heaps[heap], 0, 0, budget, 0};
+    btree_walk(trim_cb, &st);
+    flush_run(&st);
+    if (st.released) {
+        printf("[scavenger] Released %zu bytes of heap %d to the kernel (%zu total)\n", st.released, heap, scavenger_released_bytes());
+    }
+    return st.released;
+}
+
+void scavenger_claim(int heap, void* ptr, size_t size, uintptr_t* zero_lo, uintptr_t* zero_hi) {
+    ReleasedSet* s = &heaps[heap];
+    uintptr_t lo = (uintptr_t)ptr;
+    uintptr_t hi = lo + size;
+    *zero_lo = *zero_hi = lo;
+    if (!s->span_count) return;
+    for (size_t i = span_search(s, lo); i < s->span_count && s->spans[i].lo < hi; i++) {
+        uintptr_t a = s->spans[i].lo > lo ? s->spans[i].lo : lo;
+        uintptr_t b = s->spans[i].hi < hi ? s->spans[i].hi : hi;
+        if (b - a > *zero_hi - *zero_lo) {
+            *zero_lo = a;
+            *zero_hi = b;
+        }
+    }
+    span_remove(s, lo, hi);
+}
+
+void scavenger_reset(void) {
+    for (int i = 0; i < REGION_MAX_SHARDS; i++) {
+        free(heaps[i].spans);
+        heaps[i].spans = NULL;
+        heaps[i].span_count = heaps[i].span_cap = 0;
+        heaps[i].released_bytes = 0;
+    }
+}
+
+size_t scavenger_released_bytes(void) {
+    size_t total = 0;
+    for (int i = 0; i < REGION_MAX_SHARDS; i++) total += atomic_load_explicit(&heaps[i].released_bytes, memory_order_relaxed);
+    return total;
+}
@@ -0,0 +1,24 @@
+#ifndef SCAVENGER_H
+#define SCAVENGER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Возврат свободной памяти ядру. Обход дерева в порядке адресов склеивает
+// соседние свободные блоки, и целые страницы внутри получившихся диапазонов
+// отдаются через madvise. Такие страницы запоминаются: после MADV_DONTNEED
+// они читаются нулями, и повторно выданный блок не нужно обнулять.
+
+#define SCAVENGE_DEFAULT_INTERVAL_MS 1000
+#define SCAVENGE_DEFAULT_BUDGET (64u << 20) // Байт за один проход фонового потока
+
+// heap - куча: 0 - основная, 1.. - шарды (shard.c). Вызывающий держит блокировку этой кучи,
+// и её дерево выбрано потоком (btree_select)
+size_t scavenger_trim(int heap, size_t budget); // Возвращает число отданных байт
+// Блок выдан снова - его страницы больше не "отданы". В [*zero_lo, *zero_hi)
+// возвращается наибольший участок блока, который гарантированно читается нулями.
+void scavenger_claim(int heap, void* ptr, size_t size, uintptr_t* zero_lo, uintptr_t* zero_hi);
+void scavenger_reset(void);             // Под блокировкой аллокатора при пустых кучах
+size_t scavenger_released_bytes(void);  // Сумма по всем кучам, без блокировок
+
+#endif
@@ -0,0 +1,230 @@
+#include "shard.h"
+#include "pagemap.h"
+#include "cpucache.h"
+#include "remotefree.h"
+#include "scavenger.h"
+#include "telemetry.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef struct {
+    pthread_mutex_t lock;   // У шарда 0 не используется: его защищает блокировка аллокатора
+    BNode* root;
+    RemoteQueue remote;
+    ShardStats stats;       // Под блокировкой шарда
+    _Atomic uint64_t contended;
+    _Atomic uint64_t remote_frees;
+} __attribute__((aligned(64))) Shard;
+
+static Shard shards[SHARD_MAX];
+static int initialized = 0;
+static _Atomic unsigned active_count = 1;
+static int assign_policy = SHARD_ROUND_ROBIN;
+static _Atomic unsigned next_ticket;
+
+static __thread int ticket = -1;
+static __thread int current; // Шард, чьё дерево сейчас выбрано потоком
+
+// Наблюдатель за всеми деревьями: событие относится к шарду, выбранному потоком
+static void on_event(const BTreeEvent* ev, void* ctx) {
+    (void)ctx;
+    ShardStats* s = &shards[current].stats;
+    switch (ev->type) {
+        case BTREE_EV_INSERT:
+            s->allocs++;
+            s->blocks++;
+            s->bytes_in_use += ev->size;
+            break;
+        case BTREE_EV_REUSE:
+            s->allocs++;
+            s->reuse_hits++;
+            s->free_retained -= ev->size;
+            s->bytes_in_use += ev->size;
+            break;
+        case BTREE_EV_RELEASE:
+            s->frees++;
+            s->bytes_in_use -= ev->size;
+            s->free_retained += ev->size;
+            break;
+        case BTREE_EV_REMOVE:
+            s->blocks--;
+            if (ev->is_free) s->free_retained -= ev->size;
+            else s->bytes_in_use -= ev->size;
+            break;
+        case BTREE_EV_RESIZE:
+            if (ev->is_free) s->free_retained += ev->size - ev->old_size;
+            else s->bytes_in_use += ev->size - ev->old_size;
+            break;
+        case BTREE_EV_CLEAR:
+            s->blocks = 0;
+            s->bytes_in_use = 0;
+            s->free_retained = 0;
+            break;
+    }
+}
+
+void shard_init(void) {
+    if (initialized) return;
+    for (int i = 0; i < SHARD_MAX; i++) pthread_mutex_init(&shards[i].lock, NULL);
+    btree_add_concurrent_listener(on_event, NULL);
+    initialized = 1;
+}
+
+void shard_configure(unsigned count, int policy) {
+    if (count < 1) count = 1;
+    if (count > SHARD_MAX) count = SHARD_MAX;
+    assign_policy = policy;
+    atomic_store(&active_count, count);
+    printf("[shard] %u heap shard(s), %s assignment\n", count, policy == SHARD_HASH ? "hashed" : "round-robin");
+}
+
+unsigned shard_count(void) {
+    return atomic_load_explicit(&active_count, memory_order_relaxed);
+}
+
+int shard_for_thread(void) {
+    unsigned count = shard_count();
+    if (count <= 1) return 0;
+    if (ticket < 0) {
+        if (assign_policy == SHARD_HASH) {
+            uint64_t h = (uint64_t)(uintptr_t)pthread_self() * 0x9E3779B97F4A7C15ull;
+            ticket = (int)(h >> 33);
+        } else {
+            ticket = (int)(atomic_fetch_add(&next_ticket, 1) & 0x7fffffff);
+        }
+    }
+    return ticket % count;
+}
+
+static void release_in_shard(void* ptr) {
+    btree_mark_free(ptr);
+}
+
+// Блокировка захвачена: выбираем дерево шарда и забираем отложенные освобождения
+static void enter(int i) {
+    btree_select(&shards[i].root);
+    current = i;
+    remote_drain(&shards[i].remote, release_in_shard);
+}
+
+static void lock_shard(int i) {
+    if (pthread_mutex_trylock(&shards[i].lock) != 0) {
+        atomic_fetch_add_explicit(&shards[i].contended, 1, memory_order_relaxed);
+        pthread_mutex_lock(&shards[i].lock);
+    }
+    enter(i);
+}
+
+static void unlock_shard(int i) {
+    btree_select(NULL);
+    current = 0;
+    pthread_mutex_unlock(&shards[i].lock);
+}
+
+// Отладочный вывод на каждую операцию здесь не печатается: он сериализовал бы потоки на stdout
+void* shard_alloc(int i, size_t size, size_t align, uintptr_t* zero_lo, uintptr_t* zero_hi) {
+    size_t block_size = (size + align - 1) & ~(align - 1);
+    if (!block_size) block_size = align;
+    lock_shard(i);
+    void* ptr = align > REGION_ALIGN ? btree_find_best_fit_aligned(block_size, align) : btree_find_best_fit(block_size);
+    if (ptr) {
+        scavenger_claim(i, ptr, btree_block_size(ptr), zero_lo, zero_hi); // Вся ёмкость, как в основной куче
+        cpucache_unmark(ptr);
+        TELEMETRY_INC(reuse_hits);
+    } else {
+        TELEMETRY_INC(reuse_misses);
+        ptr = region_alloc_aligned(i, block_size, align);
+        if (ptr) btree_insert(block_size, ptr);
+        // Свежая память области ещё не выдавалась и читается нулями
+        *zero_lo = (uintptr_t)ptr;
+        *zero_hi = ptr ? (uintptr_t)ptr + block_size : (uintptr_t)ptr;
+    }
+    unlock_shard(i);
+    return ptr;
+}
+
+void shard_free(int i, void* ptr, int defer) {
+    Shard* s = &shards[i];
+    if (pthread_mutex_trylock(&s->lock) != 0) {
+        atomic_fetch_add_explicit(&s->contended, 1, memory_order_relaxed);
+        // Как в free_or_defer: ссылка очереди пишется в сам блок, поэтому в очередь
+        // идут только выровненные начала блоков, остальное проверяется под блокировкой
+        if (defer && !((uintptr_t)ptr & (sizeof(void*) - 1)) && region_block_size(pagemap_lookup(ptr), ptr)) {
+            remote_push(&s->remote, ptr);
+            atomic_fetch_add_explicit(&s->remote_frees, 1, memory_order_relaxed);
+            return;
+        }
+        pthread_mutex_lock(&s->lock);
+    }
+    enter(i);
+    if (!btree_mark_free(ptr)) printf("[shard] free(%p): not a live block of shard %d\n", ptr, i);
+    unlock_shard(i);
+}
+
+size_t shard_usable_size(int i, void* ptr) {
+    lock_shard(i);
+    int index;
+    BNode* node = find_node(shards[i].root, ptr, &index);
+    size_t size = node && !bnode_is_free(node, index) ? bnode_size(node, index) : 0;
+    unlock_shard(i);
+    return size;
+}
+
+void shard_stats(int i, ShardStats* out) {
+    if (i == 0) {
+        *out = shards[0].stats;
+        out->height = btree_height();
+    } else {
+        lock_shard(i);
+        *out = shards[i].stats;
+        out->height = btree_height();
+        unlock_shard(i);
+    }
+    out->contended = atomic_load(&shards[i].contended);
+    out->remote_frees = atomic_load(&shards[i].remote_frees);
+}
+
+void shard_debug(void) {
+    for (int i = 1; i < SHARD_MAX; i++) {
+        if (!shards[i].root) continue;
+        lock_shard(i);
+        printf("[shard] Shard %d:\n", i);
+        btree_debug();
+        unlock_shard(i);
+    }
+}
+
+void shard_walk(void* start, void* end, btree_walk_fn fn, void* ctx) {
+    for (int i = 1; i < SHARD_MAX; i++) {
+        if (!shards[i].root) continue;
+        lock_shard(i);
+        btree_walk_range(start, end, fn, ctx);
+        unlock_shard(i);
+    }
+}
+
+size_t shard_trim(size_t budget) {
+    size_t released = 0;
+    for (int i = 1; i < SHARD_MAX && released < budget; i++) {
+        if (!shards[i].root) continue;
+        lock_shard(i);
+        released += scavenger_trim(i, budget - released);
+        unlock_shard(i);
+    }
+    return released;
+}
+
+void shard_cleanup(void) {
+    for (int i = 1; i < SHARD_MAX; i++) {
+        lock_shard(i);
+        if (shards[i].root) btree_cleanup();
+        unlock_shard(i);
+    }
+    for (int i = 0; i < SHARD_MAX; i++) {
+        memset(&shards[i].stats, 0, sizeof(ShardStats));
+        atomic_store(&shards[i].contended, 0);
+        atomic_store(&shards[i].remote_frees, 0);
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include "b_tree.h"
+#include "region.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Независимые кучи движка best-fit. У каждого шарда своё B-дерево, свои
+// области для нарезки, своя блокировка и очередь отложенных освобождений,
+// поэтому потоки разных шардов не мешают друг другу. Шард 0 - основная куча
+// (дерево root под блокировкой аллокатора со всеми остальными механизмами);
+// этот модуль ведёт шарды 1..N-1 и статистику всех шардов.
+// Поток закрепляется за шардом при первом выделении: по кругу или по хешу
+// идентификатора потока. Владелец блока определяется по области, которой он принадлежит.
+
+#define SHARD_MAX REGION_MAX_SHARDS
+
+enum {
+    SHARD_ROUND_ROBIN = 0,
+    SHARD_HASH
+};
+
+typedef struct {
+    uint64_t allocs;       // Выдачи из дерева: новые блоки и повторно выданные
+    uint64_t reuse_hits;
+    uint64_t frees;
+    uint64_t blocks;       // Записей в дереве
+    uint64_t bytes_in_use;
+    uint64_t free_retained;
+    uint64_t contended;    // Сколько раз блокировка шарда оказалась занята
+    uint64_t remote_frees; // Освобождений через очередь
+    int height;
+} ShardStats;
+
+void shard_init(void);
+void shard_configure(unsigned count, int policy);
+unsigned shard_count(void);
+int shard_for_thread(void);
+
+// Без внешних блокировок; шард >= 1
+// align - REGION_ALIGN или строка кэша; [*zero_lo, *zero_hi) - заведомо нулевой участок, как у alloc_locked
+void* shard_alloc(int shard, size_t size, size_t align, uintptr_t* zero_lo, uintptr_t* zero_hi);
+void shard_free(int shard, void* ptr, int defer); // defer - при занятой блокировке в очередь
+size_t shard_usable_size(int shard, void* ptr);   // По дереву шарда; 0 - не занятый блок
+
+// Статистика шарда 0 читается под блокировкой аллокатора, остальных - под своей
+void shard_stats(int shard, ShardStats* out);
+void shard_debug(void);   // Деревья шардов 1..N-1
+void shard_walk(void* start, void* end, btree_walk_fn fn, void* ctx); // Блоки шардов 1..N-1, каждый под своей блокировкой
+size_t shard_trim(size_t budget); // Возврат свободных страниц шардов 1..N-1 ядру, каждый под своей блокировкой
+void shard_cleanup(void); // Под блокировкой аллокатора, до region_release_all
+
+#endif
@@ -0,0 +1,78 @@
+#include "sizecache.h"
+#include <stdint.h>
+
+// Следующий указатель хранится в первых байтах самого свободного блока, за ним - метка
+typedef struct CachedBlock {
+    struct CachedBlock* next;
+    uintptr_t mark; // key() ^ размер, с которым блок положен в кэш
+} CachedBlock;
+
+static CachedBlock* heads[SIZECACHE_CLASSES];
+static int counts[SIZECACHE_CLASSES];
+
+// Секрет меток зависит от адреса модуля (ASLR), чтобы данные программы случайно с ним не совпадали
+static uintptr_t key(void) {
+    return (uintptr_t)heads ^ (uintptr_t)0x9e3779b97f4a7c15ull;
+}
+
+static int class_of(size_t size) {
+    size_t cls = size / SIZECACHE_GRANULE - 1;
+    return size && cls < SIZECACHE_CLASSES ? (int)cls : -1;
+}
+
+int sizecache_push(void* ptr, size_t size) {
+    int cls = class_of(size);
+    if (cls < 0 || counts[cls] >= SIZECACHE_DEPTH) return 0;
+    CachedBlock* block = ptr;
+    block->next = heads[cls];
+    block->mark = key() ^ size;
+    heads[cls] = block;
+    counts[cls]++;
+    return 1;
+}
+
+void* sizecache_pop(size_t size) {
+    int cls = class_of(size);
+    if (cls < 0 || !heads[cls]) return NULL;
+    CachedBlock* block = heads[cls];
+    heads[cls] = block->next;
+    counts[cls]--;
+    block->mark = 0;
+    return block;
+}
+
+size_t sizecache_marked(const void* ptr) {
+    size_t size = ((const CachedBlock*)ptr)->mark ^ key();
+    return class_of(size) >= 0 && size % SIZECACHE_GRANULE == 0 ? size : 0;
+}
+
+void sizecache_unmark(void* ptr) {
+    if (sizecache_marked(ptr)) ((CachedBlock*)ptr)->mark = 0;
+}
+
+int sizecache_contains(const void* ptr, size_t size) {
+    int cls = class_of(size);
+    if (cls < 0) return 0;
+    for (const CachedBlock* block = heads[cls]; block; block = block->next) {
+        if (block == ptr) return 1;
+    }
+    return 0;
+}
+
+void sizecache_drain(void (*release)(void* ptr)) {
+    for (int cls = 0; cls < SIZECACHE_CLASSES; cls++) {
+        while (heads[cls]) {
+            CachedBlock* block = heads[cls];
+            heads[cls] = block->next;
+            release(block);
+        }
+        counts[cls] = 0;
+    }
+}
+
+void sizecache_reset(void) {
+    for (int cls = 0; cls < SIZECACHE_CLASSES; cls++) {
+        heads[cls] = NULL;
+        counts[cls] = 0;
+    }
+}
@@ -0,0 +1,26 @@
+#ifndef SIZECACHE_H
+#define SIZECACHE_H
+
+#include <stddef.h>
+
+// Кэш блоков, освобождённых через treealoc_free_sized. Размер известен заранее,
+// поэтому блок кладётся в стек своего класса без спуска по B-дереву, а malloc
+// того же размера забирает его оттуда. Для дерева такие блоки остаются занятыми,
+// пока кэш не будет слит (trim, сборщик, отладочный вывод).
+
+#define SIZECACHE_GRANULE 16
+#define SIZECACHE_CLASSES 64  // Классы 16, 32, ..., 1024 байт
+#define SIZECACHE_DEPTH 64    // Блоков на класс; лишние освобождаются обычным путём
+
+// Вызывающий держит блокировку аллокатора; size уже округлён до SIZECACHE_GRANULE
+int sizecache_push(void* ptr, size_t size);   // 0, если класса нет или он заполнен
+void* sizecache_pop(size_t size);
+// Метка остаётся на блоке и после слива в дерево, пока блок не выдан из кэша или не перезаписан:
+// размер, с которым ptr положен в кэш, или 0. Совпадение - повод проверить блок, а не ошибка.
+size_t sizecache_marked(const void* ptr);
+int sizecache_contains(const void* ptr, size_t size); // Просмотр стека одного класса
+void sizecache_unmark(void* ptr);                     // Блок снова выдан из дерева
+void sizecache_drain(void (*release)(void* ptr));
+void sizecache_reset(void);                   // Забыть блоки (области уже возвращены)
+
+#endif
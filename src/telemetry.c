@@ -0,0 +1,129 @@
+#include "telemetry.h"
+#include "b_tree.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+// Пока сегмент не создан, счётчики пишутся в локальную страницу - без проверок на горячем пути
+static TelemetryPage local_page;
+TelemetryPage* telemetry = &local_page;
+
+static char shm_name[64];
+static int registered = 0;
+static BNode* last_root = NULL;
+
+static void on_event(const BTreeEvent* ev, void* ctx) {
+    (void)ctx;
+    switch (ev->type) {
+        case BTREE_EV_INSERT:
+            if (ev->is_free) TELEMETRY_ADD(free_retained, ev->size);
+            else TELEMETRY_ADD(bytes_in_use, ev->size);
+            break;
+        case BTREE_EV_REMOVE:
+            if (ev->is_free) TELEMETRY_SUB(free_retained, ev->size);
+            else TELEMETRY_SUB(bytes_in_use, ev->size);
+            break;
+        case BTREE_EV_REUSE:
+            TELEMETRY_SUB(free_retained, ev->size);
+            TELEMETRY_ADD(bytes_in_use, ev->size);
+            break;
+        case BTREE_EV_RELEASE:
+            TELEMETRY_SUB(bytes_in_use, ev->size);
+            TELEMETRY_ADD(free_retained, ev->size);
+            break;
+        case BTREE_EV_RESIZE:
+            if (ev->is_free) {
+                TELEMETRY_SUB(free_retained, ev->old_size);
+                TELEMETRY_ADD(free_retained, ev->size);
+            } else {
+                TELEMETRY_SUB(bytes_in_use, ev->old_size);
+                TELEMETRY_ADD(bytes_in_use, ev->size);
+            }
+            break;
+        case BTREE_EV_CLEAR:
+            atomic_store_explicit(&telemetry->bytes_in_use, 0, memory_order_relaxed);
+            atomic_store_explicit(&telemetry->free_retained, 0, memory_order_relaxed);
+            break;
+    }
+    // Высота меняется только вместе с корнем; публикуется высота основного дерева
+    if (btree_main_selected() && root != last_root) {
+        last_root = root;
+        atomic_store_explicit(&telemetry->tree_height, (uint64_t)btree_height(), memory_order_relaxed);
+    }
+}
+
+void telemetry_init(void) {
+    if (!registered) {
+        btree_add_concurrent_listener(on_event, NULL);
+        registered = 1;
+    }
+    const char* env = getenv("TREEALOC_TELEMETRY");
+    if ((env && strcmp(env, "0") == 0) || telemetry != &local_page) return;
+
+    snprintf(shm_name, sizeof(shm_name), TELEMETRY_NAME_FMT, (int)getpid());
+    int fd = shm_open(shm_name, O_CREAT | O_RDWR | O_TRUNC, 0600);
+    if (fd < 0) {
+        perror("[telemetry] shm_open");
+        shm_name[0] = '\0';
+        return;
+    }
+    if (ftruncate(fd, sizeof(TelemetryPage)) != 0) {
+        perror("[telemetry] ftruncate");
+        close(fd);
+        shm_unlink(shm_name);
+        shm_name[0] = '\0';
+        return;
+    }
+    TelemetryPage* page = mmap(NULL, sizeof(TelemetryPage), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (page == MAP_FAILED) {
+        perror("[telemetry] mmap");
+        shm_unlink(shm_name);
+        shm_name[0] = '\0';
+        return;
+    }
+
+    // Переносим то, что успели насчитать до создания сегмента
+    memcpy(page, &local_page, sizeof(TelemetryPage));
+    page->version = TELEMETRY_VERSION;
+    page->pid = (int32_t)getpid();
+    env = getenv("TREEALOC_TELEMETRY_LATENCY");
+    page->latency_enabled = env && strcmp(env, "1") == 0;
+    atomic_thread_fence(memory_order_release);
+    page->magic = TELEMETRY_MAGIC;
+    telemetry = page;
+
+    atexit(telemetry_shutdown);
+    printf("[telemetry] Publishing counters in /dev/shm%s\n", shm_name);
+}
+
+void telemetry_shutdown(void) {
+    if (telemetry == &local_page) return;
+    TelemetryPage* page = telemetry;
+    memcpy(&local_page, page, sizeof(TelemetryPage));
+    telemetry = &local_page;
+    munmap(page, sizeof(TelemetryPage));
+    if (shm_name[0]) {
+        shm_unlink(shm_name);
+        shm_name[0] = '\0';
+    }
+}
+
+uint64_t telemetry_now_ns(void) {
+    if (!telemetry->latency_enabled) return 0;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void telemetry_record_latency(uint64_t start_ns) {
+    if (!start_ns) return;
+    uint64_t delta = telemetry_now_ns() - start_ns;
+    int bucket = delta ? 63 - __builtin_clzll(delta) : 0;
+    if (bucket >= TELEMETRY_LAT_BUCKETS) bucket = TELEMETRY_LAT_BUCKETS - 1;
+    TELEMETRY_INC(latency[bucket]);
+}
@@ -0,0 +1,49 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Счётчики аллокатора в разделяемой памяти /dev/shm/treealoc.<pid>.
+// Пишущие потоки выполняют только relaxed-инкременты; читатель (treealoc-top)
+// сам считает скорости по разнице значений между опросами.
+
+#define TELEMETRY_MAGIC 0x544C4F43u // "TLOC"
+#define TELEMETRY_VERSION 4
+#define TELEMETRY_LAT_BUCKETS 32    // Корзина i: задержка в [2^i, 2^(i+1)) нс
+#define TELEMETRY_NAME_FMT "/treealoc.%d"
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    int32_t pid;
+    uint32_t latency_enabled;
+    _Atomic uint64_t allocs;
+    _Atomic uint64_t frees;
+    _Atomic uint64_t reallocs;
+    _Atomic uint64_t callocs;
+    _Atomic uint64_t bytes_in_use;   // Байты в занятых блоках дерева
+    _Atomic uint64_t free_retained;  // Байты в свободных блоках, удерживаемых деревом
+    _Atomic uint64_t reuse_hits;     // btree_find_best_fit нашёл блок
+    _Atomic uint64_t reuse_misses;   // Пришлось брать новую память
+    _Atomic uint64_t tree_height;
+    _Atomic uint64_t latency[TELEMETRY_LAT_BUCKETS];
+    _Atomic uint64_t released_to_os; // Байты свободных блоков, отданные ядру через madvise
+    _Atomic uint64_t calloc_zero_skipped; // Байты calloc, не обнулявшиеся: память уже нулевая
+    _Atomic uint64_t mapped_bytes;      // Байты областей, полученных через mmap
+    _Atomic uint64_t huge_backed_bytes; // Из них покрыто большими страницами (по smaps)
+} TelemetryPage;
+
+extern TelemetryPage* telemetry;
+
+#define TELEMETRY_INC(field) atomic_fetch_add_explicit(&telemetry->field, 1, memory_order_relaxed)
+#define TELEMETRY_ADD(field, v) atomic_fetch_add_explicit(&telemetry->field, (uint64_t)(v), memory_order_relaxed)
+#define TELEMETRY_SUB(field, v) atomic_fetch_sub_explicit(&telemetry->field, (uint64_t)(v), memory_order_relaxed)
+
+void telemetry_init(void);
+void telemetry_shutdown(void);
+uint64_t telemetry_now_ns(void);            // 0, если замер задержек выключен
+void telemetry_record_latency(uint64_t start_ns);
+
+#endif
@@ -2,9 +2,18 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <sched.h>
 #include <string.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <time.h>
 #include "Lib.h"
 #include "visual.h"
+#include "b_tree.h"
+#include "guard.h"
 
 extern void* __real_malloc(size_t size);
 extern void __real_free(void* ptr);
@@ -142,6 +151,764 @@ void test_edge_cases() {
     sleep(1);
 }
 
+void test_persistent_crash() {
+    printf("=== Test 8: Persistent heap crash consistency ===\n");
+    const char* path = "/tmp/treealoc_test.heap";
+    int fds[2];
+    unlink(path);
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        return;
+    }
+
+    fflush(stdout); // Иначе буфер stdout продублируется в дочернем процессе
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        if (treealoc_persist_open(path, 16 << 20) != 0) _exit(1);
+        char* anchor = malloc(64);
+        strcpy(anchor, "checkpointed");
+        treealoc_persist_set_root(anchor);
+        void* filler[500];
+        for (int i = 0; i < 500; i++) filler[i] = malloc(32 + i % 64);
+        for (int i = 0; i < 500; i += 2) free(filler[i]);
+        treealoc_persist_checkpoint();
+
+        // После контрольной точки меняем существующие узлы и добавляем новые, затем "падаем"
+        free(anchor);
+        treealoc_persist_set_root(NULL);
+        for (int i = 0; i < 500; i += 2) filler[i] = malloc(32 + i % 64);
+        char* lost = malloc(4096);
+        long lost_rel = lost - anchor;
+        if (write(fds[1], &lost_rel, sizeof(lost_rel)) != sizeof(lost_rel)) _exit(1);
+        kill(getpid(), SIGKILL);
+    }
+    close(fds[1]);
+    long lost_rel = 0;
+    if (read(fds[0], &lost_rel, sizeof(lost_rel)) != sizeof(lost_rel)) lost_rel = -1;
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+
+    int ok = treealoc_persist_open(path, 0) == 0;
+    char* anchor = ok ? treealoc_persist_root() : NULL;
+    ok = ok && anchor && strcmp(anchor, "checkpointed") == 0;
+    // Блок, выделенный после контрольной точки, откатан: то же место выдаётся снова
+    char* again = ok ? malloc(4096) : NULL;
+    ok = ok && again - anchor == lost_rel;
+    // anchor снова занят, поэтому точное попадание по размеру его не вернёт
+    void* probe = ok ? malloc(64) : NULL;
+    ok = ok && probe != anchor;
+    treealoc_persist_close();
+    unlink(path);
+    printf("[TEST] Persistent heap crash consistency: %s\n", ok ? "PASS" : "FAIL");
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Нагрузка буферных пулов: размеры - степени двойки от 16 байт до 4 КБ
+static double bench_engine(int engine) {
+    enum { SLOTS = 1000, OPS = 20000 };
+    void* slots[SLOTS] = {0};
+    treealoc_set_engine(engine, 0);
+    srand(42);
+    double start = now_seconds();
+    for (int i = 0; i < OPS; i++) {
+        int s = rand() % SLOTS;
+        if (slots[s]) {
+            treealoc_free(slots[s]);
+            slots[s] = NULL;
+        } else {
+            slots[s] = treealoc_malloc((size_t)16 << (rand() % 9));
+        }
+    }
+    for (int s = 0; s < SLOTS; s++) treealoc_free(slots[s]);
+    double elapsed = now_seconds() - start;
+    treealoc_cleanup();
+    return elapsed * 1e9 / OPS;
+}
+
+void test_engine_benchmark() {
+    printf("=== Test 9: Allocation engine benchmark ===\n");
+    double best_fit = bench_engine(TREEALOC_ENGINE_BESTFIT);
+    double tlsf = bench_engine(TREEALOC_ENGINE_TLSF);
+    double buddy = bench_engine(TREEALOC_ENGINE_BUDDY);
+    treealoc_set_engine(TREEALOC_ENGINE_BESTFIT, 0);
+    printf("[TEST] Power-of-two workload, ns per operation:\n");
+    printf("[TEST]   best-fit %10.0f\n", best_fit);
+    printf("[TEST]   tlsf     %10.0f\n", tlsf);
+    printf("[TEST]   buddy    %10.0f\n", buddy);
+}
+
+// Пара потоков: производитель выделяет, потребитель освобождает; между ними кольцо на одного писателя
+enum { RING_SIZE = 1024, PAIR_OBJECTS = 100000 };
+
+typedef struct {
+    void* slots[RING_SIZE];
+    _Atomic size_t head;
+    _Atomic size_t tail;
+} PairRing;
+
+static void* bench_producer(void* arg) {
+    PairRing* ring = arg;
+    for (size_t i = 0; i < PAIR_OBJECTS; i++) {
+        void* obj = treealoc_malloc(64 + (i % 8) * 64);
+        size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        while (head - atomic_load_explicit(&ring->tail, memory_order_acquire) == RING_SIZE) sched_yield();
+        ring->slots[head % RING_SIZE] = obj;
+        atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    }
+    return NULL;
+}
+
+static void* bench_consumer(void* arg) {
+    PairRing* ring = arg;
+    for (size_t i = 0; i < PAIR_OBJECTS; i++) {
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        while (atomic_load_explicit(&ring->head, memory_order_acquire) == tail) sched_yield();
+        treealoc_free(ring->slots[tail % RING_SIZE]);
+        atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    }
+    return NULL;
+}
+
+static double bench_pairs(int pairs) {
+    PairRing* rings = __real_calloc(pairs, sizeof(PairRing));
+    pthread_t* threads = __real_malloc(2 * pairs * sizeof(pthread_t));
+    double start = now_seconds();
+    for (int i = 0; i < pairs; i++) {
+        pthread_create(&threads[2 * i], NULL, bench_producer, &rings[i]);
+        pthread_create(&threads[2 * i + 1], NULL, bench_consumer, &rings[i]);
+    }
+    for (int i = 0; i < 2 * pairs; i++) pthread_join(threads[i], NULL);
+    double elapsed = now_seconds() - start;
+    __real_free(threads);
+    __real_free(rings);
+    return pairs * PAIR_OBJECTS / elapsed / 1e6;
+}
+
+void test_remote_free_benchmark() {
+    printf("=== Test 10: Producer/consumer benchmark ===\n");
+    // TLSF: отладочный вывод best-fit на каждую операцию заглушил бы разницу
+    treealoc_set_engine(TREEALOC_ENGINE_TLSF, 0);
+    double result[2][3];
+    for (int remote = 0; remote < 2; remote++) {
+        treealoc_remote_free_enable(remote);
+        for (int i = 0; i < 3; i++) result[remote][i] = bench_pairs(1 << i);
+    }
+    treealoc_remote_free_enable(0);
+    treealoc_cleanup();
+    treealoc_set_engine(TREEALOC_ENGINE_BESTFIT, 0);
+    printf("[TEST] Million objects per second (TLSF engine):\n");
+    printf("[TEST]   pairs   locked free   remote free queue\n");
+    for (int i = 0; i < 3; i++) printf("[TEST]   %5d   %11.2f   %17.2f\n", 1 << i, result[0][i], result[1][i]);
+}
+
+// Ложное разделение (cache-thrash и cache-scratch из набора Hoard): каждый поток пишет только в свой
+// объект, но объекты, выданные подряд, лежат в одной строке кэша, и строка переходит между ядрами
+enum { SHARE_THREADS = 4, SHARE_ROUNDS = 50, SHARE_WRITES = 1000000, SHARE_SIZE = 8 };
+
+enum { PLACE_PACKED, PLACE_FLAG, PLACE_THRESHOLD };
+
+typedef struct {
+    int placement;
+    char* handoff;              // cache-scratch: объект, выданный главным потоком
+    uintptr_t first;            // Объект первого раунда: все потоки держат свои объекты одновременно
+    pthread_barrier_t* barrier;
+} ShareArg;
+
+static void* share_alloc(int placement) {
+    return placement == PLACE_FLAG ? treealoc_malloc_flags(SHARE_SIZE, TREEALOC_F_ISOLATED) : treealoc_malloc(SHARE_SIZE);
+}
+
+static void* share_worker(void* arg) {
+    ShareArg* a = arg;
+    if (a->handoff) treealoc_free(a->handoff); // Освобождённый объект главного потока выдаётся снова
+    for (int r = 0; r < SHARE_ROUNDS; r++) {
+        volatile char* obj = share_alloc(a->placement);
+        if (r == 0) a->first = (uintptr_t)obj;
+        pthread_barrier_wait(a->barrier);
+        for (int w = 0; w < SHARE_WRITES / SHARE_ROUNDS; w++) obj[w % SHARE_SIZE]++;
+        treealoc_free((void*)obj);
+    }
+    return NULL;
+}
+
+// Время в мс; *shared - сколько потоков делили строку кэша с объектом другого потока
+static double bench_sharing(int placement, int scratch, int* shared) {
+    ShareArg args[SHARE_THREADS];
+    pthread_t threads[SHARE_THREADS];
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier, NULL, SHARE_THREADS);
+    treealoc_set_isolation(placement == PLACE_THRESHOLD ? SHARE_SIZE : 0);
+    for (int i = 0; i < SHARE_THREADS; i++) {
+        args[i].placement = placement;
+        args[i].handoff = scratch ? share_alloc(placement) : NULL;
+        args[i].barrier = &barrier;
+    }
+    double start = now_seconds();
+    for (int i = 0; i < SHARE_THREADS; i++) pthread_create(&threads[i], NULL, share_worker, &args[i]);
+    for (int i = 0; i < SHARE_THREADS; i++) pthread_join(threads[i], NULL);
+    double elapsed = now_seconds() - start;
+    pthread_barrier_destroy(&barrier);
+    treealoc_set_isolation(0);
+    treealoc_cleanup();
+
+    *shared = 0;
+    for (int i = 0; i < SHARE_THREADS; i++) {
+        for (int j = 0; j < SHARE_THREADS; j++) {
+            if (i != j && args[i].first / TREEALOC_CACHE_LINE == args[j].first / TREEALOC_CACHE_LINE) {
+                (*shared)++;
+                break;
+            }
+        }
+    }
+    return elapsed * 1e3;
+}
+
+void test_false_sharing_benchmark() {
+    printf("=== Test 11: False sharing benchmark ===\n");
+    static const char* names[] = {"packed", "TREEALOC_F_ISOLATED", "isolation threshold"};
+    double ms[3][2];
+    int shared[3][2];
+    for (int p = 0; p < 3; p++) {
+        for (int scratch = 0; scratch < 2; scratch++) ms[p][scratch] = bench_sharing(p, scratch, &shared[p][scratch]);
+    }
+    printf("[TEST] %d threads, %d writes each; ms (threads sharing a cache line):\n", SHARE_THREADS, SHARE_WRITES);
+    printf("[TEST]   placement               cache-thrash      cache-scratch\n");
+    for (int p = 0; p < 3; p++) {
+        printf("[TEST]   %-20s %9.1f (%d)    %9.1f (%d)\n", names[p], ms[p][0], shared[p][0], ms[p][1], shared[p][1]);
+    }
+}
+
+// Отладочный вывод на каждую операцию уводим в /dev/null; возвращается прежний stdout
+static int mute_stdout(void) {
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+    close(devnull);
+    return saved_stdout;
+}
+
+static void restore_stdout(int saved_stdout) {
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+}
+
+// Раскладка узлов B-дерева: то же дерево до и после перестановки узлов, с подгрузкой детей и без.
+// Дерево отдельное (btree_select), ключи - фиктивные адреса: блоки не разыменовываются
+enum { LAYOUT_KEYS = 200000, LAYOUT_LOOKUPS = 200000, LAYOUT_SCANS = 5, EVICT_BYTES = 64 << 20 };
+
+static void evict_caches(char* buffer) {
+    for (size_t i = 0; i < EVICT_BYTES; i += 64) buffer[i]++;
+}
+
+static void bench_layout(BNode** tree, const uintptr_t* keys, char* buffer, double* lookup_ns, double* scan_ms) {
+    evict_caches(buffer);
+    double start = now_seconds();
+    for (int i = 0; i < LAYOUT_LOOKUPS; i++) {
+        int index;
+        find_node(*tree, (void*)keys[(size_t)i * 7919 % LAYOUT_KEYS], &index);
+    }
+    *lookup_ns = (now_seconds() - start) * 1e9 / LAYOUT_LOOKUPS;
+
+    double total = 0;
+    for (int i = 0; i < LAYOUT_SCANS; i++) {
+        evict_caches(buffer);
+        start = now_seconds();
+        btree_find_best_fit(32); // Все блоки заняты: проход по всем листьям
+        total += now_seconds() - start;
+    }
+    *scan_ms = total * 1e3 / LAYOUT_SCANS;
+}
+
+void test_layout_benchmark() {
+    printf("=== Test 12: B-tree layout benchmark ===\n");
+    static const char* names[] = {"allocation order", "breadth-first", "van Emde Boas"};
+    uintptr_t* keys = __real_malloc(LAYOUT_KEYS * sizeof(uintptr_t));
+    char* buffer = __real_calloc(1, EVICT_BYTES);
+    uintptr_t base = (uintptr_t)treealoc_malloc(16);
+    for (size_t k = 0; k < LAYOUT_KEYS; k++) keys[k] = base + k * 16;
+    srand(42);
+    for (size_t k = LAYOUT_KEYS - 1; k > 0; k--) {
+        size_t j = (size_t)rand() % (k + 1);
+        uintptr_t t = keys[k];
+        keys[k] = keys[j];
+        keys[j] = t;
+    }
+
+    int saved_stdout = mute_stdout();
+    int saved_layout = btree_layout();
+    BNode* tree = NULL;
+    btree_select(&tree);
+    btree_set_layout(BTREE_LAYOUT_NONE); // Вставка в случайном порядке разбрасывает узлы по пулу
+    for (size_t k = 0; k < LAYOUT_KEYS; k++) btree_insert(16, (void*)keys[k]);
+    double lookup_ns[3][2], scan_ms[3][2];
+    for (int mode = BTREE_LAYOUT_NONE; mode <= BTREE_LAYOUT_VEB; mode++) {
+        btree_set_layout(mode);
+        btree_relayout();
+        for (int prefetch = 0; prefetch < 2; prefetch++) {
+            btree_prefetch_enabled = prefetch;
+            bench_layout(&tree, keys, buffer, &lookup_ns[mode][prefetch], &scan_ms[mode][prefetch]);
+        }
+    }
+    btree_prefetch_enabled = 1;
+    btree_set_layout(saved_layout);
+    btree_cleanup();
+    btree_select(NULL);
+    restore_stdout(saved_stdout);
+
+    treealoc_free((void*)base);
+    __real_free(buffer);
+    __real_free(keys);
+    printf("[TEST] %d keys, node size %zu bytes; lookup ns / full scan ms:\n", LAYOUT_KEYS, sizeof(BNode));
+    printf("[TEST]   layout              no prefetch         prefetch\n");
+    for (int mode = 0; mode < 3; mode++) {
+        printf("[TEST]   %-16s %7.0f / %6.2f   %7.0f / %6.2f\n", names[mode],
+               lookup_ns[mode][0], scan_ms[mode][0], lookup_ns[mode][1], scan_ms[mode][1]);
+    }
+}
+
+// Обход кучи: занятые блоки видны в порядке адресов и с верным признаком свободы,
+// обход диапазона не выходит за его границы
+enum { WALK_BLOCKS = 64 };
+
+typedef struct {
+    void* blocks[WALK_BLOCKS]; // Нечётные заняты, чётные освобождены
+    size_t sizes[WALK_BLOCKS];
+    int seen[WALK_BLOCKS];
+    uintptr_t start;
+    uintptr_t end;             // 0 - до конца кучи
+    uintptr_t last;
+    int ok;
+} WalkCheck;
+
+static void walk_check(void* block, size_t size, int is_free, void* ctx) {
+    WalkCheck* w = ctx;
+    uintptr_t addr = (uintptr_t)block;
+    if (addr <= w->last || addr < w->start || (w->end && addr >= w->end)) w->ok = 0;
+    w->last = addr;
+    for (int i = 1; i < WALK_BLOCKS; i += 2) {
+        if (w->blocks[i] != block) continue;
+        if (is_free || size < w->sizes[i]) w->ok = 0;
+        w->seen[i] = 1;
+    }
+}
+
+static int walk_range(WalkCheck* w, uintptr_t start, uintptr_t end) {
+    memset(w->seen, 0, sizeof(w->seen));
+    w->start = start;
+    w->end = end;
+    w->last = 0;
+    w->ok = 1;
+    treealoc_heap_walk((void*)start, (void*)end, walk_check, w);
+    for (int i = 1; i < WALK_BLOCKS; i += 2) {
+        uintptr_t addr = (uintptr_t)w->blocks[i];
+        if (addr >= start && (!end || addr < end) && !w->seen[i]) w->ok = 0;
+    }
+    return w->ok;
+}
+
+static int compare_addr(const void* a, const void* b) {
+    uintptr_t x = *(const uintptr_t*)a;
+    uintptr_t y = *(const uintptr_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+void test_heap_walk() {
+    printf("=== Test 13: Heap walk ===\n");
+    static WalkCheck w;
+    int saved_stdout = mute_stdout();
+    for (int i = 0; i < WALK_BLOCKS; i++) {
+        w.sizes[i] = 48 + i * 8;
+        w.blocks[i] = treealoc_malloc(w.sizes[i]);
+    }
+    for (int i = 0; i < WALK_BLOCKS; i += 2) treealoc_free(w.blocks[i]);
+    uintptr_t live[WALK_BLOCKS / 2];
+    for (int i = 1; i < WALK_BLOCKS; i += 2) live[i / 2] = (uintptr_t)w.blocks[i];
+    qsort(live, WALK_BLOCKS / 2, sizeof(uintptr_t), compare_addr);
+
+    int whole = walk_range(&w, 0, 0);
+    int part = walk_range(&w, live[8], live[16]);
+    for (int i = 1; i < WALK_BLOCKS; i += 2) treealoc_free(w.blocks[i]);
+    restore_stdout(saved_stdout);
+    printf("[TEST] Heap walk: whole heap %s, address range %s\n", whole ? "PASS" : "FAIL", part ? "PASS" : "FAIL");
+}
+
+void test_pool_arena() {
+    printf("=== Test 14: Object pools and arenas ===\n");
+    enum { POOL_OBJECTS = 2000, ARENA_OBJECTS = 5000, ARENA_ROUNDS = 3 };
+    int saved_stdout = mute_stdout();
+
+    TreealocPool* pool = treealoc_pool_create(40, 64);
+    void** objs = __real_malloc(POOL_OBJECTS * sizeof(void*));
+    int pool_ok = pool != NULL;
+    for (int i = 0; pool_ok && i < POOL_OBJECTS; i++) {
+        objs[i] = treealoc_pool_alloc(pool);
+        pool_ok = objs[i] && ((uintptr_t)objs[i] & 63) == 0;
+        if (pool_ok) memset(objs[i], i & 0xff, 40);
+    }
+    // Объекты не пересекаются: каждый сохранил своё содержимое
+    for (int i = 0; pool_ok && i < POOL_OBJECTS; i++) {
+        const unsigned char* obj = objs[i];
+        pool_ok = obj[0] == (i & 0xff) && obj[39] == (i & 0xff);
+    }
+    if (pool_ok) {
+        for (int i = 0; i < POOL_OBJECTS; i += 2) treealoc_pool_free(pool, objs[i]);
+        pool_ok = treealoc_pool_alloc(pool) == objs[POOL_OBJECTS - 2]; // Последний освобождённый выдаётся первым
+    }
+    if (pool) treealoc_pool_destroy(pool);
+    __real_free(objs);
+
+    TreealocArena* arena = treealoc_arena_create(0);
+    int arena_ok = arena != NULL;
+    void* first[ARENA_ROUNDS] = {0};
+    for (int round = 0; arena_ok && round < ARENA_ROUNDS; round++) {
+        for (int i = 0; arena_ok && i < ARENA_OBJECTS; i++) {
+            char* p = treealoc_arena_alloc(arena, 1 + i % 200);
+            arena_ok = p && ((uintptr_t)p & 15) == 0;
+            if (!arena_ok) break;
+            memset(p, 1, 1 + i % 200);
+            if (i == 0) first[round] = p;
+        }
+        char* big = arena_ok ? treealoc_arena_alloc(arena, 300000) : NULL; // Больше блока арены
+        arena_ok = arena_ok && big;
+        if (big) memset(big, 2, 300000);
+        treealoc_arena_reset(arena);
+    }
+    // После reset арена выдаёт память с начала своего первого блока
+    for (int round = 1; round < ARENA_ROUNDS; round++) arena_ok = arena_ok && first[round] == first[0];
+    if (arena) treealoc_arena_destroy(arena);
+
+    restore_stdout(saved_stdout);
+    printf("[TEST] Object pool: %s, arena: %s\n", pool_ok ? "PASS" : "FAIL", arena_ok ? "PASS" : "FAIL");
+}
+
+void test_tlsf_bad_pointers() {
+    printf("=== Test 15: TLSF interior and stale pointers ===\n");
+    int saved_stdout = mute_stdout();
+    treealoc_set_engine(TREEALOC_ENGINE_TLSF, 0);
+    char* a = treealoc_malloc(256);
+    memset(a, 0x41, 256);
+    int interior = treealoc_usable_size(a + 64) == 0;
+    treealoc_free(a + 64); // Не начало блока: отклоняется
+    char* b = treealoc_malloc(256);
+    interior = interior && b != a && a[0] == 0x41 && a[255] == 0x41 && treealoc_usable_size(a) >= 256;
+    treealoc_free(a);
+    treealoc_free(a); // Уже свободен: отклоняется, иначе блок выдали бы дважды
+    char* c = treealoc_malloc(256);
+    char* d = treealoc_malloc(256);
+    int stale = c != d;
+    treealoc_free(b);
+    treealoc_free(c);
+    treealoc_free(d);
+    treealoc_set_engine(TREEALOC_ENGINE_BESTFIT, 0);
+    restore_stdout(saved_stdout);
+    printf("[TEST] TLSF rejects interior pointer: %s, stale pointer: %s\n", interior ? "PASS" : "FAIL", stale ? "PASS" : "FAIL");
+}
+
+// calloc не обнуляет заведомо нулевую память, но блок, выданный повторно,
+// должен прийти чистым - и из основной кучи, и из шардов
+enum { CALLOC_ROUNDS = 20, CALLOC_THREADS = 4 };
+
+static int calloc_rounds(void) {
+    static const size_t sizes[] = {24, 200, 4000, 100000, 3 << 20};
+    int ok = 1;
+    for (int r = 0; r < CALLOC_ROUNDS; r++) {
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            size_t n = sizes[s] + r * 8;
+            unsigned char* p = treealoc_malloc(n);
+            memset(p, 0xAB, n);
+            treealoc_free(p);
+            unsigned char* q = treealoc_calloc(n, 1);
+            for (size_t k = 0; k < n && ok; k++) ok = q[k] == 0;
+            memset(q, 0xCD, n);
+            treealoc_free(q);
+        }
+        if (r == CALLOC_ROUNDS / 2) treealoc_trim(); // Часть блоков ляжет на страницы, отданные ядру
+    }
+    return ok;
+}
+
+static void* calloc_worker(void* arg) {
+    *(int*)arg = calloc_rounds();
+    return NULL;
+}
+
+void test_calloc_zero() {
+    printf("=== Test 16: calloc on reused memory ===\n");
+    int saved_stdout = mute_stdout();
+    int heap_ok = calloc_rounds();
+    treealoc_set_shards(CALLOC_THREADS, TREEALOC_SHARD_ROUND_ROBIN);
+    pthread_t threads[CALLOC_THREADS];
+    int results[CALLOC_THREADS];
+    for (int i = 0; i < CALLOC_THREADS; i++) pthread_create(&threads[i], NULL, calloc_worker, &results[i]);
+    int shard_ok = 1;
+    for (int i = 0; i < CALLOC_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+        shard_ok = shard_ok && results[i];
+    }
+    treealoc_set_shards(1, TREEALOC_SHARD_ROUND_ROBIN);
+    restore_stdout(saved_stdout);
+    printf("[TEST] calloc zeroing: main heap %s, shards %s\n", heap_ok ? "PASS" : "FAIL", shard_ok ? "PASS" : "FAIL");
+}
+
+void test_free_sized_double() {
+    printf("=== Test 17: Double free_sized ===\n");
+    int saved_stdout = mute_stdout();
+    void* warm[8];
+    for (int i = 0; i < 8; i++) warm[i] = treealoc_malloc(64);
+    char* a = treealoc_malloc(64);
+    treealoc_free_sized(a, 64);
+    treealoc_free_sized(a, 64); // Блок ещё в кэше размеров
+    char* b = treealoc_malloc(64);
+    char* c = treealoc_malloc(64);
+    int cached = b != c;
+    treealoc_free_sized(b, 64);
+    treealoc_trim();            // Кэш сливается в дерево
+    treealoc_free_sized(b, 64); // Блок уже свободен в дереве
+    char* d = treealoc_malloc(64);
+    char* e = treealoc_malloc(64);
+    int in_tree = d != e;
+    treealoc_free(c);
+    treealoc_free(d);
+    treealoc_free(e);
+    for (int i = 0; i < 8; i++) treealoc_free(warm[i]);
+    restore_stdout(saved_stdout);
+    printf("[TEST] Double free_sized: cached block %s, block in tree %s\n", cached ? "PASS" : "FAIL", in_tree ? "PASS" : "FAIL");
+}
+
+// Шарды: счётчики ведутся по каждому шарду, свободные страницы шардов возвращаются ядру,
+// защитные страницы ловят обращение после free и на пути шарда
+enum { SHARD_THREADS = 4, SHARD_ROUNDS = 10, SHARD_BLOCKS = 256 };
+
+static void* shard_worker(void* arg) {
+    (void)arg;
+    void* p[SHARD_BLOCKS];
+    for (int r = 0; r < SHARD_ROUNDS; r++) {
+        for (int i = 0; i < SHARD_BLOCKS; i++) {
+            p[i] = treealoc_malloc(8192 + i * 16);
+            memset(p[i], 1, 64);
+        }
+        for (int i = 0; i < SHARD_BLOCKS; i++) treealoc_free(p[i]);
+    }
+    return NULL;
+}
+
+static void* guard_worker(void* arg) {
+    int fd = *(int*)arg;
+    char* p = treealoc_malloc(100);
+    char sampled = guard_owns(p) && treealoc_usable_size(p) >= 100;
+    if (write(fd, &sampled, 1) != 1) _exit(1);
+    p[99] = 1;
+    treealoc_free(p);
+    p[0] = 1; // Обращение после free: SIGSEGV в защитном пуле
+    return NULL;
+}
+
+void test_shard_telemetry_guard() {
+    printf("=== Test 18: Shard telemetry and guard pages ===\n");
+    int saved_stdout = mute_stdout();
+    treealoc_set_shards(SHARD_THREADS, TREEALOC_SHARD_ROUND_ROBIN);
+    TreealocShardStats before[SHARD_THREADS], after[SHARD_THREADS];
+    for (int i = 0; i < SHARD_THREADS; i++) treealoc_shard_stats(i, &before[i]);
+    pthread_t threads[SHARD_THREADS];
+    for (int i = 0; i < SHARD_THREADS; i++) pthread_create(&threads[i], NULL, shard_worker, NULL);
+    for (int i = 0; i < SHARD_THREADS; i++) pthread_join(threads[i], NULL);
+    size_t trimmed = treealoc_trim();
+    int busy = 0;
+    for (int i = 0; i < SHARD_THREADS; i++) {
+        treealoc_shard_stats(i, &after[i]);
+        if (after[i].allocs > before[i].allocs && after[i].frees > before[i].frees) busy++;
+    }
+    // Потоки закрепляются по кругу, поэтому работа расходится по нескольким шардам
+    int stats_ok = busy >= 2 && trimmed > 0;
+
+    // Выборку нельзя выключить после включения, поэтому она проверяется в дочернем процессе
+    int guard_ok = 0;
+    int fds[2];
+    if (pipe(fds) == 0) {
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(fds[0]);
+            int devnull = open("/dev/null", O_WRONLY);
+            dup2(devnull, STDERR_FILENO); // Отчёт обработчика о пойманной ошибке ожидаем
+            close(devnull);
+            if (treealoc_guard_enable(1, 16) != 0) _exit(1);
+            pthread_t t;
+            pthread_create(&t, NULL, guard_worker, &fds[1]);
+            pthread_join(t, NULL);
+            _exit(0); // Обращение после free не поймано
+        }
+        close(fds[1]);
+        char sampled = 0;
+        if (read(fds[0], &sampled, 1) != 1) sampled = 0;
+        close(fds[0]);
+        int status = 0;
+        waitpid(pid, &status, 0);
+        guard_ok = sampled && WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV;
+    }
+    treealoc_set_shards(1, TREEALOC_SHARD_ROUND_ROBIN);
+    restore_stdout(saved_stdout);
+    printf("[TEST] Shard telemetry: %d of %d shards busy, %zu bytes trimmed: %s\n", busy, SHARD_THREADS, trimmed, stats_ok ? "PASS" : "FAIL");
+    printf("[TEST] Guard page catches use-after-free on the shard path: %s\n", guard_ok ? "PASS" : "FAIL");
+}
+
+// Нагрузка: случайные вставки, удаления и освобождения в отдельном B-дереве сверяются
+// с теневой таблицей; затем потоки гоняют malloc/realloc/calloc/free по шардам,
+// проверяя содержимое блоков и передавая часть блоков друг другу на освобождение
+enum { STRESS_KEYS = 20000, STRESS_TREE_OPS = 300000, STRESS_CHECK_EVERY = 20000 };
+enum { STRESS_THREADS = 8, STRESS_SLOTS = 256, STRESS_OPS = 30000 };
+enum { KEY_ABSENT, KEY_USED, KEY_FREE };
+
+typedef struct {
+    const unsigned char* state;
+    uintptr_t base;
+    uintptr_t last;
+    size_t count;
+    int ok;
+} TreeCheck;
+
+static void tree_check(void* block, size_t size, int is_free, void* ctx) {
+    TreeCheck* c = ctx;
+    uintptr_t addr = (uintptr_t)block;
+    size_t k = (addr - c->base) / 16;
+    if ((c->count && addr <= c->last) || addr < c->base || k >= STRESS_KEYS || size != 16 ||
+        c->state[k] != (is_free ? KEY_FREE : KEY_USED)) {
+        c->ok = 0;
+    }
+    c->last = addr;
+    c->count++;
+}
+
+static int stress_tree(void) {
+    unsigned char* state = __real_calloc(STRESS_KEYS, 1);
+    uintptr_t base = (uintptr_t)treealoc_malloc(16); // Ключи - фиктивные адреса рядом с кучей
+    size_t present = 0;
+    int ok = 1;
+    BNode* tree = NULL;
+    btree_select(&tree);
+    srand(7);
+    for (int op = 0; ok && op < STRESS_TREE_OPS; op++) {
+        size_t k = (size_t)rand() % STRESS_KEYS;
+        void* key = (void*)(base + k * 16);
+        if (state[k] == KEY_ABSENT) {
+            btree_insert(16, key);
+            state[k] = KEY_USED;
+            present++;
+        } else if (state[k] == KEY_USED && rand() % 2) {
+            btree_remove(key);
+            state[k] = KEY_ABSENT;
+            present--;
+        } else if (state[k] == KEY_USED) {
+            btree_mark_free(key);
+            state[k] = KEY_FREE;
+        } else {
+            uintptr_t got = (uintptr_t)btree_find_best_fit(16);
+            size_t j = (got - base) / 16;
+            ok = got >= base && j < STRESS_KEYS && state[j] == KEY_FREE;
+            if (ok) state[j] = KEY_USED;
+        }
+        if (op % STRESS_CHECK_EVERY == STRESS_CHECK_EVERY - 1) {
+            TreeCheck c = {state, base, 0, 0, 1};
+            btree_walk(tree_check, &c);
+            ok = ok && c.ok && c.count == present;
+        }
+    }
+    btree_cleanup();
+    btree_select(NULL);
+    treealoc_free((void*)base);
+    __real_free(state);
+    return ok;
+}
+
+static _Atomic int stress_failed;
+static void* _Atomic stress_handoff; // Блок другого потока: освобождается не тем, кто выделил
+
+static int stress_intact(const char* p, size_t n, char fill) {
+    for (size_t k = 0; k < n; k++) {
+        if (p[k] != fill) return 0;
+    }
+    return 1;
+}
+
+static void* stress_worker(void* arg) {
+    unsigned seed = (unsigned)(uintptr_t)arg;
+    char* p[STRESS_SLOTS] = {0};
+    size_t size[STRESS_SLOTS];
+    for (int op = 0; op < STRESS_OPS && !stress_failed; op++) {
+        int i = rand_r(&seed) % STRESS_SLOTS;
+        char fill = (char)(i ^ (uintptr_t)arg);
+        if (!p[i]) {
+            size[i] = rand_r(&seed) % 512 + 1;
+            p[i] = op % 5 == 0 ? treealoc_calloc(1, size[i]) : treealoc_malloc(size[i]);
+            if (!p[i] || treealoc_usable_size(p[i]) < size[i] || (op % 5 == 0 && !stress_intact(p[i], size[i], 0))) {
+                stress_failed = 1;
+                break;
+            }
+            memset(p[i], fill, size[i]);
+            continue;
+        }
+        if (!stress_intact(p[i], size[i], fill)) {
+            stress_failed = 1;
+            break;
+        }
+        if (op % 7 == 0) {
+            size_t n = rand_r(&seed) % 2000 + 1;
+            p[i] = treealoc_realloc(p[i], n);
+            if (!p[i] || !stress_intact(p[i], n < size[i] ? n : size[i], fill)) {
+                stress_failed = 1;
+                break;
+            }
+            memset(p[i], fill, n);
+            size[i] = n;
+        } else if (op % 11 == 0) {
+            void* other = atomic_exchange(&stress_handoff, p[i]);
+            if (other) treealoc_free(other);
+            p[i] = NULL;
+        } else {
+            treealoc_free(p[i]);
+            p[i] = NULL;
+        }
+    }
+    for (int i = 0; i < STRESS_SLOTS; i++) treealoc_free(p[i]);
+    return NULL;
+}
+
+static int stress_heap(unsigned shards, int remote) {
+    treealoc_set_shards(shards, TREEALOC_SHARD_ROUND_ROBIN);
+    treealoc_remote_free_enable(remote);
+    stress_failed = 0;
+    pthread_t threads[STRESS_THREADS];
+    for (int i = 0; i < STRESS_THREADS; i++) pthread_create(&threads[i], NULL, stress_worker, (void*)(uintptr_t)(i + 1));
+    for (int i = 0; i < STRESS_THREADS; i++) pthread_join(threads[i], NULL);
+    treealoc_free(atomic_exchange(&stress_handoff, NULL));
+    treealoc_remote_free_enable(0);
+    treealoc_set_shards(1, TREEALOC_SHARD_ROUND_ROBIN);
+    return !stress_failed;
+}
+
+void test_stress() {
+    printf("=== Test 19: B-tree and sharded heap stress ===\n");
+    int saved_stdout = mute_stdout();
+    double start = now_seconds();
+    int tree_ok = stress_tree();
+    int heap_ok = stress_heap(1, 0);
+    int shard_ok = stress_heap(4, 0);
+    int remote_ok = stress_heap(4, 1);
+    double elapsed = now_seconds() - start;
+    restore_stdout(saved_stdout);
+    printf("[TEST] %d B-tree operations against a shadow table: %s\n", STRESS_TREE_OPS, tree_ok ? "PASS" : "FAIL");
+    printf("[TEST] %d threads x %d operations: one heap %s, 4 shards %s, 4 shards with remote free %s (%.1f s)\n",
+           STRESS_THREADS, STRESS_OPS, heap_ok ? "PASS" : "FAIL", shard_ok ? "PASS" : "FAIL", remote_ok ? "PASS" : "FAIL", elapsed);
+}
+
 void clear_input_buffer() {
     int c;
     while ((c = getchar()) != '\n' && c != EOF);
@@ -156,6 +923,18 @@ void print_menu() {
     printf("5. Memory Fragmentation\n");
     printf("6. Edge Cases\n");
     printf("7. Run All Tests\n");
+    printf("8. Persistent heap crash consistency\n");
+    printf("9. Allocation engine benchmark\n");
+    printf("10. Producer/consumer benchmark\n");
+    printf("11. False sharing benchmark\n");
+    printf("12. B-tree layout benchmark\n");
+    printf("13. Heap walk\n");
+    printf("14. Object pools and arenas\n");
+    printf("15. TLSF interior and stale pointers\n");
+    printf("16. calloc on reused memory\n");
+    printf("17. Double free_sized\n");
+    printf("18. Shard telemetry and guard pages\n");
+    printf("19. B-tree and sharded heap stress\n");
     printf("0. Exit\n");
     printf("Enter choice: ");
 }
@@ -193,7 +972,27 @@ int main() {
                 test_intensive();
                 test_fragmentation();
                 test_edge_cases();
+                test_persistent_crash();
+                test_heap_walk();
+                test_pool_arena();
+                test_tlsf_bad_pointers();
+                test_calloc_zero();
+                test_free_sized_double();
+                test_shard_telemetry_guard();
+                test_stress();
                 break;
+            case 8: test_persistent_crash(); break;
+            case 9: test_engine_benchmark(); break;
+            case 10: test_remote_free_benchmark(); break;
+            case 11: test_false_sharing_benchmark(); break;
+            case 12: test_layout_benchmark(); break;
+            case 13: test_heap_walk(); break;
+            case 14: test_pool_arena(); break;
+            case 15: test_tlsf_bad_pointers(); break;
+            case 16: test_calloc_zero(); break;
+            case 17: test_free_sized_double(); break;
+            case 18: test_shard_telemetry_guard(); break;
+            case 19: test_stress(); break;
             case 0: goto exit;
             default: printf("Invalid choice\n");
         }
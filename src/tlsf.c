@@ -0,0 +1,234 @@
+#include "tlsf.h"
+#include "region.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define BLOCK_FREE 1
+#define BLOCK_PREV_FREE 2
+#define BLOCK_FLAGS (BLOCK_FREE | BLOCK_PREV_FREE)
+
+// Заголовок хранится всегда; ссылки списка свободных лежат в полезной части блока
+typedef struct TlsfBlock {
+    struct TlsfBlock* prev_phys;
+    size_t size; // Размер полезной части | флаги
+    struct TlsfBlock* next_free;
+    struct TlsfBlock* prev_free;
+} TlsfBlock;
+
+#define HEADER_SIZE (2 * sizeof(void*))
+#define MIN_BLOCK (2 * sizeof(void*))
+
+typedef struct TlsfPool {
+    Span span;
+    struct TlsfPool* next;
+    // Бит на каждые TLSF_ALIGN байт пула: с этого места начинается занятый блок.
+    // Заголовки лежат в полезной части соседей, поэтому free проверяет указатель по карте.
+    uint64_t used[];
+} TlsfPool;
+
+static uint64_t fl_bitmap;
+static uint32_t sl_bitmap[TLSF_FL_COUNT];
+static TlsfBlock* blocks[TLSF_FL_COUNT][TLSF_SL_COUNT];
+static TlsfPool* pools;
+static tlsf_pool_fn pool_hook;
+
+static inline size_t block_size(const TlsfBlock* b) { return b->size & ~(size_t)BLOCK_FLAGS; }
+static inline TlsfBlock* block_next(const TlsfBlock* b) {
+    return (TlsfBlock*)((char*)b + HEADER_SIZE + block_size(b));
+}
+static inline void* block_ptr(TlsfBlock* b) { return (char*)b + HEADER_SIZE; }
+static inline TlsfBlock* ptr_block(void* p) { return (TlsfBlock*)((char*)p - HEADER_SIZE); }
+
+static inline size_t used_index(const TlsfPool* pool, const TlsfBlock* b) {
+    return ((uintptr_t)b - pool->span.base) / TLSF_ALIGN;
+}
+static inline void mark_used(TlsfPool* pool, const TlsfBlock* b, int on) {
+    size_t i = used_index(pool, b);
+    if (on) pool->used[i >> 6] |= 1ull << (i & 63);
+    else pool->used[i >> 6] &= ~(1ull << (i & 63));
+}
+
+// Заголовок занятого блока этого пула для ptr или NULL для указателя внутрь блока и чужого
+static TlsfBlock* used_block(const Span* span, void* ptr) {
+    const TlsfPool* pool = span->owner;
+    uintptr_t off = (uintptr_t)ptr - pool->span.base;
+    if ((off & (TLSF_ALIGN - 1)) || off < HEADER_SIZE || off >= pool->span.size) return NULL;
+    size_t i = (off - HEADER_SIZE) / TLSF_ALIGN;
+    return (pool->used[i >> 6] >> (i & 63)) & 1 ? ptr_block(ptr) : NULL;
+}
+
+static inline int fls_size(size_t x) { return 63 - __builtin_clzll((unsigned long long)x); }
+
+static void mapping_insert(size_t size, int* fl, int* sl) {
+    if (size < TLSF_SMALL_BLOCK) {
+        *fl = 0;
+        *sl = (int)(size / (TLSF_SMALL_BLOCK / TLSF_SL_COUNT));
+    } else {
+        int f = fls_size(size);
+        *sl = (int)(size >> (f - TLSF_SL_LOG2)) ^ TLSF_SL_COUNT;
+        *fl = f - (TLSF_FL_SHIFT - 1);
+    }
+}
+
+// Размер округляется вверх до границы подкласса: любой блок найденного списка подойдёт
+static void mapping_search(size_t size, int* fl, int* sl) {
+    if (size >= TLSF_SMALL_BLOCK) size += ((size_t)1 << (fls_size(size) - TLSF_SL_LOG2)) - 1;
+    mapping_insert(size, fl, sl);
+}
+
+static void insert_free(TlsfBlock* b) {
+    int fl, sl;
+    mapping_insert(block_size(b), &fl, &sl);
+    b->prev_free = NULL;
+    b->next_free = blocks[fl][sl];
+    if (b->next_free) b->next_free->prev_free = b;
+    blocks[fl][sl] = b;
+    fl_bitmap |= 1ull << fl;
+    sl_bitmap[fl] |= 1u << sl;
+}
+
+static void remove_free(TlsfBlock* b) {
+    int fl, sl;
+    mapping_insert(block_size(b), &fl, &sl);
+    if (b->prev_free) b->prev_free->next_free = b->next_free;
+    else blocks[fl][sl] = b->next_free;
+    if (b->next_free) b->next_free->prev_free = b->prev_free;
+    if (!blocks[fl][sl]) {
+        sl_bitmap[fl] &= ~(1u << sl);
+        if (!sl_bitmap[fl]) fl_bitmap &= ~(1ull << fl);
+    }
+}
+
+static TlsfBlock* find_suitable(size_t size) {
+    int fl, sl;
+    mapping_search(size, &fl, &sl);
+    if (fl >= TLSF_FL_COUNT) return NULL;
+    uint32_t sl_map = sl_bitmap[fl] & (~0u << sl);
+    if (!sl_map) {
+        uint64_t fl_map = fl + 1 < 64 ? fl_bitmap & (~0ull << (fl + 1)) : 0;
+        if (!fl_map) return NULL;
+        fl = __builtin_ctzll(fl_map);
+        sl_map = sl_bitmap[fl];
+    }
+    return blocks[fl][__builtin_ctz(sl_map)];
+}
+
+// Пул: один свободный блок на всю длину и нулевой занятый блок-ограничитель в конце
+static int add_pool(size_t min_payload) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t bytes = min_payload + 2 * HEADER_SIZE;
+    if (bytes < TLSF_POOL_BYTES) bytes = TLSF_POOL_BYTES;
+    bytes = (bytes + page - 1) & ~(page - 1);
+    void* mem = region_map_pool(bytes, page);
+    if (!mem) {
+        printf("[tlsf] mmap of %zu-byte pool failed\n", bytes);
+        return -1;
+    }
+    TlsfPool* pool = calloc(1, sizeof(TlsfPool) + (bytes / TLSF_ALIGN + 63) / 64 * sizeof(uint64_t));
+    if (!pool) {
+        region_unmap_pool(mem, bytes);
+        return -1;
+    }
+    pool->span = (Span){SPAN_TLSF, (uintptr_t)mem, bytes, pool};
+    pagemap_set((uintptr_t)mem, bytes, &pool->span);
+    pool->next = pools;
+    pools = pool;
+
+    TlsfBlock* b = mem;
+    b->prev_phys = NULL;
+    b->size = (bytes - 2 * HEADER_SIZE) | BLOCK_FREE;
+    TlsfBlock* sentinel = block_next(b);
+    sentinel->prev_phys = b;
+    sentinel->size = BLOCK_PREV_FREE;
+    insert_free(b);
+    printf("[tlsf] Added %zu-byte pool at %p\n", bytes, mem);
+    if (pool_hook) pool_hook(mem, bytes);
+    return 0;
+}
+
+void tlsf_set_pool_hook(tlsf_pool_fn on_pool) {
+    pool_hook = on_pool;
+}
+
+int tlsf_reserve(size_t bytes) {
+    return add_pool(bytes);
+}
+
+void* tlsf_malloc(size_t size) {
+    size_t adjust = (size + TLSF_ALIGN - 1) & ~(size_t)(TLSF_ALIGN - 1);
+    if (adjust < MIN_BLOCK) adjust = MIN_BLOCK;
+    if (adjust < size || adjust > ((size_t)1 << (TLSF_FL_MAX - 1))) return NULL;
+    TlsfBlock* b = find_suitable(adjust);
+    if (!b) {
+        // Пул должен попасть в класс не ниже округлённого запроса
+        size_t need = adjust >= TLSF_SMALL_BLOCK ? adjust + ((size_t)1 << (fls_size(adjust) - TLSF_SL_LOG2)) : adjust;
+        if (add_pool(need) != 0) return NULL;
+        b = find_suitable(adjust);
+        if (!b) return NULL;
+    }
+    remove_free(b);
+
+    size_t avail = block_size(b);
+    TlsfBlock* next = block_next(b);
+    if (avail >= adjust + HEADER_SIZE + MIN_BLOCK) {
+        // Остаток отделяется в новый свободный блок
+        TlsfBlock* rest = (TlsfBlock*)((char*)b + HEADER_SIZE + adjust);
+        rest->prev_phys = b;
+        rest->size = (avail - adjust - HEADER_SIZE) | BLOCK_FREE;
+        next->prev_phys = rest;
+        insert_free(rest);
+        b->size = adjust | (b->size & BLOCK_PREV_FREE);
+    } else {
+        b->size &= ~(size_t)BLOCK_FREE;
+        next->size &= ~(size_t)BLOCK_PREV_FREE;
+    }
+    mark_used(pagemap_lookup(b)->owner, b, 1);
+    return block_ptr(b);
+}
+
+int tlsf_free(Span* span, void* ptr) {
+    TlsfBlock* b = used_block(span, ptr);
+    if (!b || (b->size & BLOCK_FREE)) return -1;
+    mark_used(span->owner, b, 0);
+
+    if (b->size & BLOCK_PREV_FREE) {
+        TlsfBlock* prev = b->prev_phys;
+        remove_free(prev);
+        prev->size += HEADER_SIZE + block_size(b);
+        b = prev;
+    } else {
+        b->size |= BLOCK_FREE;
+    }
+    TlsfBlock* next = block_next(b);
+    if (next->size & BLOCK_FREE) {
+        remove_free(next);
+        b->size += HEADER_SIZE + block_size(next);
+        next = block_next(b);
+    }
+    next->prev_phys = b;
+    next->size |= BLOCK_PREV_FREE;
+    insert_free(b);
+    return 0;
+}
+
+size_t tlsf_usable_size(Span* span, void* ptr) {
+    TlsfBlock* b = used_block(span, ptr);
+    return !b || (b->size & BLOCK_FREE) ? 0 : block_size(b);
+}
+
+void tlsf_release_all(void) {
+    while (pools) {
+        TlsfPool* next = pools->next;
+        pagemap_clear(pools->span.base, pools->span.size);
+        region_unmap_pool((void*)pools->span.base, pools->span.size);
+        free(pools);
+        pools = next;
+    }
+    fl_bitmap = 0;
+    for (int i = 0; i < TLSF_FL_COUNT; i++) {
+        sl_bitmap[i] = 0;
+        for (int j = 0; j < TLSF_SL_COUNT; j++) blocks[i][j] = NULL;
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef TLSF_H
+#define TLSF_H
+
+#include "pagemap.h"
+#include <stddef.h>
+
+// Two-Level Segregated Fit: свободные блоки разложены по спискам по двум
+// уровням (степень двойки и 32 линейных подкласса внутри неё), непустые
+// списки отмечены битовыми масками. Поиск подходящего списка - две операции
+// ctz, слияние с соседями при освобождении - через заголовки соседних блоков,
+// поэтому malloc и free выполняются за O(1) в худшем случае.
+//
+// Память берётся пулами через region_map_pool (в компактной сборке - из окна областей).
+// В B-дерево пул попадает одной записью (для визуализации), в карту страниц - участком SPAN_TLSF.
+
+#define TLSF_ALIGN 16
+#define TLSF_SL_LOG2 5
+#define TLSF_SL_COUNT (1 << TLSF_SL_LOG2)
+#define TLSF_FL_SHIFT (TLSF_SL_LOG2 + 4)        // Блоки до 512 байт - линейные классы по 16
+#define TLSF_SMALL_BLOCK (1 << TLSF_FL_SHIFT)
+#define TLSF_FL_MAX 40                           // Блоки до 1 ТБ
+#define TLSF_FL_COUNT (TLSF_FL_MAX - TLSF_FL_SHIFT + 1)
+#define TLSF_POOL_BYTES (4u << 20)
+
+typedef void (*tlsf_pool_fn)(void* base, size_t size);
+
+// Вызывающий держит блокировку аллокатора.
+// on_pool вызывается для каждого нового пула (регистрация в B-дереве).
+void tlsf_set_pool_hook(tlsf_pool_fn on_pool);
+void* tlsf_malloc(size_t size);
+// span - участок пула из карты страниц. Начала занятых блоков отмечены в карте пула,
+// поэтому указатель внутрь блока или повторное освобождение не портят заголовки.
+int tlsf_free(Span* span, void* ptr);          // -1 - не занятый блок TLSF
+size_t tlsf_usable_size(Span* span, void* ptr); // 0 - не занятый блок TLSF
+int tlsf_reserve(size_t bytes);    // Заранее завести пул, чтобы первые malloc не ждали mmap
+void tlsf_release_all(void);
+
+#endif
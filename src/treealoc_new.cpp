@@ -0,0 +1,52 @@
+// Глобальные operator new/delete поверх treealoc. Подключается явно:
+// добавить build/treealoc_new.o при компоновке C++-программы вместе с -ltreealoc.
+// Размерные delete (C++14) передают размер в treealoc_free_sized.
+#include "Lib.h"
+#include <new>
+
+static void* allocate(std::size_t size) {
+    void* ptr = treealoc_malloc(size ? size : 1);
+    if (!ptr) throw std::bad_alloc();
+    return ptr;
+}
+
+void* operator new(std::size_t size) {
+    return allocate(size);
+}
+
+void* operator new[](std::size_t size) {
+    return allocate(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    return treealoc_malloc(size ? size : 1);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return treealoc_malloc(size ? size : 1);
+}
+
+void operator delete(void* ptr) noexcept {
+    treealoc_free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    treealoc_free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+    treealoc_free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+    treealoc_free(ptr);
+}
+
+// new(0) выделяет 1 байт, поэтому и освобождается как 1 байт
+void operator delete(void* ptr, std::size_t size) noexcept {
+    treealoc_free_sized(ptr, size ? size : 1);
+}
+
+void operator delete[](void* ptr, std::size_t size) noexcept {
+    treealoc_free_sized(ptr, size ? size : 1);
+}
@@ -0,0 +1,138 @@
+#include "treealoc_pmr.hpp"
+#include <cstdint>
+
+namespace treealoc {
+
+// Перед выровненным указателем хранится начало исходного блока
+static constexpr std::size_t header_size = sizeof(void*);
+
+static std::size_t aligned_total(std::size_t bytes, std::size_t alignment) {
+    if (bytes > std::numeric_limits<std::size_t>::max() - alignment - header_size) throw std::bad_alloc();
+    return bytes + alignment + header_size;
+}
+
+void* memory_resource::do_allocate(std::size_t bytes, std::size_t alignment) {
+    if (bytes == 0) bytes = 1;
+    if (alignment <= TREEALOC_ALIGNMENT) {
+        void* p = treealoc_malloc(bytes);
+        if (!p) throw std::bad_alloc();
+        return p;
+    }
+    std::size_t total = aligned_total(bytes, alignment);
+    char* raw = static_cast<char*>(treealoc_malloc(total));
+    if (!raw) throw std::bad_alloc();
+    std::uintptr_t aligned = (reinterpret_cast<std::uintptr_t>(raw) + header_size + alignment - 1) & ~(alignment - 1);
+    reinterpret_cast<void**>(aligned)[-1] = raw;
+    return reinterpret_cast<void*>(aligned);
+}
+
+void memory_resource::do_deallocate(void* p, std::size_t bytes, std::size_t alignment) {
+    if (!p) return;
+    if (bytes == 0) bytes = 1;
+    if (alignment <= TREEALOC_ALIGNMENT) {
+        treealoc_free_sized(p, bytes);
+        return;
+    }
+    treealoc_free_sized(static_cast<void**>(p)[-1], aligned_total(bytes, alignment));
+}
+
+bool memory_resource::do_is_equal(const std::pmr::memory_resource& other) const noexcept {
+    return dynamic_cast<const memory_resource*>(&other) != nullptr;
+}
+
+monotonic_resource::monotonic_resource(std::size_t chunk_size) : arena_(treealoc_arena_create(chunk_size)) {
+    if (!arena_) throw std::bad_alloc();
+}
+
+monotonic_resource::~monotonic_resource() {
+    treealoc_arena_destroy(arena_);
+}
+
+void monotonic_resource::release() noexcept {
+    treealoc_arena_reset(arena_);
+}
+
+// Арена выравнивает по TREEALOC_ALIGNMENT; для большего выравнивания берётся запас
+void* monotonic_resource::do_allocate(std::size_t bytes, std::size_t alignment) {
+    if (bytes == 0) bytes = 1;
+    std::size_t extra = alignment > TREEALOC_ALIGNMENT ? alignment - TREEALOC_ALIGNMENT : 0;
+    if (bytes > std::numeric_limits<std::size_t>::max() - extra) throw std::bad_alloc();
+    void* raw = treealoc_arena_alloc(arena_, bytes + extra);
+    if (!raw) throw std::bad_alloc();
+    if (!extra) return raw;
+    std::uintptr_t aligned = (reinterpret_cast<std::uintptr_t>(raw) + alignment - 1) & ~(alignment - 1);
+    return reinterpret_cast<void*>(aligned);
+}
+
+void monotonic_resource::do_deallocate(void*, std::size_t, std::size_t) {}
+
+bool monotonic_resource::do_is_equal(const std::pmr::memory_resource& other) const noexcept {
+    return this == &other;
+}
+
+pool_resource::pool_resource(const std::pmr::pool_options& options) {
+    std::size_t largest = options.largest_required_pool_block ? options.largest_required_pool_block : 4096;
+    while (classes_ < max_classes && (std::size_t(16) << classes_) < largest) classes_++;
+    if (classes_ < max_classes) classes_++;
+    create_pools();
+}
+
+pool_resource::~pool_resource() {
+    for (int i = 0; i < classes_; i++) treealoc_pool_destroy(pools_[i]);
+}
+
+void pool_resource::create_pools() {
+    for (int i = 0; i < classes_; i++) {
+        std::size_t size = std::size_t(16) << i;
+        pools_[i] = treealoc_pool_create(size, size);
+        if (!pools_[i]) throw std::bad_alloc();
+    }
+}
+
+void pool_resource::release() noexcept {
+    for (int i = 0; i < classes_; i++) {
+        treealoc_pool_destroy(pools_[i]);
+        pools_[i] = treealoc_pool_create(std::size_t(16) << i, std::size_t(16) << i);
+    }
+}
+
+std::pmr::pool_options pool_resource::options() const noexcept {
+    std::pmr::pool_options out;
+    out.max_blocks_per_chunk = 0;
+    out.largest_required_pool_block = std::size_t(16) << (classes_ - 1);
+    return out;
+}
+
+// Класс - наименьшая степень двойки не меньше размера и выравнивания; -1 - мимо пулов
+int pool_resource::class_of(std::size_t bytes, std::size_t alignment) const noexcept {
+    std::size_t need = bytes > alignment ? bytes : alignment;
+    for (int i = 0; i < classes_; i++) {
+        if ((std::size_t(16) << i) >= need) return i;
+    }
+    return -1;
+}
+
+void* pool_resource::do_allocate(std::size_t bytes, std::size_t alignment) {
+    int cls = class_of(bytes, alignment);
+    if (cls < 0 || !pools_[cls]) return get_resource()->allocate(bytes, alignment);
+    void* p = treealoc_pool_alloc(pools_[cls]);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void pool_resource::do_deallocate(void* p, std::size_t bytes, std::size_t alignment) {
+    int cls = class_of(bytes, alignment);
+    if (cls < 0 || !pools_[cls]) get_resource()->deallocate(p, bytes, alignment);
+    else treealoc_pool_free(pools_[cls], p);
+}
+
+bool pool_resource::do_is_equal(const std::pmr::memory_resource& other) const noexcept {
+    return this == &other;
+}
+
+memory_resource* get_resource() noexcept {
+    static memory_resource resource;
+    return &resource;
+}
+
+} // namespace treealoc
@@ -0,0 +1,117 @@
+// C++-интерфейс treealoc: ресурс памяти std::pmr и аллокатор для контейнеров STL.
+// Позволяет направить через treealoc отдельные контейнеры, не подменяя malloc
+// всего процесса. Компоновка: build/libtreealoc_pmr.a -ltreealoc (C++17).
+#ifndef TREEALOC_PMR_HPP
+#define TREEALOC_PMR_HPP
+
+#include "Lib.h"
+#include <cstddef>
+#include <limits>
+#include <memory_resource>
+#include <new>
+
+namespace treealoc {
+
+// Ресурс поверх treealoc_malloc/treealoc_free_sized. Выравнивание больше
+// TREEALOC_ALIGNMENT обеспечивается запасом и адресом исходного блока перед данными.
+class memory_resource : public std::pmr::memory_resource {
+protected:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+};
+
+// Общий экземпляр на процесс (все экземпляры treealoc::memory_resource взаимозаменяемы)
+memory_resource* get_resource() noexcept;
+
+// Аллокатор для std::vector, std::map и т.п.; размер при освобождении известен,
+// поэтому память возвращается через treealoc_free_sized
+template <class T>
+class allocator {
+public:
+    using value_type = T;
+
+    allocator() noexcept = default;
+    template <class U>
+    allocator(const allocator<U>&) noexcept {}
+
+    T* allocate(std::size_t n) {
+        if (n > std::numeric_limits<std::size_t>::max() / sizeof(T)) throw std::bad_array_new_length();
+        return static_cast<T*>(get_resource()->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept {
+        get_resource()->deallocate(p, n * sizeof(T), alignof(T));
+    }
+};
+
+template <class T, class U>
+bool operator==(const allocator<T>&, const allocator<U>&) noexcept {
+    return true;
+}
+
+template <class T, class U>
+bool operator!=(const allocator<T>&, const allocator<U>&) noexcept {
+    return false;
+}
+
+// Монотонный ресурс на арене treealoc: выделение сдвигом указателя, освобождение только
+// целиком. release() - treealoc_arena_reset (блоки остаются за ресурсом), деструктор -
+// treealoc_arena_destroy.
+class monotonic_resource : public std::pmr::memory_resource {
+public:
+    explicit monotonic_resource(std::size_t chunk_size = 64 * 1024);
+    ~monotonic_resource() override;
+    monotonic_resource(const monotonic_resource&) = delete;
+    monotonic_resource& operator=(const monotonic_resource&) = delete;
+
+    void release() noexcept;
+
+protected:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+private:
+    TreealocArena* arena_;
+};
+
+// Пулы treealoc (treealoc_pool_*) для классов-степеней двойки от 16 байт до
+// largest_required_pool_block (по умолчанию 4 КБ, не больше 64 КБ); объект класса
+// выровнен по своему размеру. Крупные блоки идут в get_resource(). Размер блоков
+// пулов treealoc выбирает сам, max_blocks_per_chunk не используется.
+class pool_resource : public std::pmr::memory_resource {
+public:
+    explicit pool_resource(const std::pmr::pool_options& options = {});
+    ~pool_resource() override;
+    pool_resource(const pool_resource&) = delete;
+    pool_resource& operator=(const pool_resource&) = delete;
+
+    void release() noexcept; // Освобождает все объекты пулов разом
+    std::pmr::memory_resource* upstream_resource() const noexcept { return get_resource(); }
+    std::pmr::pool_options options() const noexcept;
+
+protected:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+private:
+    static constexpr int max_classes = 13; // 16 Б .. 64 КБ
+    int class_of(std::size_t bytes, std::size_t alignment) const noexcept;
+    void create_pools();
+
+    TreealocPool* pools_[max_classes] = {};
+    int classes_ = 0;
+};
+
+// treealoc_pool_* сами берут блокировку аллокатора, поэтому тот же ресурс годится
+// для нескольких потоков; release() с выделениями одновременно вызывать нельзя
+class synchronized_pool_resource : public pool_resource {
+public:
+    using pool_resource::pool_resource;
+};
+
+} // namespace treealoc
+
+#endif
@@ -0,0 +1,140 @@
+// treealoc-top: просмотр счётчиков libtreealoc живого процесса по PID
+#include "telemetry.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+    uint64_t allocs, frees, reallocs, callocs;
+    uint64_t reuse_hits, reuse_misses;
+    uint64_t latency[TELEMETRY_LAT_BUCKETS];
+} Sample;
+
+static void take_sample(const TelemetryPage* page, Sample* s) {
+    s->allocs = atomic_load_explicit(&page->allocs, memory_order_relaxed);
+    s->frees = atomic_load_explicit(&page->frees, memory_order_relaxed);
+    s->reallocs = atomic_load_explicit(&page->reallocs, memory_order_relaxed);
+    s->callocs = atomic_load_explicit(&page->callocs, memory_order_relaxed);
+    s->reuse_hits = atomic_load_explicit(&page->reuse_hits, memory_order_relaxed);
+    s->reuse_misses = atomic_load_explicit(&page->reuse_misses, memory_order_relaxed);
+    for (int i = 0; i < TELEMETRY_LAT_BUCKETS; i++) {
+        s->latency[i] = atomic_load_explicit(&page->latency[i], memory_order_relaxed);
+    }
+}
+
+static const char* human_bytes(uint64_t bytes, char* buf, size_t len) {
+    const char* units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+    double v = (double)bytes;
+    int u = 0;
+    while (v >= 1024.0 && u < 4) {
+        v /= 1024.0;
+        u++;
+    }
+    snprintf(buf, len, "%.1f %s", v, units[u]);
+    return buf;
+}
+
+static double seconds_between(const struct timespec* a, const struct timespec* b) {
+    return (double)(b->tv_sec - a->tv_sec) + (double)(b->tv_nsec - a->tv_nsec) / 1e9;
+}
+
+static void print_screen(const TelemetryPage* page, int pid, const Sample* prev, const Sample* cur, double dt) {
+    char b1[32], b2[32];
+    uint64_t hits = cur->reuse_hits - prev->reuse_hits;
+    uint64_t misses = cur->reuse_misses - prev->reuse_misses;
+    uint64_t total_hits = cur->reuse_hits + cur->reuse_misses;
+
+    printf("\033[H\033[2J");
+    printf("treealoc-top  pid %d  (интервал %.1f с)\n\n", pid, dt);
+    printf("  allocs/s   %12.0f   всего %llu\n", (cur->allocs - prev->allocs) / dt, (unsigned long long)cur->allocs);
+    printf("  frees/s    %12.0f   всего %llu\n", (cur->frees - prev->frees) / dt, (unsigned long long)cur->frees);
+    printf("  reallocs/s %12.0f   callocs/s %.0f\n", (cur->reallocs - prev->reallocs) / dt,
+           (cur->callocs - prev->callocs) / dt);
+    printf("  в работе   %12s   свободно в дереве %s\n",
+           human_bytes(atomic_load_explicit(&page->bytes_in_use, memory_order_relaxed), b1, sizeof(b1)),
+           human_bytes(atomic_load_explicit(&page->free_retained, memory_order_relaxed), b2, sizeof(b2)));
+    printf("  отдано ОС  %12s   calloc без memset %s\n",
+           human_bytes(atomic_load_explicit(&page->released_to_os, memory_order_relaxed), b1, sizeof(b1)),
+           human_bytes(atomic_load_explicit(&page->calloc_zero_skipped, memory_order_relaxed), b2, sizeof(b2)));
+    uint64_t mapped = atomic_load_explicit(&page->mapped_bytes, memory_order_relaxed);
+    uint64_t huge = atomic_load_explicit(&page->huge_backed_bytes, memory_order_relaxed);
+    printf("  отображено %12s   большими страницами %.1f%%\n", human_bytes(mapped, b1, sizeof(b1)),
+           mapped ? 100.0 * huge / mapped : 0.0);
+    printf("  reuse hit  %11.1f%%   за всё время %.1f%%\n",
+           hits + misses ? 100.0 * hits / (hits + misses) : 0.0,
+           total_hits ? 100.0 * cur->reuse_hits / total_hits : 0.0);
+    printf("  высота дерева %9llu\n\n",
+           (unsigned long long)atomic_load_explicit(&page->tree_height, memory_order_relaxed));
+
+    if (!page->latency_enabled) {
+        printf("  Гистограмма задержек выключена (TREEALOC_TELEMETRY_LATENCY=1 в наблюдаемом процессе)\n");
+        return;
+    }
+    uint64_t max = 0;
+    for (int i = 0; i < TELEMETRY_LAT_BUCKETS; i++) {
+        uint64_t d = cur->latency[i] - prev->latency[i];
+        if (d > max) max = d;
+    }
+    printf("  Задержка malloc/free за интервал:\n");
+    for (int i = 0; i < TELEMETRY_LAT_BUCKETS; i++) {
+        uint64_t d = cur->latency[i] - prev->latency[i];
+        if (!d) continue;
+        int bar = max ? (int)(d * 50 / max) : 0;
+        printf("  %10llu нс | %-50.*s %llu\n", 1ULL << i, bar,
+               "##################################################", (unsigned long long)d);
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <pid> [interval_ms]\n", argv[0]);
+        return 1;
+    }
+    int pid = atoi(argv[1]);
+    int interval_ms = argc > 2 ? atoi(argv[2]) : 1000;
+    if (interval_ms <= 0) interval_ms = 1000;
+
+    char name[64];
+    snprintf(name, sizeof(name), TELEMETRY_NAME_FMT, pid);
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        fprintf(stderr, "treealoc-top: no telemetry segment %s: %s\n", name, strerror(errno));
+        return 1;
+    }
+    const TelemetryPage* page = mmap(NULL, sizeof(TelemetryPage), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (page == MAP_FAILED) {
+        perror("treealoc-top: mmap");
+        return 1;
+    }
+    if (page->magic != TELEMETRY_MAGIC || page->version != TELEMETRY_VERSION) {
+        fprintf(stderr, "treealoc-top: %s is not a treealoc telemetry page (version %u)\n", name, page->version);
+        return 1;
+    }
+
+    Sample prev, cur;
+    struct timespec t_prev, t_cur;
+    take_sample(page, &prev);
+    clock_gettime(CLOCK_MONOTONIC, &t_prev);
+    while (1) {
+        usleep((useconds_t)interval_ms * 1000);
+        if (kill(pid, 0) != 0 && errno == ESRCH) {
+            printf("\nПроцесс %d завершился\n", pid);
+            break;
+        }
+        take_sample(page, &cur);
+        clock_gettime(CLOCK_MONOTONIC, &t_cur);
+        print_screen(page, pid, &prev, &cur, seconds_between(&t_prev, &t_cur));
+        fflush(stdout);
+        prev = cur;
+        t_prev = t_cur;
+    }
+    munmap((void*)page, sizeof(TelemetryPage));
+    return 0;
+}
@@ -1,9 +1,12 @@
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_ttf.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
 #include <time.h>
+#include <pthread.h>
 #include "b_tree.h"
+#include "history.h"
 #include "visual.h"
 #include "Lib.h" // Для вызова функций treealoc_malloc/cleanup
 
@@ -117,22 +120,505 @@ typedef struct {
 
 void calculate_level_width(BNode* node, int depth, LevelInfo* levels, int max_depth) {
     if (!node || depth >= max_depth) return;
-    // Count only actual blocks, not empty slots
-    for (int i = 0; i < node->n; i++) {
-        if (node->blocks[i]) {
-            levels[depth].node_count++;
-        }
-    }
+    bnode_prefetch_children(node);
+    // Записи листа и разделители внутреннего узла рисуются одинаковыми прямоугольниками
+    levels[depth].node_count += node->n;
     // Simple width calculation for the level based on average node count * spacing
     levels[depth].total_width = levels[depth].node_count * (NODE_WIDTH + HORIZONTAL_SPACING);
 
+    if (node->leaf) return;
     for (int i = 0; i <= node->n; i++) {
-        if (node->children[i]) {
-            calculate_level_width(node->children[i], depth + 1, levels, max_depth);
+        calculate_level_width(node->children[i], depth + 1, levels, max_depth);
+    }
+}
+
+// --- Карта адресного пространства (heat map) ---
+// Управляемый диапазон адресов отображается в HEAT_CELLS ячеек. Каждая ячейка
+// накапливает число занятых и свободных байт, попавших в неё, поэтому стоимость
+// кадра зависит от размера текстуры, а не от числа блоков.
+#define HEAT_SIDE 256
+#define HEAT_CELLS (HEAT_SIDE * HEAT_SIDE)
+#define HEAT_STRIP_W 1024
+#define HEAT_STRIP_H (HEAT_CELLS / HEAT_STRIP_W)
+#define HEAT_QUEUE_SIZE 4096
+#define HEAT_PAGE 4096
+
+enum { VIEW_TREE = 0, VIEW_HEATMAP };
+static int view_mode = VIEW_TREE;
+static int heat_hilbert = 0; // 0 - линейная полоса, 1 - кривая Гильберта
+
+static uint64_t heat_used[HEAT_CELLS];
+static uint64_t heat_free[HEAT_CELLS];
+static Uint32 heat_pixels[HEAT_CELLS];
+static Uint32 heat_hilbert_pos[HEAT_CELLS]; // ячейка -> индекс пикселя на кривой
+static int heat_hilbert_ready = 0;
+static SDL_Texture* heat_texture = NULL;
+static int heat_texture_layout = -1;
+
+static uintptr_t heat_lo = 0, heat_hi = 0; // Полный управляемый диапазон
+static uintptr_t heat_view_start = 0;      // Начало видимого окна
+static uint64_t heat_view_span = 0;        // Размер видимого окна в байтах
+static uint64_t heat_cell_bytes = 1;
+static double heat_zoom = 1.0;
+static int heat_dirty_lo = HEAT_CELLS, heat_dirty_hi = -1;
+
+// Очередь событий дерева: заполняется потоком-аллокатором, разбирается при отрисовке
+static pthread_mutex_t heat_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static BTreeEvent heat_queue[HEAT_QUEUE_SIZE];
+static int heat_queue_len = 0;
+static int heat_needs_rebuild = 1;
+
+// --- Перемотка истории ---
+// При перемотке карта строится по восстановленному списку блоков, а не по живому дереву
+static int replay_active = 0;
+static unsigned long replay_seq = 0;
+static HistoryBlock* replay_blocks = NULL;
+static size_t replay_count = 0;
+static int slider_drag = 0;
+
+static void heat_on_event(const BTreeEvent* ev, void* ctx) {
+    (void)ctx;
+    pthread_mutex_lock(&heat_queue_lock);
+    if (ev->type == BTREE_EV_CLEAR || heat_queue_len == HEAT_QUEUE_SIZE) {
+        heat_needs_rebuild = 1;
+        heat_queue_len = 0;
+    } else if (!heat_needs_rebuild) {
+        heat_queue[heat_queue_len++] = *ev;
+    }
+    pthread_mutex_unlock(&heat_queue_lock);
+}
+
+// Перевод индекса d на кривой Гильберта в координаты (x, y) квадрата side x side
+static void hilbert_d2xy(int side, int d, int* x, int* y) {
+    int rx, ry, t = d;
+    *x = *y = 0;
+    for (int s = 1; s < side; s *= 2) {
+        rx = 1 & (t / 2);
+        ry = 1 & (t ^ rx);
+        if (ry == 0) {
+            if (rx == 1) {
+                *x = s - 1 - *x;
+                *y = s - 1 - *y;
+            }
+            int tmp = *x; *x = *y; *y = tmp;
+        }
+        *x += s * rx;
+        *y += s * ry;
+        t /= 4;
+    }
+}
+
+static int hilbert_xy2d(int side, int x, int y) {
+    int rx, ry, d = 0;
+    for (int s = side / 2; s > 0; s /= 2) {
+        rx = (x & s) > 0;
+        ry = (y & s) > 0;
+        d += s * s * ((3 * rx) ^ ry);
+        if (ry == 0) {
+            if (rx == 1) {
+                x = side - 1 - x;
+                y = side - 1 - y;
+            }
+            int tmp = x; x = y; y = tmp;
+        }
+    }
+    return d;
+}
+
+static void heat_mark_dirty(int cell) {
+    if (cell < heat_dirty_lo) heat_dirty_lo = cell;
+    if (cell > heat_dirty_hi) heat_dirty_hi = cell;
+}
+
+// Добавляет (sign = 1) или вычитает (sign = -1) байты блока в ячейки видимого окна
+static void heat_account(uintptr_t addr, size_t size, int is_free, int sign) {
+    if (size == 0) size = 1;
+    uintptr_t view_end = heat_view_start + heat_view_span;
+    uintptr_t start = addr > heat_view_start ? addr : heat_view_start;
+    uintptr_t end = addr + size < view_end ? addr + size : view_end;
+    if (start >= end) return;
+
+    uint64_t* acc = is_free ? heat_free : heat_used;
+    int cell = (int)((start - heat_view_start) / heat_cell_bytes);
+    while (start < end && cell < HEAT_CELLS) {
+        uintptr_t cell_end = heat_view_start + (uintptr_t)(cell + 1) * heat_cell_bytes;
+        uint64_t chunk = (end < cell_end ? end : cell_end) - start;
+        acc[cell] += sign > 0 ? chunk : (uint64_t)-chunk;
+        heat_mark_dirty(cell);
+        start += chunk;
+        cell++;
+    }
+}
+
+static void heat_range_cb(void* block, size_t size, int is_free, void* ctx) {
+    (void)is_free; (void)ctx;
+    uintptr_t a = (uintptr_t)block;
+    uintptr_t e = a + (size ? size : 1);
+    if (heat_lo == heat_hi) {
+        heat_lo = a;
+        heat_hi = e;
+    } else {
+        if (a < heat_lo) heat_lo = a;
+        if (e > heat_hi) heat_hi = e;
+    }
+}
+
+static void heat_account_cb(void* block, size_t size, int is_free, void* ctx) {
+    (void)ctx;
+    heat_account((uintptr_t)block, size, is_free, 1);
+}
+
+// Пересчитывает видимое окно по текущему диапазону и масштабу
+static void heat_update_view(void) {
+    uint64_t full = heat_hi - heat_lo;
+    uint64_t span = (uint64_t)(full / heat_zoom);
+    if (span < HEAT_CELLS) span = HEAT_CELLS; // Предел приближения: 1 байт на пиксель
+    if (heat_view_start < heat_lo) heat_view_start = heat_lo;
+    if (heat_view_start + span > heat_lo + full) {
+        heat_view_start = full > span ? heat_lo + full - span : heat_lo;
+    }
+    heat_view_span = span;
+    heat_cell_bytes = (span + HEAT_CELLS - 1) / HEAT_CELLS;
+    heat_view_span = heat_cell_bytes * HEAT_CELLS;
+}
+
+// Источник блоков для карты: живое дерево или восстановленное состояние
+static void heat_walk(btree_walk_fn fn) {
+    if (replay_active) {
+        for (size_t i = 0; i < replay_count; i++) {
+            fn((void*)replay_blocks[i].addr, replay_blocks[i].size, replay_blocks[i].is_free, NULL);
+        }
+    } else {
+        btree_walk(fn, NULL);
+    }
+}
+
+// Полная перестройка накопителей обходом дерева в порядке адресов
+static void heat_rebuild(void) {
+    pthread_mutex_lock(&heat_queue_lock);
+    heat_queue_len = 0;
+    heat_needs_rebuild = 0;
+    pthread_mutex_unlock(&heat_queue_lock);
+
+    heat_lo = heat_hi = 0;
+    heat_walk(heat_range_cb);
+    heat_lo &= ~(uintptr_t)(HEAT_PAGE - 1);
+    heat_hi = (heat_hi + HEAT_PAGE - 1) & ~(uintptr_t)(HEAT_PAGE - 1);
+    heat_update_view();
+
+    memset(heat_used, 0, sizeof(heat_used));
+    memset(heat_free, 0, sizeof(heat_free));
+    heat_walk(heat_account_cb);
+    heat_dirty_lo = 0;
+    heat_dirty_hi = HEAT_CELLS - 1;
+}
+
+// Применяет накопившиеся события; блок за пределами диапазона требует перестройки
+static void heat_apply_events(void) {
+    static BTreeEvent pending[HEAT_QUEUE_SIZE]; // ~160 КБ - не на стеке; разбирает только поток отрисовки
+    int count;
+    int rebuild;
+
+    pthread_mutex_lock(&heat_queue_lock);
+    rebuild = heat_needs_rebuild;
+    count = heat_queue_len;
+    if (!rebuild) memcpy(pending, heat_queue, count * sizeof(BTreeEvent));
+    heat_queue_len = 0;
+    pthread_mutex_unlock(&heat_queue_lock);
+
+    if (rebuild) {
+        heat_rebuild();
+        return;
+    }
+    if (replay_active) return; // Живые события не относятся к показываемому моменту
+
+    for (int i = 0; i < count; i++) {
+        BTreeEvent* ev = &pending[i];
+        uintptr_t a = (uintptr_t)ev->block;
+        switch (ev->type) {
+            case BTREE_EV_INSERT:
+                if (a < heat_lo || a + ev->size > heat_hi) {
+                    heat_rebuild();
+                    return;
+                }
+                heat_account(a, ev->size, ev->is_free, 1);
+                break;
+            case BTREE_EV_REMOVE:
+                heat_account(a, ev->size, ev->is_free, -1);
+                break;
+            case BTREE_EV_REUSE:
+                heat_account(a, ev->size, 1, -1);
+                heat_account(a, ev->size, 0, 1);
+                break;
+            case BTREE_EV_RELEASE:
+                heat_account(a, ev->size, 0, -1);
+                heat_account(a, ev->size, 1, 1);
+                break;
+            case BTREE_EV_RESIZE:
+                heat_account(a, ev->old_size, ev->is_free, -1);
+                heat_account(a, ev->size, ev->is_free, 1);
+                break;
         }
     }
 }
 
+static Uint32 heat_cell_color(int cell) {
+    uint64_t cap = heat_cell_bytes;
+    uint64_t used = heat_used[cell] > cap ? cap : heat_used[cell];
+    uint64_t freeb = heat_free[cell] > cap - used ? cap - used : heat_free[cell];
+    uint64_t gap = cap - used - freeb;
+    Uint32 r = (Uint32)((180 * used + 60 * gap) / cap);
+    Uint32 g = (Uint32)((180 * freeb + 60 * gap) / cap);
+    Uint32 b = (Uint32)((60 * gap) / cap);
+    return 0xFF000000u | (r << 16) | (g << 8) | b;
+}
+
+static int heat_tex_w(void) { return heat_hilbert ? HEAT_SIDE : HEAT_STRIP_W; }
+static int heat_tex_h(void) { return heat_hilbert ? HEAT_SIDE : HEAT_STRIP_H; }
+
+// Перерисовывает в текстуре только изменившиеся ячейки
+static void heat_upload(void) {
+    if (!heat_hilbert_ready) {
+        for (int d = 0; d < HEAT_CELLS; d++) {
+            int x, y;
+            hilbert_d2xy(HEAT_SIDE, d, &x, &y);
+            heat_hilbert_pos[d] = (Uint32)(y * HEAT_SIDE + x);
+        }
+        heat_hilbert_ready = 1;
+    }
+    if (heat_texture_layout != heat_hilbert) {
+        if (heat_texture) SDL_DestroyTexture(heat_texture);
+        heat_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+                                         heat_tex_w(), heat_tex_h());
+        if (!heat_texture) {
+            char msg[128];
+            snprintf(msg, sizeof(msg), "Failed to create heat map texture: %s", SDL_GetError());
+            visual_log(msg);
+            return;
+        }
+        heat_texture_layout = heat_hilbert;
+        heat_dirty_lo = 0;
+        heat_dirty_hi = HEAT_CELLS - 1;
+    }
+    if (heat_dirty_hi < heat_dirty_lo) return;
+
+    int pitch = heat_tex_w() * (int)sizeof(Uint32);
+    if (heat_hilbert) {
+        for (int c = heat_dirty_lo; c <= heat_dirty_hi; c++) {
+            heat_pixels[heat_hilbert_pos[c]] = heat_cell_color(c);
+        }
+        SDL_UpdateTexture(heat_texture, NULL, heat_pixels, pitch);
+    } else {
+        for (int c = heat_dirty_lo; c <= heat_dirty_hi; c++) {
+            heat_pixels[c] = heat_cell_color(c);
+        }
+        int row_lo = heat_dirty_lo / HEAT_STRIP_W;
+        int row_hi = heat_dirty_hi / HEAT_STRIP_W;
+        SDL_Rect rows = {0, row_lo, HEAT_STRIP_W, row_hi - row_lo + 1};
+        SDL_UpdateTexture(heat_texture, &rows, heat_pixels + row_lo * HEAT_STRIP_W, pitch);
+    }
+    heat_dirty_lo = HEAT_CELLS;
+    heat_dirty_hi = -1;
+}
+
+static SDL_Rect heat_dest_rect(void) {
+    SDL_Rect area = {10, 60, WINDOW_WIDTH - 20, WINDOW_HEIGHT - 200};
+    if (heat_hilbert) {
+        int side = area.w < area.h ? area.w : area.h;
+        area.x += (area.w - side) / 2;
+        area.w = side;
+        area.h = side;
+    }
+    return area;
+}
+
+// Ячейка под курсором мыши или -1
+static int heat_cell_at(int mx, int my) {
+    SDL_Rect dst = heat_dest_rect();
+    SDL_Point p = {mx, my};
+    if (dst.w <= 0 || dst.h <= 0 || !SDL_PointInRect(&p, &dst)) return -1;
+    int tx = (mx - dst.x) * heat_tex_w() / dst.w;
+    int ty = (my - dst.y) * heat_tex_h() / dst.h;
+    return heat_hilbert ? hilbert_xy2d(HEAT_SIDE, tx, ty) : ty * HEAT_STRIP_W + tx;
+}
+
+static void draw_heatmap(void) {
+    heat_apply_events();
+    heat_upload();
+
+    SDL_Color text_color = {0, 0, 0, 255};
+    if (heat_lo == heat_hi) {
+        if (font) draw_text(renderer, font, "Дерево пусто", text_color, WINDOW_WIDTH / 2, WINDOW_HEIGHT / 2, 1, 1);
+        return;
+    }
+    SDL_Rect dst = heat_dest_rect();
+    if (heat_texture) SDL_RenderCopy(renderer, heat_texture, NULL, &dst);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+    SDL_RenderDrawRect(renderer, &dst);
+
+    if (debug_info_visible && small_font) {
+        char info[192];
+        snprintf(info, sizeof(info), "%s | Окно: %p - %p | %llu байт/пикс. | Масштаб: %.0fx",
+                 heat_hilbert ? "Гильберт" : "Полоса", (void*)heat_view_start,
+                 (void*)(heat_view_start + heat_view_span), (unsigned long long)heat_cell_bytes, heat_zoom);
+        draw_text(renderer, small_font, info, text_color, 10, WINDOW_HEIGHT - 70, 0, 0);
+
+        int mx, my;
+        SDL_GetMouseState(&mx, &my);
+        int cell = heat_cell_at(mx, my);
+        if (cell >= 0 && cell < HEAT_CELLS) {
+            uintptr_t a = heat_view_start + (uintptr_t)cell * heat_cell_bytes;
+            snprintf(info, sizeof(info), "%p: занято %llu, свободно %llu из %llu байт", (void*)a,
+                     (unsigned long long)heat_used[cell], (unsigned long long)heat_free[cell],
+                     (unsigned long long)heat_cell_bytes);
+            draw_text(renderer, small_font, info, text_color, 10, WINDOW_HEIGHT - 90, 0, 0);
+        }
+    }
+}
+
+static void heat_request_rebuild(void) {
+    pthread_mutex_lock(&heat_queue_lock);
+    heat_needs_rebuild = 1;
+    pthread_mutex_unlock(&heat_queue_lock);
+}
+
+// Управление картой: +/- масштаб, A/D сдвиг окна, H кривая Гильберта, 0 сброс
+static int heat_handle_key(SDL_Keycode key) {
+    uint64_t full = heat_hi - heat_lo;
+    uintptr_t center = heat_view_start + heat_view_span / 2;
+    switch (key) {
+        case SDLK_PLUS:
+        case SDLK_EQUALS:
+            if (heat_view_span <= HEAT_CELLS) return 1;
+            heat_zoom *= 2.0;
+            heat_view_start = center - heat_view_span / 4;
+            break;
+        case SDLK_MINUS:
+            heat_zoom /= 2.0;
+            if (heat_zoom < 1.0) heat_zoom = 1.0;
+            heat_view_start = center > heat_view_span ? center - heat_view_span : heat_lo;
+            break;
+        case SDLK_a:
+            heat_view_start = heat_view_start > heat_lo + heat_view_span / 8 ? heat_view_start - heat_view_span / 8 : heat_lo;
+            break;
+        case SDLK_d:
+            if (heat_view_start + heat_view_span < heat_lo + full) heat_view_start += heat_view_span / 8;
+            break;
+        case SDLK_h:
+            heat_hilbert = !heat_hilbert;
+            heat_dirty_lo = 0;
+            heat_dirty_hi = HEAT_CELLS - 1;
+            return 1;
+        case SDLK_0:
+            heat_zoom = 1.0;
+            heat_view_start = heat_lo;
+            break;
+        default:
+            return 0;
+    }
+    // Окно изменилось: накопители пересчитываются заново
+    heat_request_rebuild();
+    return 1;
+}
+
+// Переход к состоянию после seq событий (восстанавливается от ближайшего слепка)
+static void replay_seek(unsigned long seq) {
+    if (!history_enabled()) return;
+    unsigned long first = history_first_seq();
+    unsigned long last = history_last_seq();
+    if (seq < first) seq = first;
+    if (seq > last) seq = last;
+
+    HistoryBlock* blocks;
+    size_t count;
+    if (history_state_at(seq, &blocks, &count) != 0) {
+        visual_log("Failed to restore history state");
+        return;
+    }
+    history_free_state(replay_blocks);
+    replay_blocks = blocks;
+    replay_count = count;
+    replay_seq = seq;
+    replay_active = 1;
+    view_mode = VIEW_HEATMAP;
+    heat_request_rebuild();
+}
+
+static void replay_go_live(void) {
+    if (!replay_active) return;
+    history_free_state(replay_blocks);
+    replay_blocks = NULL;
+    replay_count = 0;
+    replay_active = 0;
+    heat_request_rebuild();
+    visual_log("Replay: back to live state");
+}
+
+static SDL_Rect slider_rect(void) {
+    SDL_Rect r = {10, WINDOW_HEIGHT - 130, WINDOW_WIDTH - 20, 16};
+    return r;
+}
+
+static void slider_seek_to(int mouse_x) {
+    SDL_Rect r = slider_rect();
+    unsigned long first = history_first_seq();
+    unsigned long last = history_last_seq();
+    if (r.w <= 0 || last <= first) return;
+    int x = mouse_x - r.x;
+    if (x < 0) x = 0;
+    if (x > r.w) x = r.w;
+    replay_seek(first + (unsigned long)((double)(last - first) * x / r.w));
+}
+
+// Шкала времени: LIVE или номер показываемого события
+static void draw_timeline(void) {
+    if (!history_enabled()) return;
+    unsigned long first = history_first_seq();
+    unsigned long last = history_last_seq();
+    unsigned long pos = replay_active ? replay_seq : last;
+    SDL_Rect r = slider_rect();
+
+    SDL_SetRenderDrawColor(renderer, 200, 200, 200, 255);
+    SDL_RenderFillRect(renderer, &r);
+    if (last > first) {
+        SDL_Rect done = r;
+        done.w = (int)((double)r.w * (pos - first) / (last - first));
+        SDL_SetRenderDrawColor(renderer, 100, 100, 200, 255);
+        SDL_RenderFillRect(renderer, &done);
+        SDL_Rect knob = {r.x + done.w - 3, r.y - 3, 6, r.h + 6};
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+        SDL_RenderFillRect(renderer, &knob);
+    }
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+    SDL_RenderDrawRect(renderer, &r);
+
+    if (small_font) {
+        char text[128];
+        SDL_Color color = {0, 0, 0, 255};
+        if (replay_active) {
+            snprintf(text, sizeof(text), "История: событие %lu из %lu (%.3f с), блоков: %zu",
+                     replay_seq, last, history_time_ms(replay_seq) / 1000.0, replay_count);
+        } else {
+            snprintf(text, sizeof(text), "LIVE: событий %lu, доступно с %lu", last, first);
+        }
+        draw_text(renderer, small_font, text, color, 10, WINDOW_HEIGHT - 110, 0, 0);
+    }
+}
+
+// Стрелки - шаг по событиям, Home - начало записи, End - живое состояние
+static int replay_handle_key(SDL_Keycode key) {
+    unsigned long cur = replay_active ? replay_seq : history_last_seq();
+    switch (key) {
+        case SDLK_LEFT:  replay_seek(cur > 0 ? cur - 1 : 0); return 1;
+        case SDLK_RIGHT: replay_seek(cur + 1); return 1;
+        case SDLK_DOWN:  replay_seek(cur > 100 ? cur - 100 : 0); return 1;
+        case SDLK_UP:    replay_seek(cur + 100); return 1;
+        case SDLK_HOME:  replay_seek(history_first_seq()); return 1;
+        case SDLK_END:   replay_go_live(); return 1;
+    }
+    return 0;
+}
+
 void draw_node(BNode* node, int x, int y, int depth, int* node_count, int parent_x, int parent_y, float scale, LevelInfo* levels);
 
 void draw_tree(int offset_x, int offset_y, float scale) {
@@ -142,15 +628,25 @@ void draw_tree(int offset_x, int offset_y, float scale) {
     SDL_SetRenderDrawColor(renderer, 240, 240, 240, 255); // <<-- ИЗМЕНЕНИЕ: Светло-серый фон
     SDL_RenderClear(renderer);
 
-    // Max depth for level info
-    LevelInfo levels[MAX_TREE_DEPTH] = {0};
-    calculate_level_width(root, 0, levels, MAX_TREE_DEPTH);
-
     int current_node_count = 0;
-    // Apply scale to tree rendering only
-    SDL_RenderSetScale(renderer, scale, scale);
-    draw_node(root, (WINDOW_WIDTH / 2 + offset_x)/scale, (50 + offset_y)/scale, 0, &current_node_count, 0, 0, scale, levels);
-    SDL_RenderSetScale(renderer, 1.0f, 1.0f); // Reset scale for UI elements
+    if (view_mode == VIEW_HEATMAP) {
+        draw_heatmap();
+    } else if (replay_active) {
+        if (font) {
+            SDL_Color color = {0, 0, 0, 255};
+            draw_text(renderer, font, "При перемотке доступна только карта памяти (M), End - вернуться к живому дереву",
+                      color, WINDOW_WIDTH / 2, WINDOW_HEIGHT / 2, 1, 1);
+        }
+    } else {
+        // Max depth for level info
+        LevelInfo levels[MAX_TREE_DEPTH] = {0};
+        calculate_level_width(root, 0, levels, MAX_TREE_DEPTH);
+
+        // Apply scale to tree rendering only
+        SDL_RenderSetScale(renderer, scale, scale);
+        draw_node(root, (WINDOW_WIDTH / 2 + offset_x)/scale, (50 + offset_y)/scale, 0, &current_node_count, 0, 0, scale, levels);
+        SDL_RenderSetScale(renderer, 1.0f, 1.0f); // Reset scale for UI elements
+    }
 
     // --- Draw UI Elements (buttons and debug info) ---
     SDL_Color button_bg_color = {100, 100, 200, 255}; // Blueish
@@ -162,11 +658,14 @@ void draw_tree(int offset_x, int offset_y, float scale) {
     SDL_Rect add256_btn_rect = {180, 10, 160, 40};
     SDL_Rect cleanup_btn_rect = {350, 10, 160, 40};
     SDL_Rect toggle_debug_btn_rect = {520, 10, 160, 40};
+    SDL_Rect view_btn_rect = {690, 10, 160, 40};
 
     draw_button("Добавить 64 байта", add64_btn_rect, button_bg_color, button_text_color);
     draw_button("Добавить 256 байт", add256_btn_rect, button_bg_color, button_text_color);
     draw_button("Очистить дерево", cleanup_btn_rect, button_bg_color, button_text_color);
     draw_button(debug_info_visible ? "Скрыть отладку" : "Показать отладку", toggle_debug_btn_rect, button_bg_color, button_text_color);
+    draw_button(view_mode == VIEW_HEATMAP ? "Дерево" : "Карта памяти", view_btn_rect, button_bg_color, button_text_color);
+    draw_timeline();
 
 
     // Debug info at the bottom (only if visible)
@@ -230,29 +729,45 @@ void draw_rect_with_text(int x, int y, size_t size, void* addr, int is_free) {
     }
 }
 
+// Разделитель внутреннего узла B+-дерева: только граница адресов, без размера и состояния
+static void draw_separator(int x, int y, void* addr) {
+    SDL_Rect rect = {x - NODE_WIDTH / 2, y, NODE_WIDTH, NODE_HEIGHT};
+    SDL_SetRenderDrawColor(renderer, 110, 110, 130, 255);
+    SDL_RenderFillRect(renderer, &rect);
+    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+    SDL_RenderDrawRect(renderer, &rect);
+
+    if (font) {
+        char text_addr[32];
+        snprintf(text_addr, sizeof(text_addr), ">= %p", addr);
+        SDL_Color color = {255, 255, 255, 255};
+        int addr_w, addr_h;
+        TTF_SizeUTF8(font, text_addr, &addr_w, &addr_h);
+        draw_text(renderer, font, text_addr, color, x - addr_w / 2, y + (NODE_HEIGHT - addr_h) / 2, 0, 0);
+    }
+}
+
 void draw_node(BNode* node, int x, int y, int depth, int* node_count, int parent_x, int parent_y, float scale, LevelInfo* levels) {
     if (!node) return;
+    bnode_prefetch_children(node); // Дети рисуются следом
 
     int current_node_center_x = x;
 
     // Calculate dynamic horizontal spacing based on the current level's total width and number of nodes
-    int total_nodes_on_level = 0;
-    for (int i = 0; i < node->n; i++) {
-        if (node->blocks[i]) {
-            total_nodes_on_level++;
-        }
-    }
+    int total_nodes_on_level = node->n;
 
     int current_level_width = total_nodes_on_level * NODE_WIDTH + (total_nodes_on_level > 0 ? (total_nodes_on_level - 1) * HORIZONTAL_SPACING : 0);
     int starting_x = x - current_level_width / 2;
 
     int block_x_offset = starting_x;
     for (int i = 0; i < node->n; i++) {
-        if (node->blocks[i]) { // Проверяем, что блок не NULL
-            draw_rect_with_text(block_x_offset + NODE_WIDTH / 2, y, node->sizes[i], node->blocks[i], node->is_free[i]);
+        if (node->leaf) {
+            draw_rect_with_text(block_x_offset + NODE_WIDTH / 2, y, bnode_size(node, i), bnode_block(node, i), bnode_is_free(node, i));
             (*node_count)++;
-            block_x_offset += NODE_WIDTH + HORIZONTAL_SPACING;
+        } else {
+            draw_separator(block_x_offset + NODE_WIDTH / 2, y, btree_key_ptr(node->seps[i]));
         }
+        block_x_offset += NODE_WIDTH + HORIZONTAL_SPACING;
     }
     
     // Connect to parent (if not root)
@@ -261,14 +776,13 @@ void draw_node(BNode* node, int x, int y, int depth, int* node_count, int parent
         SDL_RenderDrawLine(renderer, current_node_center_x, y, parent_x, parent_y + NODE_HEIGHT);
     }
 
+    if (node->leaf) return;
     int child_start_x_for_level = x - (node->n * (NODE_WIDTH + HORIZONTAL_SPACING)) / 2;
     for (int i = 0; i <= node->n; i++) {
-        if (node->children[i]) {
-            int child_x = child_start_x_for_level + i * (NODE_WIDTH + HORIZONTAL_SPACING) + NODE_WIDTH / 2;
-            SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-            SDL_RenderDrawLine(renderer, current_node_center_x, y + NODE_HEIGHT, child_x, y + VERTICAL_SPACING);
-            draw_node(node->children[i], child_x, y + VERTICAL_SPACING, depth + 1, node_count, current_node_center_x, y, scale, levels);
-        }
+        int child_x = child_start_x_for_level + i * (NODE_WIDTH + HORIZONTAL_SPACING) + NODE_WIDTH / 2;
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+        SDL_RenderDrawLine(renderer, current_node_center_x, y + NODE_HEIGHT, child_x, y + VERTICAL_SPACING);
+        draw_node(node->children[i], child_x, y + VERTICAL_SPACING, depth + 1, node_count, current_node_center_x, y, scale, levels);
     }
 }
 
@@ -374,6 +888,8 @@ int visual_main_loop() {
     }
 
 
+    btree_add_listener(heat_on_event, NULL);
+    history_enable();
     visual_initialized = 1;
 
     int running = 1;
@@ -385,20 +901,34 @@ int visual_main_loop() {
     int drag_active = 0;
     
     // Initial centering, adjust to account for potential UI elements
-    offset_x = (WINDOW_WIDTH - (NODE_WIDTH + HORIZONTAL_SPACING) * T * 2) / 2; // Rough estimate for initial centering
+    offset_x = (WINDOW_WIDTH - (NODE_WIDTH + HORIZONTAL_SPACING) * BTREE_FANOUT) / 2; // Rough estimate for initial centering
 
     // Define button rectangles for click detection (same as drawing)
     SDL_Rect add64_btn_rect = {10, 10, 160, 40};
     SDL_Rect add256_btn_rect = {180, 10, 160, 40};
     SDL_Rect cleanup_btn_rect = {350, 10, 160, 40};
     SDL_Rect toggle_debug_btn_rect = {520, 10, 160, 40};
+    SDL_Rect view_btn_rect = {690, 10, 160, 40};
 
     while (running) {
         while (SDL_PollEvent(&e)) {
             if (e.type == SDL_QUIT) running = 0;
             if (e.type == SDL_KEYDOWN) {
                 char msg[64];
+                if (replay_handle_key(e.key.keysym.sym)) {
+                    tree_changed = 1;
+                    continue;
+                }
+                if (view_mode == VIEW_HEATMAP && heat_handle_key(e.key.keysym.sym)) {
+                    tree_changed = 1;
+                    continue;
+                }
                 switch (e.key.keysym.sym) {
+                    case SDLK_m:
+                        view_mode = view_mode == VIEW_HEATMAP ? VIEW_TREE : VIEW_HEATMAP;
+                        visual_log(view_mode == VIEW_HEATMAP ? "Heat map view" : "Tree view");
+                        tree_changed = 1;
+                        break;
                     case SDLK_PLUS:
                     case SDLK_EQUALS:
                         scale += 0.1f;
@@ -446,7 +976,12 @@ int visual_main_loop() {
                 if (e.button.button == SDL_BUTTON_LEFT) {
                     // Check for button clicks
                     SDL_Point mouse_point = {e.button.x, e.button.y};
-                    if (SDL_PointInRect(&mouse_point, &add64_btn_rect)) {
+                    SDL_Rect timeline = slider_rect();
+                    if (history_enabled() && SDL_PointInRect(&mouse_point, &timeline)) {
+                        slider_drag = 1;
+                        slider_seek_to(e.button.x);
+                        tree_changed = 1;
+                    } else if (SDL_PointInRect(&mouse_point, &add64_btn_rect)) {
                         treealoc_malloc(64); // Call your malloc wrapper
                         tree_changed = 1;
                         visual_log("Button: Add 64 bytes clicked.");
@@ -464,6 +999,10 @@ int visual_main_loop() {
                         char msg[64];
                         snprintf(msg, sizeof(msg), "Button: Toggle debug info to %s", debug_info_visible ? "visible" : "hidden");
                         visual_log(msg);
+                    } else if (SDL_PointInRect(&mouse_point, &view_btn_rect)) {
+                        view_mode = view_mode == VIEW_HEATMAP ? VIEW_TREE : VIEW_HEATMAP;
+                        tree_changed = 1;
+                        visual_log(view_mode == VIEW_HEATMAP ? "Button: Heat map view" : "Button: Tree view");
                     } else {
                         // If no button was clicked, start dragging
                         drag_active = 1;
@@ -472,9 +1011,13 @@ int visual_main_loop() {
             } else if (e.type == SDL_MOUSEBUTTONUP) {
                 if (e.button.button == SDL_BUTTON_LEFT) {
                     drag_active = 0;
+                    slider_drag = 0;
                 }
             } else if (e.type == SDL_MOUSEMOTION) {
-                if (drag_active) {
+                if (slider_drag) {
+                    slider_seek_to(e.motion.x);
+                    tree_changed = 1;
+                } else if (drag_active) {
                     offset_x += e.motion.xrel;
                     offset_y += e.motion.yrel;
                     tree_changed = 1;
@@ -497,6 +1040,11 @@ int visual_main_loop() {
         SDL_Delay(100);
     }
 
+    btree_remove_listener(heat_on_event, NULL);
+    history_disable();
+    history_free_state(replay_blocks);
+    replay_blocks = NULL;
+    if (heat_texture) SDL_DestroyTexture(heat_texture);
     if (font) TTF_CloseFont(font);
     if (small_font) TTF_CloseFont(small_font);
     SDL_DestroyRenderer(renderer);